@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#include "monit.h"
+#include "engine.h"
+#include "bench.h"
+
+
+/**
+ *  Helpers shared by the benchmarks and the globals of the main program.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------------ Global */
+
+
+char   *prog = "bench";
+struct myrun Run;
+Service_T servicelist;
+Service_T servicelist_conf;
+ServiceGroup_T servicegrouplist;
+SystemInfo_T systeminfo;
+
+int ptreesize = 0;
+int oldptreesize = 0;
+ProcessTree_T *ptree = NULL;
+ProcessTree_T *oldptree = NULL;
+
+char actionnames[][STRLEN]   = {"ignore", "alert", "restart", "stop", "exec", "unmonitor", "start", "monitor", ""};
+char modenames[][STRLEN]     = {"active", "passive", "manual"};
+char checksumnames[][STRLEN] = {"UNKNOWN", "MD5", "SHA1", "SHA256", "XXH64"};
+char operatornames[][STRLEN] = {"greater than", "less than", "equal to", "not equal to"};
+char operatorshortnames[][3] = {">", "<", "=", "!="};
+char monitornames[][STRLEN]  = {"not monitored", "monitored", "initializing"};
+char statusnames[][STRLEN]   = {"accessible", "accessible", "accessible", "running", "online with all services", "running", "accessible"};
+char servicetypes[][STRLEN]  = {"Filesystem", "Directory", "File", "Process", "Remote Host", "System", "Fifo"};
+char pathnames[][STRLEN]     = {"Path", "Path", "Path", "Pid file", "Path", "", "Path"};
+char icmpnames[19][STRLEN]   = {"Echo Reply", "", "", "Destination Unreachable", "Source Quench", "Redirect", "", "", "Echo Request", "", "", "Time Exceeded", "Parameter Problem", "Timestamp Request", "Timestamp Reply", "Information Request", "Information Reply", "Address Mask Request", "Address Mask Reply"};
+char sslnames[][STRLEN]      = {"auto", "v2", "v3", "tls"};
+
+static Service_T tail = NULL;          /**< The last service in the list */
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/**
+ * The benchmarks don't run as a daemon
+ */
+int do_wakeupcall() {
+  return FALSE;
+}
+
+
+void Bench_init() {
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&Run.mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+
+double Bench_now() {
+  struct timeval t;
+
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec / 1000000.;
+}
+
+
+Service_T Bench_service(int type, const char *name) {
+  Service_T s;
+
+  NEW(s);
+  NEW(s->inf);
+  Util_resetInfo(s);
+  s->type    = type;
+  s->name    = xstrdup(name);
+  s->monitor = MONITOR_YES;
+  s->mode    = MODE_ACTIVE;
+  gettimeofday(&s->collected, NULL);
+  pthread_mutex_init(&s->mutex, NULL);
+  Util_indexService(s);
+
+  if (tail) {
+    tail->next = s;
+    tail->next_conf = s;
+  } else {
+    servicelist = servicelist_conf = s;
+  }
+  tail = s;
+
+  return s;
+}
+
+
+void Bench_startHttpd(int port) {
+  int i, fd;
+
+  Run.httpdport = port;
+  Run.bind_addr = "127.0.0.1";
+  Run.pidfile   = "bench.pid";
+  add_net_allow("127.0.0.1/8");
+  monit_http(START_HTTP);
+  for (i = 0; (fd = Bench_connect(port)) < 0; i++) {
+    if (i == 50) {
+      fprintf(stderr, "http server not available at port %d\n", port);
+      exit(1);
+    }
+    Util_usleep(100000);
+  }
+  close(fd);
+}
+
+
+int Bench_connect(int port) {
+  int                fd;
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_BENCH_H
+#define MONIT_BENCH_H
+
+
+/**
+ *  Helpers shared by the benchmarks. The benchmarks are linked with the
+ *  monit sources except the parser and the main program, this module
+ *  provides the globals of the main program instead. The benchmarks are
+ *  built by 'make bench' and are not installed.
+ *
+ *  @file
+ */
+
+
+/**
+ * Initialize the run mutex as the main program does, it is recursive
+ * as the event handling may post new events
+ */
+void Bench_init();
+
+
+/**
+ * @return The wall clock time in seconds
+ */
+double Bench_now();
+
+
+/**
+ * Create a monitored service and append it to the service list and to
+ * the service index, the same way the parser does
+ * @param type The service type
+ * @param name The service name
+ * @return The new service
+ */
+Service_T Bench_service(int type, const char *name);
+
+
+/**
+ * Start the monit http server on the loopback interface in its thread
+ * and wait until it accepts connections. The server accepts the local
+ * clients only, without credentials.
+ * @param port The port number
+ */
+void Bench_startHttpd(int port);
+
+
+/**
+ * Connect to a local server
+ * @param port The port number
+ * @return The connected socket or -1 on error
+ */
+int Bench_connect(int port);
+
+
+#endif
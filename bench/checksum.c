@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "monit.h"
+#include "bench.h"
+
+
+/**
+ *  Checksum benchmark. A file of pseudo random content is written to a
+ *  temporary file, so it is in the page cache, and its checksum is
+ *  computed by Util_getChecksum() with every hash type. The sha256 type
+ *  is available with SSL support only.
+ *
+ *  Usage: bench/checksum [megabytes [rounds]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static struct {
+  int   type;
+  char *name;
+  int   supported;
+} hashes[] = {
+  {HASH_MD5,    "MD5",    TRUE},
+  {HASH_SHA1,   "SHA1",   TRUE},
+#ifdef HAVE_OPENSSL
+  {HASH_SHA256, "SHA256", TRUE},
+#else
+  {HASH_SHA256, "SHA256", FALSE},
+#endif
+  {HASH_XXH64,  "XXH64",  TRUE}
+};
+
+#define HASHES (sizeof(hashes) / sizeof(hashes[0]))
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int            i, j, fd;
+  long           size = (argc > 1 ? atol(argv[1]) : 512) * 1024 * 1024;
+  int            rounds = argc > 2 ? atoi(argv[2]) : 3;
+  char           path[] = "/tmp/monit-bench-XXXXXX";
+  unsigned int   seed = 1;
+  unsigned char *block = xmalloc(1024 * 1024);
+  long           written;
+
+  if ((fd = mkstemp(path)) < 0) {
+    perror("cannot create the file");
+    exit(1);
+  }
+  for (written = 0; written < size; written += 1024 * 1024) {
+    for (i = 0; i < 1024 * 1024; i++)
+      block[i] = (unsigned char)((seed = seed * 1103515245 + 12345) >> 16);
+    if (write(fd, block, 1024 * 1024) != 1024 * 1024) {
+      perror("cannot write the file");
+      unlink(path);
+      exit(1);
+    }
+  }
+  close(fd);
+  FREE(block);
+
+  printf("%ld MB, %d rounds\n", size / (1024 * 1024), rounds);
+
+  for (i = 0; i < HASHES; i++) {
+    MD_T   sum;
+    double t;
+
+    if (! hashes[i].supported) {
+      printf("%-8s not supported\n", hashes[i].name);
+      continue;
+    }
+    t = Bench_now();
+    for (j = 0; j < rounds; j++)
+      if (! Util_getChecksum(path, hashes[i].type, sum, sizeof(sum)))
+        break;
+    t = Bench_now() - t;
+    if (j < rounds)
+      printf("%-8s failed\n", hashes[i].name);
+    else
+      printf("%-8s %6.2f GB/s  %s\n", hashes[i].name, (double)size * rounds / t / (1024 * 1024 * 1024), sum);
+  }
+
+  unlink(path);
+
+  return 0;
+}
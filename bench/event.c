@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#include "monit.h"
+#include "event.h"
+#include "bench.h"
+
+
+/**
+ *  Event posting benchmark. Every service has a number of tests with
+ *  their own event action, each test posts its event in every cycle as
+ *  the checks do. Every test fails once and recovers, so its event
+ *  exists, then the steady cycles where all tests keep succeeding are
+ *  timed. A failed event is logged in every cycle, so the failing cycles
+ *  would measure the log output. The log of the setup, which goes to
+ *  stderr, is discarded.
+ *
+ *  Usage: bench/event [services [tests [cycles]]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The event ids used by the tests, cycled if there are more tests */
+static long ids[] = {
+  Event_Checksum, Event_Resource, Event_Timeout, Event_Timestamp, Event_Size,
+  Event_Connection, Event_Permission, Event_Uid, Event_Gid, Event_Nonexist,
+  Event_Invalid, Event_Data, Event_Exec, Event_Fsflag, Event_Icmp,
+  Event_Content, Event_Pid, Event_PPid
+};
+
+#define IDS (sizeof(ids) / sizeof(ids[0]))
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void post(Service_T *service, EventAction_T *action, int services, int tests, short state) {
+  int i, j;
+
+  for (i = 0; i < services; i++)
+    for (j = 0; j < tests; j++)
+      Event_post(service[i], ids[j % IDS], state, action[i * tests + j], "test %d of service %s %s", j, service[i]->name, state == STATE_SUCCEEDED ? "succeeded" : "failed");
+}
+
+
+static void run(const char *name, Service_T *service, EventAction_T *action, int services, int tests, int cycles, short state) {
+  int i;
+  double t = Bench_now();
+
+  for (i = 0; i < cycles; i++)
+    post(service, action, services, tests, state);
+  t = Bench_now() - t;
+  printf("%-22s %9d posts %8.3f s %8.0f ns/post\n", name, services * tests * cycles, t, t * 1e9 / ((double)services * tests * cycles));
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int            i, fd, null;
+  int            services = argc > 1 ? atoi(argv[1]) : 1000;
+  int            tests = argc > 2 ? atoi(argv[2]) : 30;
+  int            cycles = argc > 3 ? atoi(argv[3]) : 100;
+  Service_T     *service = xcalloc(services, sizeof(Service_T));
+  EventAction_T *action = xcalloc(services * tests, sizeof(EventAction_T));
+  Action_T       ignore;
+
+  Bench_init();
+  NEW(ignore);
+  ignore->id = ACTION_IGNORE;
+  for (i = 0; i < services; i++) {
+    char name[STRLEN];
+
+    snprintf(name, sizeof(name), "service%d", i);
+    service[i] = Bench_service(TYPE_HOST, name);
+  }
+  for (i = 0; i < services * tests; i++) {
+    NEW(action[i]);
+    action[i]->failed = action[i]->succeeded = ignore;
+  }
+
+  printf("%d services, %d tests per service, %d cycles\n", services, tests, cycles);
+
+  /* Discard the log of the failures and recoveries */
+  fflush(stderr);
+  fd = dup(STDERR_FILENO);
+  if ((null = open("/dev/null", O_WRONLY)) >= 0) {
+    dup2(null, STDERR_FILENO);
+    close(null);
+  }
+  post(service, action, services, tests, STATE_FAILED);
+  post(service, action, services, tests, STATE_SUCCEEDED);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+  run("succeeded", service, action, services, tests, cycles, STATE_SUCCEEDED);
+
+  return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "monit.h"
+#include "bench.h"
+
+
+/**
+ *  HTTP server benchmark. The monit http server is started on the
+ *  loopback interface and the given number of clients request the same
+ *  page as fast as they can. The clients use HTTP/1.1 and keep the
+ *  connection open until the server closes it. The number of requests
+ *  answered per second is reported.
+ *
+ *  Usage: bench/httpd [clients [seconds [url [port]]]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static char  *url = "/_ping";
+static int    port = 28120;
+static double deadline;
+
+/* Result of one client */
+typedef struct myclient {
+  pthread_t thread;
+  long      requests;                          /**< The requests answered */
+  long      connections;                      /**< The connections opened */
+  long      errors;                            /**< The failed requests */
+} Client_T;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Send one request and read the response
+ * @return TRUE if the connection may be used again, FALSE if it was
+ * closed by the server, -1 on error
+ */
+static int request(int fd) {
+  int  n, length = 0, header = 0, body = 0, keepalive;
+  char buf[65536], *end, *p;
+
+  snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n", url);
+  if (write(fd, buf, strlen(buf)) <= 0)
+    return -1;
+
+  /* Read the header, the body may follow in the same read */
+  *buf = 0;
+  while (! (end = strstr(buf, "\r\n\r\n"))) {
+    if (header == sizeof(buf) - 1 || (n = read(fd, buf + header, sizeof(buf) - 1 - header)) <= 0)
+      return -1;
+    header += n;
+    buf[header] = 0;
+  }
+  if (strncmp(buf, "HTTP/1.1 200", 12))
+    return -1;
+  *end = 0;
+  if ((p = strstr(buf, "Content-Length:")))
+    length = atoi(p + 15);
+  keepalive = strstr(buf, "Connection: keep-alive") != NULL;
+  body = header - (int)(end + 4 - buf);
+
+  /* Skip the rest of the body */
+  while (body < length) {
+    if ((n = read(fd, buf, MIN(sizeof(buf), length - body))) <= 0)
+      return -1;
+    body += n;
+  }
+  return keepalive;
+}
+
+
+static void *client(void *arg) {
+  int       fd = -1;
+  Client_T *c = arg;
+
+  while (Bench_now() < deadline) {
+    int rv;
+
+    if (fd < 0) {
+      if ((fd = Bench_connect(port)) < 0) {
+        c->errors++;
+        continue;
+      }
+      c->connections++;
+    }
+    if ((rv = request(fd)) < 0)
+      c->errors++;
+    else
+      c->requests++;
+    if (rv <= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd >= 0)
+    close(fd);
+  return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int       i;
+  int       clients = argc > 1 ? atoi(argv[1]) : 100;
+  int       seconds = argc > 2 ? atoi(argv[2]) : 5;
+  long      requests = 0, connections = 0, errors = 0;
+  double    t;
+  Client_T *client_list;
+
+  if (argc > 3)
+    url = argv[3];
+  if (argc > 4)
+    port = atoi(argv[4]);
+  Bench_init();
+  for (i = 0; i < 100; i++) {
+    char name[STRLEN];
+
+    snprintf(name, sizeof(name), "service%d", i);
+    Bench_service(TYPE_HOST, name)->path = "localhost";
+  }
+
+  Bench_startHttpd(port);
+
+  printf("%d clients, %d seconds, GET %s\n", clients, seconds, url);
+
+  client_list = xcalloc(clients, sizeof(Client_T));
+  t = Bench_now();
+  deadline = t + seconds;
+  for (i = 0; i < clients; i++)
+    if (pthread_create(&client_list[i].thread, NULL, client, &client_list[i]) != 0) {
+      perror("cannot create the client thread");
+      exit(1);
+    }
+  for (i = 0; i < clients; i++) {
+    pthread_join(client_list[i].thread, NULL);
+    requests += client_list[i].requests;
+    connections += client_list[i].connections;
+    errors += client_list[i].errors;
+  }
+  t = Bench_now() - t;
+  printf("%9.0f requests/s, %.1f requests/connection, %ld errors\n", requests / t, connections ? (double)requests / connections : 0, errors);
+
+  monit_http(STOP_HTTP);
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_REGEX_H
+#include <regex.h>
+#endif
+
+#include "monit.h"
+#include "matcher.h"
+#include "bench.h"
+
+
+/**
+ *  Content match benchmark. A synthetic log with lines of varying length
+ *  is written to a temporary file and matched from the beginning by
+ *  check_file() in every cycle, as when the log grew by the whole file
+ *  between two cycles. One line in a thousand matches a rule. The plain
+ *  read of the file by the same block size is timed for reference.
+ *
+ *  Usage: bench/match [megabytes [cycles]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The match rules of the service */
+static char *rules[] = {"ERROR [0-9]+", "segfault at", "Out of memory"};
+
+#define RULES (sizeof(rules) / sizeof(rules[0]))
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Write the synthetic log
+ * @return The number of lines
+ */
+static long write_log(FILE *f, long size) {
+  long  lines = 0, written = 0;
+
+  while (written < size) {
+    int n;
+
+    if (lines % 1000 == 999)
+      n = fprintf(f, "Oct 16 12:00:%02ld host app[%ld]: ERROR %ld request failed\n", lines % 60, lines % 32768, lines);
+    else
+      n = fprintf(f, "Oct 16 12:00:%02ld host app[%ld]: request %ld served in %ld ms from cache %.*s\n", lines % 60, lines % 32768, lines, lines % 997, (int)(lines % 80), "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef");
+    if (n <= 0)
+      break;
+    written += n;
+    lines++;
+  }
+  return lines;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int           i, fd;
+  long          size = (argc > 1 ? atol(argv[1]) : 50) * 1024 * 1024;
+  int           cycles = argc > 2 ? atoi(argv[2]) : 5;
+  long          lines;
+  char          path[] = "/tmp/monit-bench-XXXXXX";
+  double        t;
+  FILE         *f;
+  struct stat   st;
+  Service_T     s;
+  Action_T      ignore;
+  EventAction_T action;
+
+  if ((fd = mkstemp(path)) < 0 || ! (f = fdopen(fd, "w"))) {
+    perror("cannot create the log");
+    exit(1);
+  }
+  lines = write_log(f, size);
+  fclose(f);
+  stat(path, &st);
+
+  Bench_init();
+  NEW(ignore);
+  ignore->id = ACTION_IGNORE;
+  NEW(action);
+  action->failed = action->succeeded = ignore;
+  s = Bench_service(TYPE_FILE, "log");
+  s->path  = xstrdup(path);
+  s->check = check_file;
+  s->action_NONEXIST = s->action_INVALID = action;
+  for (i = RULES - 1; i >= 0; i--) {
+    Match_T m;
+
+    NEW(m);
+    m->match_string = xstrdup(rules[i]);
+    /* Every rule has its own action, which identifies its event */
+    NEW(m->action);
+    m->action->failed = m->action->succeeded = ignore;
+#ifdef HAVE_REGEX_H
+    NEW(m->regex_comp);
+    regcomp(m->regex_comp, m->match_string, REG_NOSUB|REG_EXTENDED);
+#endif
+    m->next = s->matchlist;
+    s->matchlist = m;
+  }
+  s->matcher = Matcher_new(s->matchlist);
+  /* The file was seen before, so the content is matched from the beginning */
+  s->inf->priv.file.st_ino = st.st_ino;
+
+  printf("%ld MB, %ld lines, %d rules, %d cycles\n", (long)(st.st_size / (1024 * 1024)), lines, (int)RULES, cycles);
+
+  t = Bench_now();
+  for (i = 0; i < cycles; i++) {
+    s->inf->priv.file.readpos = 0;
+    check_file(s);
+    if (s->inf->priv.file.readpos != st.st_size) {
+      fprintf(stderr, "read position %lld, expected %lld\n", (long long)s->inf->priv.file.readpos, (long long)st.st_size);
+      exit(1);
+    }
+  }
+  t = Bench_now() - t;
+  printf("%-22s %9.1f MB/s, %.0f lines/s\n", "check_file", st.st_size * (double)cycles / t / (1024 * 1024), lines * (double)cycles / t);
+
+  t = Bench_now();
+  for (i = 0; i < cycles; i++) {
+    char   *buffer = xmalloc(65536);
+    ssize_t n;
+
+    fd = open(path, O_RDONLY);
+    while ((n = read(fd, buffer, 65536)) > 0)
+      ;
+    close(fd);
+    FREE(buffer);
+  }
+  t = Bench_now() - t;
+  printf("%-22s %9.1f MB/s\n", "read", st.st_size * (double)cycles / t / (1024 * 1024));
+
+  unlink(path);
+
+  return 0;
+}
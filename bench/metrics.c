@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#include "monit.h"
+#include "protocol.h"
+#include "process.h"
+#include "bench.h"
+
+
+/**
+ *  Metrics endpoint benchmark. The monit http server is started with
+ *  file, directory, process, filesystem and remote host services, each
+ *  remote host has two ports. The /_metrics page is scraped repeatedly
+ *  by one client, first while the daemon is idle and then while the
+ *  validation runs in another thread, where every check holds its
+ *  service for the given time.
+ *
+ *  Usage: bench/metrics [services [scrapes [check_ms [port]]]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static int  port = 28130;
+static long latency = 1000;
+static int  validating = TRUE;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static int check_latency(Service_T s) {
+  Util_usleep(latency);
+  return TRUE;
+}
+
+
+static void *validation(void *arg) {
+  while (validating)
+    validate();
+  return NULL;
+}
+
+
+/**
+ * Scrape the metrics page
+ * @return The size of the response or -1 on error
+ */
+static long scrape() {
+  int  fd;
+  long n, size = 0;
+  char buf[65536], *request = "GET /_metrics HTTP/1.0\r\n\r\n";
+
+  if ((fd = Bench_connect(port)) < 0)
+    return -1;
+  if (write(fd, request, strlen(request)) > 0)
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+      size += n;
+  close(fd);
+  return size;
+}
+
+
+/**
+ * Scrape the metrics page repeatedly and print the average and maximum
+ * time taken
+ */
+static void run(const char *name, int scrapes) {
+  int    i;
+  long   size = 0;
+  double t, max = 0, total = 0;
+
+  for (i = 0; i < scrapes; i++) {
+    t = Bench_now();
+    if ((size = scrape()) <= 0) {
+      fprintf(stderr, "scrape failed\n");
+      exit(1);
+    }
+    t = Bench_now() - t;
+    total += t;
+    if (t > max)
+      max = t;
+  }
+  printf("%-22s %9.2f ms/scrape, %.2f ms max, %ld bytes\n", name, total * 1000 / scrapes, max * 1000, size);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int       i;
+  int       services = argc > 1 ? atoi(argv[1]) : 5000;
+  int       scrapes = argc > 2 ? atoi(argv[2]) : 20;
+  int       types[] = {TYPE_FILE, TYPE_DIRECTORY, TYPE_PROCESS, TYPE_FILESYSTEM, TYPE_HOST};
+  pthread_t thread;
+
+  if (argc > 3)
+    latency = atol(argv[3]) * 1000;
+  if (argc > 4)
+    port = atoi(argv[4]);
+  Bench_init();
+  init_process_info();
+  for (i = 0; i < services; i++) {
+    char      name[STRLEN];
+    Service_T s;
+
+    snprintf(name, sizeof(name), "service%d", i);
+    s = Bench_service(types[i % 5], name);
+    s->check = check_latency;
+    if (s->type == TYPE_HOST) {
+      int j;
+
+      s->path = xstrdup("localhost");
+      for (j = 0; j < 2; j++) {
+        Port_T p;
+
+        NEW(p);
+        p->hostname     = xstrdup(s->path);
+        p->port         = 8000 + j;
+        p->family       = AF_INET;
+        p->type         = SOCK_STREAM;
+        p->protocol     = create_http();
+        p->is_available = TRUE;
+        p->response     = 0.001 * (j + 1);
+        p->next         = s->portlist;
+        s->portlist     = p;
+      }
+    } else {
+      snprintf(name, sizeof(name), "/var/lib/bench/service%d", i);
+      s->path = xstrdup(name);
+    }
+  }
+  Bench_startHttpd(port);
+
+  printf("%d services, %d scrapes, %ld ms checks\n", services, scrapes, latency / 1000);
+
+  run("idle", scrapes);
+  if (pthread_create(&thread, NULL, validation, NULL) != 0) {
+    perror("cannot create the validation thread");
+    exit(1);
+  }
+  run("during validation", scrapes);
+  validating = FALSE;
+  Run.stopped = TRUE;
+  pthread_join(thread, NULL);
+
+  monit_http(STOP_HTTP);
+
+  return 0;
+}
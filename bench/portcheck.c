@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#include "monit.h"
+#include "protocol.h"
+#include "process.h"
+#include "bench.h"
+
+
+/**
+ *  Port check benchmark. Every port of the remote host services is
+ *  served by a local stand-in server which speaks the ssh version
+ *  exchange and sends its identification after the injected latency,
+ *  as a loaded server does. The validate() cycle is timed sequentially
+ *  and with more workers, where the ports of a service are tested
+ *  concurrently.
+ *
+ *  Usage: bench/portcheck [hosts [ports [latency_ms [cycles]]]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static long latency = 20000;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Serve one connection of the stand-in server
+ */
+static void *serve(void *arg) {
+  int  fd = (int)(long)arg;
+  char c, *banner = "SSH-2.0-bench\r\n";
+
+  Util_usleep(latency);
+  if (write(fd, banner, strlen(banner)) > 0)
+    while (read(fd, &c, 1) == 1 && c != '\n')
+      ;
+  close(fd);
+  return NULL;
+}
+
+
+/**
+ * Accept the connections of the stand-in server, each one is served by
+ * its own thread
+ */
+static void *server(void *arg) {
+  int fd, listener = (int)(long)arg;
+
+  while ((fd = accept(listener, NULL, NULL)) >= 0) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, serve, (void *)(long)fd) != 0) {
+      close(fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+
+/**
+ * Start a stand-in server on a free local port
+ * @return The port number
+ */
+static int start_server() {
+  int                listener;
+  pthread_t          thread;
+  struct sockaddr_in addr;
+  socklen_t          length = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 64) < 0 ||
+      getsockname(listener, (struct sockaddr *)&addr, &length) < 0 ||
+      pthread_create(&thread, NULL, server, (void *)(long)listener) != 0) {
+    perror("cannot start the stand-in server");
+    exit(1);
+  }
+  pthread_detach(thread);
+  return ntohs(addr.sin_port);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int           i, j, workers;
+  int           hosts = argc > 1 ? atoi(argv[1]) : 10;
+  int           ports = argc > 2 ? atoi(argv[2]) : 8;
+  int           cycles = argc > 4 ? atoi(argv[4]) : 3;
+  double        t;
+  Action_T      ignore;
+  EventAction_T action;
+
+  if (argc > 3)
+    latency = atol(argv[3]) * 1000;
+  Bench_init();
+  init_process_info();
+  NEW(ignore);
+  ignore->id = ACTION_IGNORE;
+  NEW(action);
+  action->failed = action->succeeded = ignore;
+  for (i = 0; i < hosts; i++) {
+    char      name[STRLEN];
+    Service_T s;
+
+    snprintf(name, sizeof(name), "host%d", i);
+    s = Bench_service(TYPE_HOST, name);
+    s->path  = xstrdup("127.0.0.1");
+    s->check = check_remote_host;
+    for (j = 0; j < ports; j++) {
+      Port_T p;
+
+      NEW(p);
+      p->hostname = xstrdup(s->path);
+      p->port     = start_server();
+      p->type     = SOCK_STREAM;
+      p->family   = AF_INET;
+      p->timeout  = 5;
+      p->action   = action;
+      p->protocol = create_ssh();
+      p->next     = s->portlist;
+      s->portlist = p;
+    }
+  }
+
+  printf("%d hosts, %d ports per host, %ld ms latency, %d cycles\n", hosts, ports, latency / 1000, cycles);
+
+  for (workers = 1; workers <= 8; workers *= 2) {
+    int       available = 0;
+    Service_T s;
+    Port_T    p;
+
+    Run.workers = workers;
+    t = Bench_now();
+    for (i = 0; i < cycles; i++)
+      validate();
+    t = Bench_now() - t;
+    for (s = servicelist; s; s = s->next)
+      for (p = s->portlist; p; p = p->next)
+        available += p->is_available;
+    printf("%2d workers %9.1f ms/cycle (%d ports available)\n", workers, t * 1000 / cycles, available);
+  }
+
+  return 0;
+}
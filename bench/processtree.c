@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "process.h"
+#include "process_sysdep.h"
+#include "bench.h"
+
+
+/**
+ *  Process tree benchmark. The benchmark is linked with a synthetic
+ *  process table instead of the system specific module: every process
+ *  has four children and the pids are not contiguous. The tree build by
+ *  initprocesstree(), which looks up the previous cycle entry and the
+ *  parent of every process, and the pid lookups of the services are
+ *  timed. The linear lookup of the previous versions is timed on a copy
+ *  of the tree, which isn't indexed.
+ *
+ *  Usage: bench/processtree [processes [cycles]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static int  processes = 50000;
+static long cputime = 0;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static int pid_of(int i) {
+  return i * 7 + 1;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int init_process_info_sysdep(void) {
+  systeminfo.cpus = 1;
+  systeminfo.mem_kbyte_max = 1048576;
+  return TRUE;
+}
+
+
+int getloadavg_sysdep(double *loadv, int nelem) {
+  int i;
+
+  for (i = 0; i < nelem; i++)
+    loadv[i] = 0;
+  return nelem;
+}
+
+
+int used_system_memory_sysdep(SystemInfo_T *si) {
+  si->total_mem_kbyte = si->mem_kbyte_max / 2;
+  return TRUE;
+}
+
+
+int used_system_cpu_sysdep(SystemInfo_T *si) {
+  si->total_cpu_user_percent = si->total_cpu_syst_percent = si->total_cpu_wait_percent = 0;
+  return TRUE;
+}
+
+
+int initprocesstree_sysdep(ProcessTree_T **reference) {
+  int i;
+  ProcessTree_T *pt = xcalloc(processes, sizeof(ProcessTree_T));
+
+  cputime += 10;
+  for (i = 0; i < processes; i++) {
+    pt[i].pid       = pid_of(i);
+    pt[i].ppid      = i ? pid_of((i - 1) / 4) : 0;
+    pt[i].time      = cputime;
+    pt[i].cputime   = cputime + i % 10;
+    pt[i].mem_kbyte = 1024;
+  }
+  *reference = pt;
+
+  return processes;
+}
+
+
+int main(int argc, char **argv) {
+  int i, j, found = 0;
+  int cycles = argc > 2 ? atoi(argv[2]) : 10;
+  int lookups;
+  double t;
+  ProcessTree_T *copy;
+
+  if (argc > 1)
+    processes = atoi(argv[1]);
+  init_process_info();
+
+  printf("%d processes, %d cycles\n", processes, cycles);
+
+  t = Bench_now();
+  for (i = 0; i < cycles; i++)
+    if (initprocesstree(&ptree, &ptreesize, &oldptree, &oldptreesize) <= 0)
+      exit(1);
+  t = Bench_now() - t;
+  printf("%-22s %9.3f ms/cycle\n", "initprocesstree", t * 1000 / cycles);
+
+  /* Every process is looked up once, as by the process services */
+  t = Bench_now();
+  for (i = 0; i < processes; i++)
+    if (findprocess(pid_of(i), ptree, ptreesize) != -1)
+      found++;
+  t = Bench_now() - t;
+  printf("%-22s %9.0f ns/lookup (%d found)\n", "indexed findprocess", t * 1e9 / processes, found);
+
+  /* The linear scan is too slow to look up every process */
+  copy = xcalloc(ptreesize, sizeof(ProcessTree_T));
+  memcpy(copy, ptree, ptreesize * sizeof(ProcessTree_T));
+  lookups = MIN(processes, 1000);
+  t = Bench_now();
+  for (i = 0, found = 0; i < lookups; i++) {
+    j = (int)((long long)i * processes / lookups);
+    if (findprocess(pid_of(j), copy, ptreesize) != -1)
+      found++;
+  }
+  t = Bench_now() - t;
+  printf("%-22s %9.0f ns/lookup (%d found)\n", "linear findprocess", t * 1e9 / lookups, found);
+  FREE(copy);
+
+  return 0;
+}
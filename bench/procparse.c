@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "process.h"
+#include "process_sysdep.h"
+#include "bench.h"
+
+/* The /proc files read by the process scan are counted */
+int bench_read_proc_file(char *, int, char *, int, int *);
+#define read_proc_file bench_read_proc_file
+
+/* The parsers are private to the system specific module */
+#include "process/sysdep_LINUX.c"
+
+#undef read_proc_file
+
+
+/**
+ *  /proc parser benchmark. A snapshot of /proc/self/stat, /proc/meminfo
+ *  and /proc/stat is read once and parsed repeatedly, so the parsers are
+ *  timed without the file system. The sscanf based parsing of the
+ *  previous versions is timed on the same snapshot for comparison.
+ *
+ *  The process tree is then built from the real /proc for the given
+ *  number of scans. The /proc files opened and the read syscalls made
+ *  per scan are reported, with the boot time read once and with the
+ *  /proc/uptime read per process of the previous versions.
+ *
+ *  Usage: bench/procparse [iterations [scans]]
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static unsigned long proc_files = 0;
+
+
+/**
+ * Get the number of read syscalls made by the process so far
+ */
+static unsigned long long read_syscalls() {
+  char buf[1024];
+  const char *p;
+  unsigned long long n = 0;
+
+  if (read_proc_file(buf, sizeof(buf), "io", getpid(), NULL) && (p = strstr(buf, "syscr:")))
+    n = strtoull(p + 6, NULL, 10);
+  return n;
+}
+
+
+/**
+ * Get the system start time the way the previous versions did for every
+ * process: read /proc/uptime and subtract it from the actual time
+ */
+static time_t uptime_starttime() {
+  char   buf[1024];
+  double up = 0;
+
+  if (! bench_read_proc_file(buf, sizeof(buf), "uptime", -1, NULL) || sscanf(buf, "%lf", &up) != 1)
+    return 0;
+  return time(NULL) - (time_t)up;
+}
+
+
+static void scan(const char *name, int scans, int per_process_uptime) {
+  int                i, j, n = 0;
+  unsigned long      files = proc_files;
+  unsigned long long reads = read_syscalls();
+  double             t = Bench_now();
+  ProcessTree_T     *pt;
+
+  for (i = 0; i < scans; i++) {
+    n = initprocesstree_sysdep(&pt);
+    for (j = 0; j < n; j++) {
+      if (per_process_uptime)
+        uptime_starttime();
+      FREE(pt[j].cmdline);
+    }
+    FREE(pt);
+  }
+  t = Bench_now() - t;
+  /* The read of /proc/self/io at the end is not counted */
+  reads = read_syscalls() - reads - 1;
+  printf("%-22s %9.0f us/scan %6.0f files/scan %6.0f reads/scan (%d processes)\n", name, t * 1e6 / scans, (double)(proc_files - files) / scans, (double)reads / scans, n);
+}
+
+
+static void snapshot(const char *path, char *buf, int size) {
+  int   n;
+  FILE *f = fopen(path, "r");
+
+  if (! f || (n = fread(buf, 1, size - 1, f)) <= 0) {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(1);
+  }
+  buf[n] = 0;
+  fclose(f);
+}
+
+
+static int sscanf_proc_pid_stat(const char *buf, ProcStat_T *ps) {
+  char *tmp, copy[STRLEN];
+
+  snprintf(copy, sizeof(copy), "%s", buf);
+  if (! (tmp = strrchr(copy, ')')))
+    return FALSE;
+  *tmp = 0;
+  if (sscanf(copy, "%*d (%255s", ps->name) != 1)
+    return FALSE;
+  return sscanf(tmp + 2,
+                "%c %d %*d %*d %*d %*d %*u %*u"
+                "%*u %*u %*u %lu %lu %ld %ld %*d %*d %*d "
+                "%*u %llu %*u %ld",
+                &ps->state, &ps->ppid, &ps->utime, &ps->stime, &ps->cutime, &ps->cstime, &ps->starttime, &ps->rss) == 8;
+}
+
+
+static void sscanf_meminfo(const char *buf, MemInfo_T *mi) {
+  const char *p;
+
+  memset(mi, 0, sizeof(MemInfo_T));
+  if ((p = strstr(buf, "MemTotal:")) && sscanf(p + 9, "%lu", &mi->mem_total) == 1)
+    mi->found |= MEMTOTAL;
+  if ((p = strstr(buf, "MemFree:")) && sscanf(p + 8, "%lu", &mi->mem_free) == 1)
+    mi->found |= MEMFREE;
+  if ((p = strstr(buf, "Buffers:")) && sscanf(p + 8, "%lu", &mi->buffers) == 1)
+    mi->found |= MEMBUF;
+  if ((p = strstr(buf, "Cached:")) && sscanf(p + 7, "%lu", &mi->cached) == 1)
+    mi->found |= MEMCACHE;
+  if ((p = strstr(buf, "SwapTotal:")) && sscanf(p + 10, "%lu", &mi->swap_total) == 1)
+    mi->found |= SWAPTOTAL;
+  if ((p = strstr(buf, "SwapFree:")) && sscanf(p + 9, "%lu", &mi->swap_free) == 1)
+    mi->found |= SWAPFREE;
+}
+
+
+static int sscanf_stat_cpu(const char *buf, unsigned long long *v, int count) {
+  return sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]);
+}
+
+
+static void report(const char *name, double t, int iterations) {
+  printf("%-22s %9.0f ns/parse\n", name, t * 1e9 / iterations);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int bench_read_proc_file(char *buf, int buf_size, char *name, int pid, int *bytes_read) {
+  proc_files++;
+  return read_proc_file(buf, buf_size, name, pid, bytes_read);
+}
+
+
+int main(int argc, char **argv) {
+  int                i, ok = 0;
+  int                iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+  int                scans = argc > 2 ? atoi(argv[2]) : 100;
+  double             t;
+  char               pidstat[STRLEN], meminfo[8192], stat[65536];
+  unsigned long long cpu[7];
+  ProcStat_T         ps;
+  MemInfo_T          mi;
+
+  snapshot("/proc/self/stat", pidstat, sizeof(pidstat));
+  snapshot("/proc/meminfo", meminfo, sizeof(meminfo));
+  snapshot("/proc/stat", stat, sizeof(stat));
+
+  printf("%d iterations\n", iterations);
+
+  t = Bench_now();
+  for (i = 0; i < iterations; i++)
+    ok += parse_proc_pid_stat(pidstat, &ps);
+  report("/proc/<pid>/stat", Bench_now() - t, iterations);
+
+  t = Bench_now();
+  for (i = 0; i < iterations; i++)
+    ok += sscanf_proc_pid_stat(pidstat, &ps);
+  report("  sscanf", Bench_now() - t, iterations);
+
+  t = Bench_now();
+  for (i = 0; i < iterations; i++) {
+    parse_meminfo(meminfo, &mi);
+    ok += mi.found != 0;
+  }
+  report("/proc/meminfo", Bench_now() - t, iterations);
+
+  t = Bench_now();
+  for (i = 0; i < iterations; i++) {
+    sscanf_meminfo(meminfo, &mi);
+    ok += mi.found != 0;
+  }
+  report("  strstr and sscanf", Bench_now() - t, iterations);
+
+  t = Bench_now();
+  for (i = 0; i < iterations; i++)
+    ok += parse_stat_cpu(stat, cpu, 7);
+  report("/proc/stat cpu", Bench_now() - t, iterations);
+
+  t = Bench_now();
+  for (i = 0; i < iterations; i++)
+    ok += sscanf_stat_cpu(stat, cpu, 7);
+  report("  sscanf", Bench_now() - t, iterations);
+
+  if (! init_process_info_sysdep()) {
+    fprintf(stderr, "cannot initialize the process statistic\n");
+    return 1;
+  }
+  /* Fill the command line cache, the later scans read the stat files only */
+  scan("/proc scan, first", 1, FALSE);
+  printf("%d scans\n", scans);
+  scan("/proc scan", scans, FALSE);
+  scan("  uptime per process", scans, TRUE);
+
+  return ok ? 0 : 1;
+}
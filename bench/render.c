@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "bench.h"
+
+
+/**
+ *  Status rendering benchmark. The full XML status document of the
+ *  given number of file, directory, process and remote host services is
+ *  rendered repeatedly. The rendered document is then appended to a
+ *  buffer tag by tag, once with Util_stringbuffer() and once with the
+ *  linear growth and intermediate copy of the previous versions, which
+ *  shows the cost of the buffer alone.
+ *
+ *  Usage: bench/render [services [renders]]
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Append to the buffer the way of the previous versions, growing it by
+ * the formatted length plus STRLEN
+ */
+static void legacy_stringbuffer(Buffer_T *b, const char *m, ...) {
+  va_list ap;
+  char   *buf;
+  long    need = 0;
+
+  va_start(ap, m);
+  buf = Util_formatString(m, ap, &need);
+  va_end(ap);
+  if (b->bufsize - b->bufused <= (size_t)need) {
+    b->bufsize += need + STRLEN;
+    b->buf = xresize(b->buf, b->bufsize);
+  }
+  memcpy(b->buf + b->bufused, buf, need);
+  b->bufused += need;
+  b->buf[b->bufused] = 0;
+  FREE(buf);
+}
+
+
+/**
+ * Append the document to a new buffer tag by tag
+ * @return The time taken in seconds
+ */
+static double append(const char *document, void (*f)(Buffer_T *, const char *, ...)) {
+  double      t;
+  Buffer_T    B;
+  const char *p, *q;
+
+  memset(&B, 0, sizeof(Buffer_T));
+  t = Bench_now();
+  for (p = document; *p; p = q) {
+    if (! (q = strchr(p + 1, '<')))
+      q = p + strlen(p);
+    f(&B, "%.*s", (int)(q - p), p);
+  }
+  t = Bench_now() - t;
+  if (strcmp(B.buf, document))
+    exit(1);
+  FREE(B.buf);
+  return t;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int    i, tags = 0;
+  int    services = argc > 1 ? atoi(argv[1]) : 1000;
+  int    renders = argc > 2 ? atoi(argv[2]) : 100;
+  int    types[] = {TYPE_FILE, TYPE_DIRECTORY, TYPE_PROCESS, TYPE_HOST};
+  char  *document = NULL;
+  double t;
+
+  Run.pidfile = "bench.pid";
+  for (i = 0; i < services; i++) {
+    char      name[STRLEN];
+    Service_T s;
+
+    snprintf(name, sizeof(name), "service%d", i);
+    s = Bench_service(types[i % 4], name);
+    snprintf(name, sizeof(name), "/var/lib/bench/service%d", i);
+    s->path = xstrdup(name);
+  }
+
+  t = Bench_now();
+  for (i = 0; i < renders; i++) {
+    FREE(document);
+    document = status_xml(NULL, LEVEL_FULL, 2, "127.0.0.1");
+  }
+  t = Bench_now() - t;
+  for (i = 0; document[i]; i++)
+    if (document[i] == '<')
+      tags++;
+
+  printf("%d services, %d renders, %ld bytes, %d tags\n", services, renders, (long)strlen(document), tags);
+  printf("%-22s %9.3f ms/render\n", "status_xml", t * 1000 / renders);
+  printf("%-22s %9.3f ms/document\n", "Util_stringbuffer", append(document, Util_stringbuffer) * 1000);
+  printf("%-22s %9.3f ms/document\n", "linear growth", append(document, legacy_stringbuffer) * 1000);
+  FREE(document);
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include "monit.h"
+#include "process.h"
+#include "bench.h"
+
+
+/**
+ *  Validation benchmark. The services check nothing but wait for the
+ *  given latency, as a check waiting for a remote host does, and every
+ *  tenth service depends on the previous one. The validate() cycle is
+ *  timed sequentially and with worker pools of increasing size.
+ *
+ *  Usage: bench/validate [services [latency_ms [cycles]]]
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static long latency = 1000;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static int check_latency(Service_T s) {
+  Util_usleep(latency);
+  return TRUE;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(int argc, char **argv) {
+  int    i, workers;
+  int    services = argc > 1 ? atoi(argv[1]) : 400;
+  int    cycles = argc > 3 ? atoi(argv[3]) : 5;
+  double t;
+
+  if (argc > 2)
+    latency = atol(argv[2]) * 1000;
+  Bench_init();
+  init_process_info();
+  for (i = 0; i < services; i++) {
+    char      name[STRLEN];
+    Service_T s;
+
+    snprintf(name, sizeof(name), "service%d", i);
+    s = Bench_service(TYPE_HOST, name);
+    s->check = check_latency;
+    if (i % 10 == 9) {
+      NEW(s->dependantlist);
+      snprintf(name, sizeof(name), "service%d", i - 1);
+      s->dependantlist->dependant = xstrdup(name);
+    }
+  }
+
+  printf("%d services, %ld ms latency, %d cycles\n", services, latency / 1000, cycles);
+
+  for (workers = 1; workers <= 32; workers *= 2) {
+    Run.workers = workers;
+    validate();
+    t = Bench_now();
+    for (i = 0; i < cycles; i++)
+      validate();
+    t = Bench_now() - t;
+    printf("%2d workers %9.1f ms/cycle\n", workers, t * 1000 / cycles);
+  }
+
+  return 0;
+}
@@ -29,6 +29,10 @@
 #include <stdio.h>
 #endif
 
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif 
@@ -41,7 +45,12 @@
 #include <errno.h>
 #endif 
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #include "monit.h"
+#include "net.h"
 #include "socket.h"
 #include "event.h"
 
@@ -49,6 +58,14 @@
 /**
  *  Connect to a data collector servlet and send event or status message.
  *
+ *  With the keepalive option the HTTP/1.1 connection is kept open and
+ *  reused by the following messages. The connection is shared by the
+ *  heartbeat and the notification threads, it is used with the collector
+ *  mutex locked. With the compress option the message is sent gzip
+ *  encoded. With the delta option the status report contains only the
+ *  services which changed since the last report acknowledged by the
+ *  server, every MMONIT_SNAPSHOT-th report is complete.
+ *
  *  @author Martin Pala, <martinp@tildeslash.com>
  *
  *
@@ -56,11 +73,29 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+/* Every n-th status report in the delta mode is complete */
+#define MMONIT_SNAPSHOT 10
+
+static Socket_T        mmonit_socket = NULL;          /**< Open connection */
+static Mmonit_T        mmonit_server = NULL;     /**< Connection's server */
+static Mmonit_T        mmonit_reported = NULL; /**< Server of last report */
+static int             mmonit_deltas = 0; /**< Deltas since full report */
+static pthread_mutex_t mmonit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 /* -------------------------------------------------------------- Prototypes */
 
 
-static int data_send(Socket_T, Mmonit_T, char *);
-static int data_check(Socket_T, Mmonit_T);
+static Mmonit_T open_server(Mmonit_T);
+static void close_server();
+static int data_send(Mmonit_T, char *);
+static int data_check(Mmonit_T);
+#ifdef HAVE_LIBZ
+static char *data_compress(const char *, long *);
+#endif
 
 
 /* ------------------------------------------------------------------ Public */
@@ -72,16 +107,100 @@ static int data_check(Socket_T, Mmonit_T);
  * @return If failed, return HANDLER_MMONIT flag or HANDLER_SUCCEEDED flag if succeeded
  */
 int handle_mmonit(Event_T E) {
-  char     *D = NULL;
   Mmonit_T  C = Run.mmonits;
   int       rv = HANDLER_SUCCEEDED;
-  Socket_T  socket;
 
   /* The event is sent to mmonit just once - only in the case that the state changed */
   if(!C || (E && !E->state_changed))
     return rv;
 
-  while(!(socket = socket_create_t(C->url->hostname, C->url->port, SOCKET_TCP, C->ssl, C->timeout))) {
+  LOCK(mmonit_mutex)
+  {
+    int reused = FALSE;
+
+    /* The idle connection is readable only if the server closed it */
+    if(mmonit_socket && can_read(socket_get_socket(mmonit_socket), 0))
+      close_server();
+    if(mmonit_socket) {
+      C = mmonit_server;
+      reused = TRUE;
+    }
+
+    while(TRUE) {
+      char *D;
+      int   delta = FALSE;
+
+      if(!mmonit_socket && !(C = open_server(Run.mmonits))) {
+        rv = HANDLER_MMONIT;
+        break;
+      }
+
+      if(E) {
+        D = status_xml(E, LEVEL_SUMMARY, 2, socket_get_local_host(mmonit_socket));
+      } else if(C->delta) {
+        delta = (mmonit_reported == C && mmonit_deltas < MMONIT_SNAPSHOT - 1);
+        D = status_xml_report(delta, socket_get_local_host(mmonit_socket));
+      } else {
+        D = status_xml(NULL, LEVEL_FULL, 2, socket_get_local_host(mmonit_socket));
+      }
+
+      if(!data_send(C, D) || !data_check(C)) {
+        FREE(D);
+        close_server();
+        /* The reused connection might have been closed by the server */
+        if(reused) {
+          reused = FALSE;
+          DEBUG("M/Monit: the connection to %s was closed, reconnecting\n", C->url->url);
+          continue;
+        }
+        LogError("M/Monit: communication failed (%s message)\n", E ? "event" : "status");
+        rv = HANDLER_MMONIT;
+        break;
+      }
+      FREE(D);
+      DEBUG("M/Monit: %s message sent to %s\n", E ? "event" : (delta ? "delta status" : "status"), C->url->url);
+
+      if(!E && C->delta) {
+        status_xml_acknowledge();
+        mmonit_reported = C;
+        mmonit_deltas = delta ? mmonit_deltas + 1 : 0;
+      }
+      break;
+    }
+
+    if(mmonit_socket && !mmonit_server->keepalive)
+      close_server();
+  }
+  END_LOCK;
+
+  return rv;
+}
+
+
+/**
+ * Close the connection to mmonit if open. This function is called before
+ * the mmonit servers are released, the following status report is
+ * complete.
+ */
+void mmonit_close() {
+  LOCK(mmonit_mutex)
+    close_server();
+    mmonit_reported = NULL;
+    mmonit_deltas = 0;
+  END_LOCK;
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Connect to the first available server starting with the given one
+ * @param C An mmonit object
+ * @return The connected server or NULL if no server is available
+ */
+static Mmonit_T open_server(Mmonit_T C) {
+  while(!(mmonit_socket = socket_create_t(C->url->hostname, C->url->port, SOCKET_TCP, C->ssl, C->timeout))) {
     LogError("M/Monit: cannot open a connection to %s -- %s\n", C->url->url, STRERROR);
 
     if((C = C->next)) {
@@ -89,91 +208,100 @@ int handle_mmonit(Event_T E) {
       continue;
     } else {
       LogError("M/Monit: no server available\n");
-      rv = HANDLER_MMONIT;
-      goto exit2;
+      return NULL;
     }
   }
-
-  D = status_xml(E, E ? LEVEL_SUMMARY : LEVEL_FULL, 2, socket_get_local_host(socket));
-
-  if(!data_send(socket, C, D)) {
-    LogError("M/Monit: communication failed\n");
-    rv = HANDLER_MMONIT;
-    goto exit1;
-  }
-  
-  /* Close write part of socket to indicate to M/Monit that message was sent
-  and stop M/Monit XML parser from waiting for more data */
-  socket_shutdown_write(socket);
-  
-  if(!data_check(socket, C)) {
-    LogError("M/Monit: communication failed (%s message)\n", E ? "event" : "status");
-    rv = HANDLER_MMONIT;
-    goto exit1;
-  }
-  DEBUG("M/Monit: %s message sent to %s\n", E ? "event" : "status", C->url->url);
-
-exit1:
-  FREE(D);
-  if(socket)
-    socket_free(&socket);
-exit2:
-  return rv;
+  mmonit_server = C;
+  return C;
 }
 
 
-/* ----------------------------------------------------------------- Private */
+static void close_server() {
+  if(mmonit_socket)
+    socket_free(&mmonit_socket);
+  mmonit_server = NULL;
+}
 
 
 /**
- * Send message to the server
+ * Send message to the server. The request is written at once, the body
+ * is gzip encoded if the compress option is set.
  * @param C An mmonit object
  * @param D Data to send
  * @return TRUE if the message sending succeeded otherwise FALSE
  */
-static int data_send(Socket_T socket, Mmonit_T C, char *D) {
+static int data_send(Mmonit_T C, char *D) {
   int   rv;
+  long  size = strlen(D);
+  long  headsize;
   char *auth;
-
+  char *head;
+  char *request;
+  char *body = D;
+
+#ifdef HAVE_LIBZ
+  if(C->compress && !(body = data_compress(D, &size))) {
+    body = D;
+    size = strlen(D);
+  }
+#endif
   auth = Util_getBasicAuthHeader(C->url->user, C->url->password);
-  rv = socket_print(socket,
+  head = Util_getString(
          "POST %s HTTP/1.1\r\n"
          "Host: %s:%d\r\n"
          "Content-Type: text/xml\r\n"
-         "Content-Length: %d\r\n"
+         "%s"
+         "Content-Length: %ld\r\n"
          "Pragma: no-cache\r\n"
          "Accept: */*\r\n"
          "User-Agent: %s/%s\r\n"
-         "Connection: close\r\n"
+         "Connection: %s\r\n"
          "%s"
-         "\r\n"
-         "%s",
+         "\r\n",
          C->url->path,
          C->url->hostname, C->url->port,
-         strlen(D),
+         body != D ? "Content-Encoding: gzip\r\n" : "",
+         size,
          prog, VERSION,
-         auth?auth:"",
-         D);
+         C->keepalive ? "keep-alive" : "close",
+         auth?auth:"");
+  headsize = strlen(head);
+  request = xmalloc(headsize + size);
+  memcpy(request, head, headsize);
+  memcpy(request + headsize, body, size);
+  rv = socket_write(mmonit_socket, request, headsize + size);
+  FREE(request);
+  FREE(head);
   FREE(auth);
+  if(body != D)
+    FREE(body);
   if(rv <0) {
     LogError("M/Monit: error sending data to %s -- %s\n", C->url->url, STRERROR);
     return FALSE;
   }
+  /* Close write part of socket to indicate to M/Monit that message was sent
+  and stop M/Monit XML parser from waiting for more data */
+  if(!C->keepalive)
+    socket_shutdown_write(mmonit_socket);
   return TRUE;
 }
 
 
 /**
- * Check that the server returns a valid HTTP response
+ * Check that the server returns a valid HTTP response. If the connection
+ * is kept open, the response is read completely and the connection is
+ * closed if the server doesn't keep it.
  * @param C An mmonit object
  * @return TRUE if the response is valid otherwise FALSE
  */
-static int data_check(Socket_T socket, Mmonit_T C) {
+static int data_check(Mmonit_T C) {
   int  n;
   int  status;
+  int  keep = TRUE;
+  long length = -1;
   char buf[STRLEN];
 
-  if(!socket_readln(socket, buf, sizeof(buf))) {
+  if(!socket_readln(mmonit_socket, buf, sizeof(buf))) {
     LogError("M/Monit: error receiving data from %s -- %s\n", C->url->url, STRERROR);
     return FALSE;
   }
@@ -183,6 +311,65 @@ static int data_check(Socket_T socket, Mmonit_T C) {
     LogError("M/Monit: message sending failed to %s -- %s\n", C->url->url, buf);
     return FALSE;
   }
+  if(!C->keepalive)
+    return TRUE;
+
+  /* Read the headers and skip the response body */
+  while(socket_readln(mmonit_socket, buf, sizeof(buf))) {
+    Util_chomp(buf);
+    if(!*buf)
+      break;
+    if(Util_startsWith(buf, "Content-Length:"))
+      length = strtol(buf + 15, NULL, 10);
+    else if(Util_startsWith(buf, "Connection:") && IS(Util_trim(buf + 11), "close"))
+      keep = FALSE;
+    else if(Util_startsWith(buf, "Transfer-Encoding:"))
+      keep = FALSE;
+  }
+  if(length < 0)
+    keep = FALSE;
+  while(keep && length > 0) {
+    if((n = socket_read(mmonit_socket, buf, length < (long)sizeof(buf) ? length : (long)sizeof(buf))) <= 0)
+      keep = FALSE;
+    length -= n;
+  }
+  if(!keep)
+    close_server();
   return TRUE;
 }
 
+
+#ifdef HAVE_LIBZ
+/**
+ * Compress the message with gzip
+ * @param D Data to compress
+ * @param size The data size, set to the compressed size on return
+ * @return The compressed data or NULL if failed. The caller must free
+ * the memory.
+ */
+static char *data_compress(const char *D, long *size) {
+  char     *out;
+  uLong     bound;
+  z_stream  z;
+
+  memset(&z, 0, sizeof(z));
+  /* The window bits 15 + 16 select the gzip format */
+  if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+  bound = deflateBound(&z, *size);
+  out = xmalloc(bound);
+  z.next_in = (Bytef *)D;
+  z.avail_in = *size;
+  z.next_out = (Bytef *)out;
+  z.avail_out = bound;
+  if(deflate(&z, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&z);
+    FREE(out);
+    return NULL;
+  }
+  *size = z.total_out;
+  deflateEnd(&z);
+  return out;
+}
+#endif
+
@@ -73,6 +73,8 @@
 char *device_mountpoint_sysdep(Info_T inf, char *blockdev) {
   FILE *mntfd;
   struct mntent *mnt;
+  struct mntent mntbuf;
+  char buf[PATH_MAX * 2 + STRLEN];
 
   ASSERT(inf);
   ASSERT(blockdev);
@@ -81,7 +83,8 @@ char *device_mountpoint_sysdep(Info_T inf, char *blockdev) {
     LogError("%s: Cannot open /etc/mtab file\n", prog);
     return NULL;
   }
-  while ((mnt = getmntent(mntfd)) != NULL) {
+  /* The reentrant version is used as filesystems may be checked concurrently */
+  while ((mnt = getmntent_r(mntfd, &mntbuf, buf, sizeof(buf))) != NULL) {
     char realpathbuf[PATH_MAX+1];
     /* Try to compare the the filesystem as is, if failed, try to use the symbolic link target */
     if (IS(blockdev, mnt->mnt_fsname) || (realpath(mnt->mnt_fsname, realpathbuf) && ! strcasecmp(blockdev, realpathbuf))) {
@@ -66,6 +66,14 @@
 /**
  * Implementation of the event interface.
  *
+ * The alert and M/Monit notifications are delivered by a dedicated
+ * thread in daemon mode, so a slow or unavailable mail server or M/Monit
+ * doesn't block the validation. The events are passed to the thread by
+ * a bounded in-memory queue. A failed delivery is retried with growing
+ * delay, the notification which failed repeatedly or which doesn't fit
+ * in the queue is saved to the event queue (if set) and the thread
+ * retries it with the queued events each cycle.
+ *
  * @author Jan-Henrik Haukeland, <hauk@tildeslash.com>
  * @author Martin Pala <martinp@tildeslash.com>
  * @file
@@ -100,21 +108,68 @@ EventTable_T Event_Table[]= {
   {Event_Null,       "No Event",                "No Event",                   "No Event",                 "No Event"}
 };
 
+/* Maximal number of notifications waiting for the delivery */
+#define NOTIFY_QUEUE_SIZE 1024
+
+/* Failed deliveries in a row after which the backends are considered down */
+#define NOTIFY_ATTEMPTS   4
+
+/* Delay after the first failed delivery in seconds, doubled on each failure */
+#define NOTIFY_DELAY      1
+
+typedef struct mynotification {
+  char         *data;                           /**< The serialized event */
+  int           size;                                /**< The data size */
+  unsigned int  flags;                        /**< The handlers to be done */
+  struct mynotification *next;          /**< Next notification in queue */
+} *Notification_T;
+
+static Notification_T   notify_head = NULL;
+static Notification_T   notify_tail = NULL;
+static int              notify_count = 0;
+static int              notify_stop = FALSE;
+static int              notify_replay = FALSE;
+static volatile int     notify_running = FALSE;
+static pthread_t        notify_thread;
+static pthread_mutex_t  notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   notify_cond = PTHREAD_COND_INITIALIZER;
+
 
 /* -------------------------------------------------------------- Prototypes */
 
 
+static void post_event(Service_T, long, short, EventAction_T, char *, va_list);
+static int  is_handled(Event_T);
+static unsigned int index_hash(EventAction_T, long);
+static Event_T index_find(Service_T, EventAction_T, long);
+static void index_add(Service_T, Event_T);
 static void handle_event(Event_T);
 static void handle_action(Event_T, Action_T);
+static void notify_post(Event_T);
+static void *notify_deliver(void *);
+static int  notify_send(Notification_T);
+static void notify_save(Notification_T);
+static void notify_free(Notification_T *);
 static void Event_queue_add(Event_T);
-static void Event_queue_update(Event_T, const char *);
+static void queue_process();
+static Event_T queue_restore(const char *, int, struct myeventaction *, struct myaction *);
+static int  queue_open();
+static int  queue_reserve(int);
+static unsigned int queue_priority(Event_T);
+static void queue_import();
+static char *queue_put(char *, const void *, int);
+static void *queue_get(const char **, const char *, int *);
+static char *queue_serialize(Event_T, int *);
+static Event_T queue_deserialize(const char *, int, short *);
+static int  queue_replay(void *, int, unsigned int *, void *);
 
 
 /* ------------------------------------------------------------------ Public */
 
 
 /**
- * Post a new Event
+ * Post a new Event. The event handling is serialized by the Run.mutex
+ * since services may be validated concurrently.
  * @param service The Service the event belongs to
  * @param id The event identification
  * @param state The event state
@@ -122,111 +177,13 @@ static void Event_queue_update(Event_T, const char *);
  * @param s Optional message describing the event
  */
 void Event_post(Service_T service, long id, short state, EventAction_T action, char *s, ...) {
-  Event_T e;
-
-  ASSERT(service);
-  ASSERT(action);
-  ASSERT(state == STATE_FAILED || state == STATE_SUCCEEDED || state == STATE_CHANGED || state == STATE_CHANGEDNOT);
-
-  if ((e = service->eventlist) == NULL) {
-    /* Only first failed/changed event can initialize the queue for given event type,
-     * thus succeeded events are ignored until first error. */
-    if (state == STATE_SUCCEEDED || state == STATE_CHANGEDNOT)
-      return;
-
-    /* Initialize event list and add first event. The manadatory informations
-     * are cloned so the event is as standalone as possible and may be saved
-     * to the queue without the dependency on the original service, thus
-     * persistent and managable across monit restarts */
-    NEW(e);
-    e->id = id;
-    gettimeofday(&e->collected, NULL);
-    e->source = xstrdup(service->name);
-    e->mode = service->mode;
-    e->type = service->type;
-    e->state = STATE_INIT;
-    e->state_map = 1;
-    e->action = action;
-    if (s) {
-      long l;
-      va_list ap;
-
-      va_start(ap, s);
-      e->message = Util_formatString(s, ap, &l);
-      va_end(ap);
-    }
-    service->eventlist = e;
-  } else {
-    /* Try to find the event with the same origin and type identification.
-     * Each service and each test have its own custom actions object, so
-     * we share actions object address to identify event source. */
-    do {
-      if (e->action == action && e->id == id) {
-        gettimeofday(&e->collected, NULL);
-
-        /* Shift the existing event flags to the left
-         * and set the first bit based on actual state */
-        e->state_map <<= 1;
-        e->state_map |= ((state == STATE_SUCCEEDED || state == STATE_CHANGEDNOT) ? 0 : 1);
-
-        /* Update the message */
-        if (s) {
-          long l;
-          va_list ap;
-
-          FREE(e->message);
-          va_start(ap, s);
-          e->message = Util_formatString(s, ap, &l);
-          va_end(ap);
-        }
-	break;
-      }
-      e = e->next;
-    } while (e);
-
-    if (!e) {
-      /* Only first failed/changed event can initialize the queue for given event type,
-       * thus succeeded events are ignored until first error. */
-      if (state == STATE_SUCCEEDED || state == STATE_CHANGEDNOT)
-        return;
-
-      /* Event was not found in the pending events list, we will add it.
-       * The manadatory informations are cloned so the event is as standalone
-       * as possible and may be saved to the queue without the dependency on
-       * the original service, thus persistent and managable across monit
-       * restarts */
-      NEW(e);
-      e->id = id;
-      gettimeofday(&e->collected, NULL);
-      e->source = xstrdup(service->name);
-      e->mode = service->mode;
-      e->type = service->type;
-      e->state = STATE_INIT;
-      e->state_map = 1;
-      e->action = action;
-      if (s) {
-        long l;
-        va_list ap;
-
-        va_start(ap, s);
-        e->message = Util_formatString(s, ap, &l);
-        va_end(ap);
-      }
-      e->next = service->eventlist;
-      service->eventlist = e;
-    }
-  }
-
-  e->state_changed = Event_check_state(e, state);
-
-  /* In the case that the state changed, update it and reset the counter */
-  if (e->state_changed) {
-    e->state = state;
-    e->count = 1;
-  } else
-    e->count++;
+  va_list ap;
 
-  handle_event(e);
+  LOCK(Run.mutex)
+    va_start(ap, s);
+    post_event(service, id, state, action, s, ap);
+    va_end(ap);
+  END_LOCK;
 }
 
 
@@ -447,165 +404,230 @@ const char *Event_get_action_description(Event_T E) {
 
 
 /**
- * Reprocess the partially handled event queue
+ * Reprocess the partially handled event queue. If the delivery thread
+ * is running, it is asked to process the queue when it is idle.
  */
 void Event_queue_process() {
-  DIR           *dir = NULL;
-  FILE          *file = NULL;
-  struct dirent *de = NULL;
-  EventAction_T  ea = NULL;
-  Action_T       a = NULL;
+  if (notify_running) {
+    LOCK(notify_mutex)
+      notify_replay = TRUE;
+      pthread_cond_signal(&notify_cond);
+    END_LOCK;
+  } else {
+    queue_process();
+  }
+}
 
-  /* return in the case that the eventqueue is not enabled or empty */
-  if (! Run.eventlist_dir || (! Run.handler_init && ! Run.handler_queue[HANDLER_ALERT] && ! Run.handler_queue[HANDLER_MMONIT]))
+
+/**
+ * Start the notification delivery thread. The alerts and M/Monit
+ * notifications are delivered synchronously if the thread is not
+ * running.
+ */
+void Event_delivery_start() {
+  int status;
+
+  if (notify_running)
     return;
+  notify_stop = FALSE;
+  if ((status = pthread_create(&notify_thread, NULL, notify_deliver, NULL)) != 0)
+    LogError("%s: Failed to create the notification thread -- %s\n", prog, strerror(status));
+  else
+    notify_running = TRUE;
+}
+
 
-  if (! (dir = opendir(Run.eventlist_dir)) ) {
-    if (errno != ENOENT)
-      LogError("%s: cannot open the directory %s -- %s\n", prog, Run.eventlist_dir, STRERROR);
+/**
+ * Stop the notification delivery thread. The waiting notifications are
+ * delivered unless the delivery failed recently, the notifications which
+ * were not delivered are saved to the event queue.
+ */
+void Event_delivery_stop() {
+  int status;
+
+  if (! notify_running)
     return;
+  LOCK(notify_mutex)
+    notify_stop = TRUE;
+    pthread_cond_signal(&notify_cond);
+  END_LOCK;
+  if ((status = pthread_join(notify_thread, NULL)) != 0)
+    LogError("%s: Failed to stop the notification thread -- %s\n", prog, strerror(status));
+  notify_running = FALSE;
+}
+
+
+/**
+ * Finish the notifications of the cycle. If the notifications are
+ * delivered synchronously, the mail session is closed, otherwise the
+ * delivery thread closes it when all notifications were delivered.
+ */
+void Event_flush() {
+  if (! notify_running)
+    sendmail_close();
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/*
+ * Post a new Event
+ * @param service The Service the event belongs to
+ * @param id The event identification
+ * @param state The event state
+ * @param action Description of the event action
+ * @param s Optional message describing the event
+ * @param ap The message arguments
+ */
+static void post_event(Service_T service, long id, short state, EventAction_T action, char *s, va_list ap) {
+  Event_T e;
+
+  ASSERT(service);
+  ASSERT(action);
+  ASSERT(state == STATE_FAILED || state == STATE_SUCCEEDED || state == STATE_CHANGED || state == STATE_CHANGEDNOT);
+
+  /* Try to find the event with the same origin and type identification.
+   * Each service and each test have its own custom actions object, so
+   * we share actions object address to identify event source. */
+  if ((e = index_find(service, action, id))) {
+    gettimeofday(&e->collected, NULL);
+
+    /* Shift the existing event flags to the left
+     * and set the first bit based on actual state */
+    e->state_map <<= 1;
+    e->state_map |= ((state == STATE_SUCCEEDED || state == STATE_CHANGEDNOT) ? 0 : 1);
+  } else {
+    /* Only first failed/changed event can initialize the queue for given event type,
+     * thus succeeded events are ignored until first error. */
+    if (state == STATE_SUCCEEDED || state == STATE_CHANGEDNOT)
+      return;
+
+    /* Event was not found in the pending events list, we will add it.
+     * The manadatory informations are cloned so the event is as standalone
+     * as possible and may be saved to the queue without the dependency on
+     * the original service, thus persistent and managable across monit
+     * restarts */
+    NEW(e);
+    e->id = id;
+    gettimeofday(&e->collected, NULL);
+    e->source = xstrdup(service->name);
+    e->mode = service->mode;
+    e->type = service->type;
+    e->state = STATE_INIT;
+    e->state_map = 1;
+    e->action = action;
+    e->next = service->eventlist;
+    service->eventlist = e;
+    index_add(service, e);
   }
 
-  if ((de = readdir(dir)))
-    DEBUG("Processing postponed events queue\n");
+  e->state_changed = Event_check_state(e, state);
 
-  NEW(ea);
-  NEW(a);
+  /* In the case that the state changed, update it and reset the counter */
+  if (e->state_changed) {
+    e->state = state;
+    e->count = 1;
+  } else
+    e->count++;
 
-  while (de) {
-    int            size;
-    int            handlers_passed = 0;
-    int           *version = NULL;
-    short         *action = NULL;
-    Event_T        e = NULL;
-    struct stat    st;
-    char           file_name[STRLEN];
+  /* Update the message only if the event will be handled, the message of
+   * an ignored event is not used */
+  if (s && is_handled(e)) {
+    long l;
 
-    /* In the case that all handlers failed, skip the further processing in
-     * this cycle. Alert handler is currently defined anytime (either
-     * explicitly or localhost by default) */
-    if ( (Run.mmonits && FLAG(Run.handler_flag, HANDLER_MMONIT) && FLAG(Run.handler_flag, HANDLER_ALERT)) || FLAG(Run.handler_flag, HANDLER_ALERT))
-      break;
+    FREE(e->message);
+    e->message = Util_formatString(s, ap, &l);
+  }
 
-    snprintf(file_name, STRLEN, "%s/%s", Run.eventlist_dir, de->d_name);
+  handle_event(e);
+}
 
-    if (!stat(file_name, &st) && S_ISREG(st.st_mode)) {
-      DEBUG("%s: processing queued event %s\n", prog, file_name);
 
-      if (! (file = fopen(file_name, "r")) ) {
-        LogError("%s: queued event processing failed - cannot open the file %s -- %s\n", prog, file_name, STRERROR);
-        goto error1;
-      }
+/*
+ * Test whether the event will be handled. We will handle only first
+ * succeeded event, recurrent succeeded events or insufficient succeeded
+ * events during failed service state are ignored. Failed events are
+ * handled each time.
+ * @param E An event
+ * @return TRUE if the event will be handled, otherwise FALSE
+ */
+static int is_handled(Event_T E) {
+  return E->state_changed || ! (E->state == STATE_SUCCEEDED || E->state == STATE_CHANGEDNOT || ((E->state_map & 0x1) ^ 0x1));
+}
 
-      /* read event structure version */
-      if (!(version = file_readQueue(file, &size))) {
-        LogError("skipping queued event %s - unknown data format\n", file_name);
-        goto error2;
-      }
-      if (size != sizeof(int)) {
-        LogError("Aborting queued event %s - invalid size %d\n", file_name, size);
-        goto error3;
-      }
-      if (*version != EVENT_VERSION) {
-        LogError("Aborting queued event %s - incompatible data format version %d\n", file_name, *version);
-        goto error3;
-      }
 
-      /* read event structure */
-      if (!(e = file_readQueue(file, &size)))
-        goto error3;
-      if (size != sizeof(*e))
-        goto error4;
-
-      /* read source */
-      if (!(e->source = file_readQueue(file, &size)))
-        goto error4;
-
-      /* read message */
-      if (!(e->message = file_readQueue(file, &size)))
-        goto error5;
-
-      /* read event action */
-      if (!(action = file_readQueue(file, &size)))
-        goto error6;
-      if (size != sizeof(short))
-        goto error7;
-      a->id = *action;
-      if (e->state == STATE_FAILED)
-        ea->failed = a;
-      else
-        ea->succeeded = a;
-      e->action = ea;
-
-      /* Retry all remaining handlers */
-
-      /* alert */
-      if (e->flag & HANDLER_ALERT) {
-        if (Run.handler_init)
-          Run.handler_queue[HANDLER_ALERT]++;
-        if ((Run.handler_flag & HANDLER_ALERT) != HANDLER_ALERT) {
-          if ( handle_alert(e) != HANDLER_ALERT ) {
-            e->flag &= ~HANDLER_ALERT;
-            Run.handler_queue[HANDLER_ALERT]--;
-            handlers_passed++;
-          } else {
-            LogError("Alert handler failed, retry scheduled for next cycle\n");
-            Run.handler_flag |= HANDLER_ALERT;
-          }
-        }
-      }
+/*
+ * Hash of the event identification
+ */
+static unsigned int index_hash(EventAction_T action, long id) {
+  unsigned long h = (unsigned long)action / sizeof(struct myeventaction);
 
-      /* mmonit */
-      if (e->flag & HANDLER_MMONIT) {
-        if (Run.handler_init)
-          Run.handler_queue[HANDLER_MMONIT]++;
-        if ((Run.handler_flag & HANDLER_MMONIT) != HANDLER_MMONIT) {
-          if ( handle_mmonit(e) != HANDLER_MMONIT ) {
-            e->flag &= ~HANDLER_MMONIT;
-            Run.handler_queue[HANDLER_MMONIT]--;
-            handlers_passed++;
-          } else {
-            LogError("M/Monit handler failed, retry scheduled for next cycle\n");
-            Run.handler_flag |= HANDLER_MMONIT;
-          }
-        }
-      }
+  h = h * 31 + (unsigned long)id;
+  return (unsigned int)(h ^ (h >> 15)) * 2654435761U;
+}
 
-      /* If no error persists, remove it from the queue */
-      if (e->flag == HANDLER_SUCCEEDED) {
-        DEBUG("Removing queued event %s\n", file_name);
-        if (unlink(file_name) < 0)
-          LogError("Failed to remove queued event file '%s' -- %s\n", file_name, STRERROR);
-      } else if (handlers_passed > 0) {
-        DEBUG("Updating queued event %s (some handlers passed)\n", file_name);
-        Event_queue_update(e, file_name);
-      }
 
-error7:
-      FREE(action);
-error6:
-      FREE(e->message);
-error5:
-      FREE(e->source);
-error4:
-      FREE(e);
-error3:
-      FREE(version);
-error2:
-      fclose(file);
+/*
+ * Find the service's pending event by the action and id. The events
+ * are indexed by an open addressing hash table, the index is cleared
+ * when the event list was released.
+ * @param S The service
+ * @param action The event action
+ * @param id The event identification
+ * @return The event or NULL if not found
+ */
+static Event_T index_find(Service_T S, EventAction_T action, long id) {
+  unsigned int i;
+
+  if (! S->eventlist) {
+    if (S->eventindex_count) {
+      memset(S->eventindex, 0, S->eventindex_size * sizeof(Event_T));
+      S->eventindex_count = 0;
     }
-error1:
-    de = readdir(dir);
+    return NULL;
   }
-  Run.handler_init = FALSE;
-  closedir(dir);
-  FREE(a);
-  FREE(ea);
-  return;
+
+  for (i = index_hash(action, id) & (S->eventindex_size - 1); S->eventindex[i]; i = (i + 1) & (S->eventindex_size - 1)) {
+    Event_T e = S->eventindex[i];
+    if (e->action == action && e->id == id)
+      return e;
+  }
+  return NULL;
 }
 
 
-/* ----------------------------------------------------------------- Private */
+/*
+ * Add the event to the service's event index, the index is kept at most
+ * half full
+ * @param S The service
+ * @param E The event
+ */
+static void index_add(Service_T S, Event_T E) {
+  unsigned int i;
+
+  if (2 * (S->eventindex_count + 1) > S->eventindex_size) {
+    Event_T e;
+
+    S->eventindex_size = S->eventindex_size ? 2 * S->eventindex_size : 16;
+    FREE(S->eventindex);
+    S->eventindex = xcalloc(S->eventindex_size, sizeof(Event_T));
+    S->eventindex_count = 0;
+    /* The new event is in the list already */
+    for (e = S->eventlist; e; e = e->next) {
+      for (i = index_hash(e->action, e->id) & (S->eventindex_size - 1); S->eventindex[i]; i = (i + 1) & (S->eventindex_size - 1))
+        ;
+      S->eventindex[i] = e;
+      S->eventindex_count++;
+    }
+    return;
+  }
+
+  for (i = index_hash(E->action, E->id) & (S->eventindex_size - 1); S->eventindex[i]; i = (i + 1) & (S->eventindex_size - 1))
+    ;
+  S->eventindex[i] = E;
+  S->eventindex_count++;
+}
 
 
 /*
@@ -620,10 +642,7 @@ static void handle_event(Event_T E) {
   ASSERT(E->action->failed);
   ASSERT(E->action->succeeded);
 
-  /* We will handle only first succeeded event, recurrent succeeded events
-   * or insufficient succeeded events during failed service state are
-   * ignored. Failed events are handled each time. */
-  if (!E->state_changed && (E->state == STATE_SUCCEEDED || E->state == STATE_CHANGEDNOT || ((E->state_map & 0x1) ^ 0x1)))
+  if (! is_handled(E))
     return;
 
   S = Event_get_source(E);
@@ -679,16 +698,20 @@ static void handle_action(Event_T E, Action_T A) {
     return;
 
   /* Alert and mmonit event notification are common actions */
-  E->flag |= handle_mmonit(E);
-  E->flag |= handle_alert(E);
-
-  /* In the case that some subhandler failed, enqueue the event for
-   * partial reprocessing */
-  if (E->flag != HANDLER_SUCCEEDED) {
-    if (Run.eventlist_dir)
-      Event_queue_add(E);
-    else
-      LogError("Aborting event\n");
+  if (notify_running) {
+    notify_post(E);
+  } else {
+    E->flag |= handle_mmonit(E);
+    E->flag |= handle_alert(E);
+
+    /* In the case that some subhandler failed, enqueue the event for
+     * partial reprocessing */
+    if (E->flag != HANDLER_SUCCEEDED) {
+      if (Run.eventlist_dir)
+        Event_queue_add(E);
+      else
+        LogError("Aborting event\n");
+    }
   }
 
   if (!(s = Event_get_source(E))) {
@@ -717,140 +740,602 @@ static void handle_action(Event_T E, Action_T A) {
 }
 
 
+/**
+ * Pass the event to the delivery thread. The event is serialized, so the
+ * notification doesn't depend on the event which may change meanwhile.
+ * If the notification queue is full, the event is saved to the event
+ * queue for the later delivery.
+ * @param E An event object
+ */
+static void notify_post(Event_T E) {
+  int            full;
+  Service_T      s = Event_get_source(E);
+  Notification_T N;
+
+  /* The M/Monit is notified about the state change only */
+  NEW(N);
+  if (s && (s->maillist || Run.maillist))
+    N->flags |= HANDLER_ALERT;
+  if (Run.mmonits && E->state_changed)
+    N->flags |= HANDLER_MMONIT;
+  if (N->flags == HANDLER_SUCCEEDED) {
+    FREE(N);
+    return;
+  }
+  N->data = queue_serialize(E, &N->size);
+
+  LOCK(notify_mutex)
+    if (! (full = notify_count >= NOTIFY_QUEUE_SIZE)) {
+      if (notify_tail)
+        notify_tail->next = N;
+      else
+        notify_head = N;
+      notify_tail = N;
+      notify_count++;
+      pthread_cond_signal(&notify_cond);
+    }
+  END_LOCK;
+
+  if (full) {
+    E->flag = N->flags;
+    if (Run.eventlist_dir) {
+      LogWarning("%s: notification queue full -- the event is saved to the event queue\n", prog);
+      Event_queue_add(E);
+    } else {
+      LogError("Aborting event - notification queue full\n");
+    }
+    E->flag = HANDLER_SUCCEEDED;
+    notify_free(&N);
+  }
+}
+
+
+/**
+ * The delivery thread. Delivers the notifications in the queue order,
+ * after a failed delivery the next attempt is delayed. If the delivery
+ * failed repeatedly, the backends are considered down and the waiting
+ * notifications are saved to the event queue until the next cycle. The
+ * event queue is processed when the notification queue is empty.
+ */
+static void *notify_deliver(void *args) {
+  int            failures = 0;
+  time_t         retry = 0;
+  sigset_t       ns;
+  Notification_T N;
+
+  set_signal_block(&ns, NULL);
+  while (TRUE) {
+    int stop;
+    int replay = FALSE;
+
+    N = NULL;
+    LOCK(notify_mutex)
+      while (! notify_stop) {
+        if (notify_head && (! failures || failures >= NOTIFY_ATTEMPTS || time(NULL) >= retry)) {
+          N = notify_head;
+          break;
+        }
+        if (! notify_head && notify_replay) {
+          notify_replay = FALSE;
+          replay = TRUE;
+          break;
+        }
+        if (notify_head) {
+          struct timespec wait = {retry, 0};
+          pthread_cond_timedwait(&notify_cond, &notify_mutex, &wait);
+        } else {
+          pthread_cond_wait(&notify_cond, &notify_mutex);
+        }
+      }
+      stop = notify_stop;
+    END_LOCK;
+
+    if (stop)
+      break;
+
+    if (replay) {
+      /* The queued events were delivered, try the backends again */
+      queue_process();
+      if (Run.handler_flag == HANDLER_SUCCEEDED)
+        failures = 0;
+      sendmail_close();
+      continue;
+    }
+
+    if (failures >= NOTIFY_ATTEMPTS) {
+      notify_save(N);
+    } else if (notify_send(N)) {
+      failures = 0;
+    } else {
+      retry = time(NULL) + (NOTIFY_DELAY << failures);
+      if (++failures < NOTIFY_ATTEMPTS)
+        continue;
+      notify_save(N);
+    }
+
+    LOCK(notify_mutex)
+      if (! (notify_head = N->next))
+        notify_tail = NULL;
+      notify_count--;
+      stop = ! notify_head;
+    END_LOCK;
+    notify_free(&N);
+
+    /* All pending notifications were sent, close the mail session */
+    if (stop)
+      sendmail_close();
+  }
+
+  /* Deliver the remaining notifications unless the backends are down,
+   * the undelivered ones are saved */
+  LOCK(notify_mutex)
+    N = notify_head;
+    notify_head = notify_tail = NULL;
+    notify_count = 0;
+  END_LOCK;
+  while (N) {
+    Notification_T next = N->next;
+
+    if (failures || ! notify_send(N)) {
+      failures++;
+      notify_save(N);
+    }
+    notify_free(&N);
+    N = next;
+  }
+  sendmail_close();
+  return NULL;
+}
+
+
+/**
+ * Deliver the notification via the handlers which were not done yet
+ * @param N A notification object
+ * @return TRUE if all handlers succeeded, otherwise FALSE
+ */
+static int notify_send(Notification_T N) {
+  Event_T              e;
+  struct myaction      a;
+  struct myeventaction ea;
+
+  /* The invalid notification is dropped */
+  if (! (e = queue_restore(N->data, N->size, &ea, &a)))
+    return TRUE;
+
+  if (N->flags & HANDLER_MMONIT && handle_mmonit(e) == HANDLER_SUCCEEDED)
+    N->flags &= ~HANDLER_MMONIT;
+  if (N->flags & HANDLER_ALERT && handle_alert(e) == HANDLER_SUCCEEDED)
+    N->flags &= ~HANDLER_ALERT;
+
+  FREE(e->source);
+  FREE(e->message);
+  FREE(e);
+  return N->flags == HANDLER_SUCCEEDED;
+}
+
+
+/**
+ * Save the undelivered notification to the event queue
+ * @param N A notification object
+ */
+static void notify_save(Notification_T N) {
+  Event_T              e;
+  struct myaction      a;
+  struct myeventaction ea;
+
+  if (! Run.eventlist_dir) {
+    LogError("Aborting event\n");
+    return;
+  }
+  if (! (e = queue_restore(N->data, N->size, &ea, &a)))
+    return;
+  e->flag = N->flags;
+  LOCK(Run.mutex)
+    Event_queue_add(e);
+  END_LOCK;
+  FREE(e->source);
+  FREE(e->message);
+  FREE(e);
+}
+
+
+static void notify_free(Notification_T *N) {
+  FREE((*N)->data);
+  FREE(*N);
+}
+
+
 /**
  * Add the partialy handled event to the global queue
  * @param E An event object
  */
 static void Event_queue_add(Event_T E) {
-  FILE        *file = NULL;
-  char         file_name[STRLEN];
-  int          version = EVENT_VERSION;
-  short        action = Event_get_action(E);
-  int          rv = FALSE;
-  mode_t       mask;
+  int   size;
+  char *data;
 
   ASSERT(E);
   ASSERT(E->flag != HANDLER_SUCCEEDED);
 
-  if (!file_checkQueueDirectory(Run.eventlist_dir, 0700)) {
+  if (! queue_open()) {
     LogError("%s: Aborting event - cannot access the directory %s\n", prog, Run.eventlist_dir);
     return;
   }
-    
-  if (!file_checkQueueLimit(Run.eventlist_dir, Run.eventlist_slots)) {
+
+  data = queue_serialize(E, &size);
+
+  if (! queue_reserve(size)) {
     LogError("%s: Aborting event - queue over quota\n", prog);
+    FREE(data);
     return;
   }
-    
-  /* compose the file name of actual timestamp and service name */
-  snprintf(file_name, STRLEN, "%s/%ld_%lx", Run.eventlist_dir, (long int)time(NULL), (long unsigned)E->source);
 
-  DEBUG("%s: Adding event to the queue file %s for later delivery\n", prog, file_name);
+  DEBUG("%s: Adding event to the queue %s for later delivery\n", prog, Run.eventlist_dir);
 
-  mask = umask(QUEUEMASK);
-  file = fopen(file_name, "w");
-  umask(mask);
-  if (! file) {
-    LogError("%s: Aborting event - cannot open the event file %s -- %s\n", prog, file_name, STRERROR);
-    return;
+  if (! Journal_append(data, size, E->flag, queue_priority(E))) {
+    LogError("%s: Aborting event - unable to save event information to %s\n", prog, Run.eventlist_dir);
+  } else {
+    if (!Run.handler_init && E->flag & HANDLER_ALERT)
+      Run.handler_queue[HANDLER_ALERT]++;
+    if (!Run.handler_init && E->flag & HANDLER_MMONIT)
+      Run.handler_queue[HANDLER_MMONIT]++;
   }
+  FREE(data);
+}
 
-  /* write event structure version */
-  if (!(rv = file_writeQueue(file, &version, sizeof(int))))
-    goto error;
 
-  /* write event structure */
-  if (!(rv = file_writeQueue(file, E, sizeof(*E))))
-    goto error;
+/**
+ * Retry the queued events. The queue counters are updated when the
+ * journal replay finished. The journal is unlocked while an event is
+ * delivered, so the threads adding events to the queue don't wait for
+ * the delivery.
+ */
+static void queue_process() {
+  int i;
+  int queued[HANDLER_MAX + 1] = {0};
 
-  /* write source */
-  if (!(rv = file_writeQueue(file, E->source, E->source ? strlen(E->source)+1 : 0)))
-    goto error;
+  Run.handler_flag = HANDLER_SUCCEEDED;
 
-  /* write message */
-  if (!(rv = file_writeQueue(file, E->message, E->message ? strlen(E->message)+1 : 0)))
-    goto error;
+  /* return in the case that the eventqueue is not enabled or empty */
+  if (! Run.eventlist_dir || (! Run.handler_init && ! Run.handler_queue[HANDLER_ALERT] && ! Run.handler_queue[HANDLER_MMONIT]))
+    return;
 
-  /* write event action */
-  if (!(rv = file_writeQueue(file, &action, sizeof(short))))
-    goto error;
+  if (! queue_open())
+    return;
 
-  error:
-  fclose(file);
-  if (!rv) {
-    LogError("%s: Aborting event - unable to save event information to %s\n",  prog, file_name);
-    if (unlink(file_name) < 0)
-      LogError("Failed to remove event file '%s' -- %s\n", file_name, STRERROR);
-  } else {
-    if (!Run.handler_init && E->flag & HANDLER_ALERT)
-      Run.handler_queue[HANDLER_ALERT]++;
-    if (!Run.handler_init && E->flag & HANDLER_MMONIT)
-      Run.handler_queue[HANDLER_MMONIT]++;
+  /* The events saved by the previous versions as one file per event are
+   * moved to the journal on startup */
+  if (Run.handler_init)
+    queue_import();
+
+  if (Journal_pending()) {
+    DEBUG("Processing postponed events queue\n");
+    Journal_replay(queue_replay, queued);
   }
+  LOCK(Run.mutex)
+    for (i = 0; i <= HANDLER_MAX; i++)
+      Run.handler_queue[i] += queued[i];
+    Run.handler_init = FALSE;
+  END_LOCK;
+}
+
 
-  return;
+/**
+ * Open the event queue journal, the queue directory is created if it
+ * doesn't exist
+ * @return TRUE if succeeded, otherwise FALSE
+ */
+static int queue_open() {
+  if (!file_checkQueueDirectory(Run.eventlist_dir, 0700))
+    return FALSE;
+  return Journal_open(Run.eventlist_dir);
 }
 
 
 /**
- * Update the partialy handled event in the global queue
- * @param E An event object
- * @param file_name File name
+ * Make space for a new record of the given size in the queue. If the
+ * queue is full, the queued events are dropped according to the queue
+ * policy. The queue usage is kept by the journal, so no I/O is needed
+ * unless an event is dropped. A record larger than the whole queue is
+ * rejected before any queued event is dropped.
+ * @param size The record size
+ * @return TRUE if the record fits in the queue, otherwise FALSE
  */
-static void Event_queue_update(Event_T E, const char *file_name) {
-  FILE        *file = NULL;
-  int          version = EVENT_VERSION;
-  short        action = Event_get_action(E);
-  int          rv = FALSE;
-  mode_t       mask;
+static int queue_reserve(int size) {
+  unsigned long long length = Journal_length(size);
 
-  ASSERT(E);
-  ASSERT(E->flag != HANDLER_SUCCEEDED);
+  if (Run.eventlist_bytes && length > Run.eventlist_bytes)
+    return FALSE;
+  while ((Run.eventlist_slots >= 0 && Journal_pending() >= Run.eventlist_slots) ||
+         (Run.eventlist_bytes && Journal_bytes() + length > Run.eventlist_bytes)) {
+    unsigned int flags;
+
+    if (Run.eventlist_policy == QUEUE_DROP_NONE)
+      return FALSE;
+    if (! (Run.eventlist_policy == QUEUE_DROP_SUCCEEDED && Journal_drop(0, &flags)) && ! Journal_drop(UINT_MAX, &flags))
+      return FALSE;
+    LogWarning("%s: event queue full -- dropped a queued event\n", prog);
+    if (!Run.handler_init && flags & HANDLER_ALERT)
+      Run.handler_queue[HANDLER_ALERT]--;
+    if (!Run.handler_init && flags & HANDLER_MMONIT)
+      Run.handler_queue[HANDLER_MMONIT]--;
+  }
+  return TRUE;
+}
 
-  if (!file_checkQueueDirectory(Run.eventlist_dir, 0700)) {
-    LogError("%s: Aborting event - cannot access the directory %s\n", prog, Run.eventlist_dir);
+
+/**
+ * Get the queue eviction priority of the event, the succeeded events are
+ * dropped first with the QUEUE_DROP_SUCCEEDED policy
+ */
+static unsigned int queue_priority(Event_T E) {
+  return (E->state == STATE_SUCCEEDED || E->state == STATE_CHANGEDNOT) ? 0 : 1;
+}
+
+
+/**
+ * Move the event files written by the previous versions to the journal.
+ * The file content has the same layout as the journal record.
+ */
+static void queue_import() {
+  DIR           *dir = NULL;
+  struct dirent *de = NULL;
+
+  if (! (dir = opendir(Run.eventlist_dir)))
     return;
+
+  while ((de = readdir(dir))) {
+    long           timestamp;
+    unsigned long  id;
+    char           c;
+    char           file_name[STRLEN];
+    char          *data;
+    short          action;
+    struct stat    st;
+    FILE          *file;
+    Event_T        e;
+
+    /* The event files were named <timestamp>_<id> */
+    if (sscanf(de->d_name, "%ld_%lx%c", &timestamp, &id, &c) != 2)
+      continue;
+
+    snprintf(file_name, STRLEN, "%s/%s", Run.eventlist_dir, de->d_name);
+    if (stat(file_name, &st) || ! S_ISREG(st.st_mode) || st.st_size > 1048576)
+      continue;
+    if (! (file = fopen(file_name, "r"))) {
+      LogError("%s: queued event processing failed - cannot open the file %s -- %s\n", prog, file_name, STRERROR);
+      continue;
+    }
+    data = xcalloc(1, st.st_size + 1);
+    if (fread(data, 1, st.st_size, file) == (size_t)st.st_size && (e = queue_deserialize(data, st.st_size, &action))) {
+      DEBUG("%s: moving queued event %s to the journal\n", prog, file_name);
+      if (e->flag == HANDLER_SUCCEEDED || Journal_append(data, st.st_size, e->flag, queue_priority(e))) {
+        if (unlink(file_name) < 0)
+          LogError("Failed to remove queued event file '%s' -- %s\n", file_name, STRERROR);
+      }
+      FREE(e->source);
+      FREE(e->message);
+      FREE(e);
+    } else {
+      LogError("skipping queued event %s - unknown data format\n", file_name);
+    }
+    FREE(data);
+    fclose(file);
   }
-    
-  DEBUG("%s: Updating event in the queue file %s for later delivery\n", prog, file_name);
+  closedir(dir);
+}
 
-  mask = umask(QUEUEMASK);
-  file = fopen(file_name, "w");
-  umask(mask);
-  if (! file)
-  {
-    LogError("%s: Aborting event - cannot open the event file %s -- %s\n", prog, file_name, STRERROR);
-    return;
+
+/**
+ * Append the size prefixed data to the queue record
+ * @return The position following the data
+ */
+static char *queue_put(char *p, const void *data, int size) {
+  memcpy(p, &size, sizeof(int));
+  p += sizeof(int);
+  if (size > 0) {
+    memcpy(p, data, size);
+    p += size;
   }
+  return p;
+}
 
-  /* write event structure version */
-  if (!(rv = file_writeQueue(file, &version, sizeof(int))))
-    goto error;
 
-  /* write event structure */
-  if (!(rv = file_writeQueue(file, E, sizeof(*E))))
-    goto error;
+/**
+ * Read the size prefixed data from the queue record. The data is NUL
+ * terminated for the strings.
+ * @return The data read or NULL if the size is zero or the record is
+ * too short. The size parameter is set appropriately.
+ */
+static void *queue_get(const char **p, const char *end, int *size) {
+  char *data;
+
+  if (end - *p < (long)sizeof(int))
+    return NULL;
+  memcpy(size, *p, sizeof(int));
+  *p += sizeof(int);
+  if (*size <= 0 || *size > end - *p)
+    return NULL;
+  data = xcalloc(1, *size + 1);
+  memcpy(data, *p, *size);
+  *p += *size;
+  return data;
+}
 
-  /* write source */
-  if (!(rv = file_writeQueue(file, E->source, E->source ? strlen(E->source)+1 : 0)))
-    goto error;
 
-  /* write message */
-  if (!(rv = file_writeQueue(file, E->message, E->message ? strlen(E->message)+1 : 0)))
-    goto error;
+/**
+ * Serialize the event to the queue record: the event structure version,
+ * the event structure, the source, the message and the event action,
+ * each prefixed by its size
+ * @param E An event object
+ * @param size The record size
+ * @return The record, to be freed by the caller
+ */
+static char *queue_serialize(Event_T E, int *size) {
+  int    version = EVENT_VERSION;
+  short  action = Event_get_action(E);
+  int    source_size = E->source ? strlen(E->source) + 1 : 0;
+  int    message_size = E->message ? strlen(E->message) + 1 : 0;
+  char  *data;
+  char  *p;
+
+  *size = 5 * sizeof(int) + sizeof(int) + sizeof(*E) + source_size + message_size + sizeof(short);
+  data = p = xmalloc(*size);
+  p = queue_put(p, &version, sizeof(int));
+  p = queue_put(p, E, sizeof(*E));
+  p = queue_put(p, E->source, source_size);
+  p = queue_put(p, E->message, message_size);
+  queue_put(p, &action, sizeof(short));
+  return data;
+}
+
 
-  /* write event action */
-  if (!(rv = file_writeQueue(file, &action, sizeof(short))))
+/**
+ * Read the event from the queue record
+ * @param data The record
+ * @param size The record size
+ * @param action The event action
+ * @return The event or NULL if the record is invalid
+ */
+static Event_T queue_deserialize(const char *data, int size, short *action) {
+  int          fieldsize;
+  int         *version = NULL;
+  short       *a = NULL;
+  Event_T      e = NULL;
+  const char  *p = data;
+  const char  *end = data + size;
+
+  /* read event structure version */
+  if (!(version = queue_get(&p, end, &fieldsize)) || fieldsize != sizeof(int)) {
+    LogError("Aborting queued event - unknown data format\n");
     goto error;
+  }
+  if (*version != EVENT_VERSION) {
+    LogError("Aborting queued event - incompatible data format version %d\n", *version);
+    goto error;
+  }
 
+  /* read event structure */
+  if (!(e = queue_get(&p, end, &fieldsize)) || fieldsize != sizeof(*e))
+    goto invalid;
+  e->source = e->message = NULL;
+  e->action = NULL;
+  e->next = e->previous = NULL;
+
+  /* read source and message */
+  if (!(e->source = queue_get(&p, end, &fieldsize)) || !(e->message = queue_get(&p, end, &fieldsize)))
+    goto invalid;
+
+  /* read event action */
+  if (!(a = queue_get(&p, end, &fieldsize)) || fieldsize != sizeof(short))
+    goto invalid;
+  *action = *a;
+
+  FREE(a);
+  FREE(version);
+  return e;
+
+  invalid:
+  LogError("Aborting queued event - invalid data\n");
   error:
-  fclose(file);
-  if (!rv) {
-    LogError("%s: Aborting event - unable to update event information to %s\n",  prog, file_name);
-    if (unlink(file_name) < 0)
-      LogError("Failed to remove event file '%s' -- %s\n", file_name, STRERROR);
+  if (e) {
+    FREE(e->source);
+    FREE(e->message);
+    FREE(e);
   }
+  FREE(a);
+  FREE(version);
+  return NULL;
+}
+
+
+/**
+ * Read the event from the queue record and set its action
+ * @param data The record
+ * @param size The record size
+ * @param ea The event action object to use
+ * @param a The action object to use
+ * @return The event, to be freed by the caller, or NULL if the record
+ * is invalid
+ */
+static Event_T queue_restore(const char *data, int size, struct myeventaction *ea, struct myaction *a) {
+  short   action;
+  Event_T e;
+
+  if (! (e = queue_deserialize(data, size, &action)))
+    return NULL;
+
+  memset(a, 0, sizeof(*a));
+  memset(ea, 0, sizeof(*ea));
+  a->id = action;
+  ea->failed = ea->succeeded = a;
+  e->action = ea;
+  return e;
+}
+
+
+/**
+ * Retry the remaining handlers of the queued event. The changes of the
+ * handlers queue counters are summed up in the ctx array.
+ * @return FALSE if all handlers failed, so the replay should stop
+ */
+static int queue_replay(void *data, int size, unsigned int *flags, void *ctx) {
+  Event_T              e;
+  int                 *queued = ctx;
+  struct myaction      a;
+  struct myeventaction ea;
+
+  /* In the case that all handlers failed, skip the further processing in
+   * this cycle. Alert handler is currently defined anytime (either
+   * explicitly or localhost by default) */
+  if ( (Run.mmonits && FLAG(Run.handler_flag, HANDLER_MMONIT) && FLAG(Run.handler_flag, HANDLER_ALERT)) || FLAG(Run.handler_flag, HANDLER_ALERT))
+    return FALSE;
+
+  /* The invalid record is dropped */
+  if (! (e = queue_restore(data, size, &ea, &a))) {
+    *flags = HANDLER_SUCCEEDED;
+    return TRUE;
+  }
+  /* The journal holds the current handlers state */
+  e->flag = *flags;
+
+  /* Retry all remaining handlers */
+
+  /* alert */
+  if (e->flag & HANDLER_ALERT) {
+    if (Run.handler_init)
+      queued[HANDLER_ALERT]++;
+    if ((Run.handler_flag & HANDLER_ALERT) != HANDLER_ALERT) {
+      if ( handle_alert(e) != HANDLER_ALERT ) {
+        e->flag &= ~HANDLER_ALERT;
+        queued[HANDLER_ALERT]--;
+      } else {
+        LogError("Alert handler failed, retry scheduled for next cycle\n");
+        Run.handler_flag |= HANDLER_ALERT;
+      }
+    }
+  }
+
+  /* mmonit */
+  if (e->flag & HANDLER_MMONIT) {
+    if (Run.handler_init)
+      queued[HANDLER_MMONIT]++;
+    if ((Run.handler_flag & HANDLER_MMONIT) != HANDLER_MMONIT) {
+      if ( handle_mmonit(e) != HANDLER_MMONIT ) {
+        e->flag &= ~HANDLER_MMONIT;
+        queued[HANDLER_MMONIT]--;
+      } else {
+        LogError("M/Monit handler failed, retry scheduled for next cycle\n");
+        Run.handler_flag |= HANDLER_MMONIT;
+      }
+    }
+  }
+
+  /* The succeeded handlers are acknowledged in the journal */
+  *flags = e->flag;
 
-  return;
+  FREE(e->source);
+  FREE(e->message);
+  FREE(e);
+  return TRUE;
 }
 
@@ -200,4 +200,26 @@ const char *Event_get_action_description(Event_T E);
 void Event_queue_process();
 
 
+/**
+ * Start the notification delivery thread. The alerts and M/Monit
+ * notifications are delivered synchronously if the thread is not
+ * running.
+ */
+void Event_delivery_start();
+
+
+/**
+ * Stop the notification delivery thread. The waiting notifications are
+ * delivered unless the delivery failed recently, the notifications which
+ * were not delivered are saved to the event queue.
+ */
+void Event_delivery_stop();
+
+
+/**
+ * Finish the notifications of the cycle
+ */
+void Event_flush();
+
+
 #endif
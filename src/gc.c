@@ -92,6 +92,7 @@ void gc() {
     delprocesstree(&ptree, &ptreesize);
   }
   
+  Util_resetServiceIndex();
   if(servicelist)
     _gc_service_list(&servicelist);
   
@@ -104,15 +105,18 @@ void gc() {
   if(Run.maillist)
     gc_mail_list(&Run.maillist);
   
+  sendmail_close();
   if(Run.mailservers)
     _gc_mail_server(&Run.mailservers);
 
+  mmonit_close();
   if(Run.mmonits)
     _gc_mmonit(&Run.mmonits);
 
   if(Run.eventlist)
     gc_event(&Run.eventlist);
   
+  Journal_close();
   FREE(Run.eventlist_dir);
   FREE(Run.mygroup);
   FREE(Run.localhostname);
@@ -218,9 +222,15 @@ static void _gc_service(Service_T *s) {
   if((*s)->sizelist)
     _gcso(&(*s)->sizelist);
 
+  if((*s)->matcher)
+    Matcher_free(&(*s)->matcher);
+
   if((*s)->matchlist)
     _gcmatch(&(*s)->matchlist);
 
+  if((*s)->matchlimit)
+    FREE((*s)->matchlimit);
+
   if((*s)->checksum)
     _gcchecksum(&(*s)->checksum);
 
@@ -277,10 +287,13 @@ static void _gc_service(Service_T *s) {
   
   if((*s)->eventlist)
     gc_event(&(*s)->eventlist);
+  FREE((*s)->eventindex);
 
   FREE((*s)->name);
   FREE((*s)->path);
   
+  pthread_mutex_destroy(&(*s)->mutex);
+
   (*s)->next= NULL;
 
   FREE(*s);
@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#include "monit.h"
+#include "history.h"
+
+
+/**
+ *  In-memory history of the service metrics.
+ *
+ *  The series table is built from the service list at start, each
+ *  series has three rings of the same length: the raw samples and the
+ *  one minute and one hour rollups. The newest rollup bucket is updated
+ *  in place until a sample of the next interval arrives, so the rollups
+ *  cost one update per sample and the current interval is visible too.
+ *
+ *  The table is updated by the main thread at the end of the cycle and
+ *  read by the http thread, both with the history mutex locked.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define HISTORY_RAW     0
+#define HISTORY_MINUTE  1
+#define HISTORY_HOUR    2
+#define HISTORY_ROLLUPS 2
+
+typedef enum {
+  Metric_Load = 0,
+  Metric_CpuUser,
+  Metric_CpuSystem,
+  Metric_CpuWait,
+  Metric_SystemMemory,
+  Metric_Swap,
+  Metric_Cpu,
+  Metric_CpuTotal,
+  Metric_Memory,
+  Metric_MemoryTotal,
+  Metric_Children,
+  Metric_Space,
+  Metric_Inode,
+  Metric_Size,
+  Metric_Response,
+  Metric_Icmp
+} Metric_Type;
+
+typedef struct mysample {
+  unsigned int time;                                        /**< Sample time */
+  float        value;                                      /**< Sample value */
+} Sample_T;
+
+typedef struct myrollup {
+  unsigned int time;                                  /**< Interval start */
+  float        avg;                         /**< Average in the interval */
+  float        min;                         /**< Minimum in the interval */
+  float        max;                         /**< Maximum in the interval */
+} Rollup_T;
+
+typedef struct myseries {
+  Service_T    s;                                            /**< The service */
+  char        *name;                                        /**< Metric name */
+  Metric_Type  type;                                        /**< Metric type */
+  void        *object;              /**< The port or icmp test of the metric */
+  unsigned int last;                        /**< Time of the last sample */
+  int          head[3];          /**< Index of the newest slot of the ring */
+  int          count[3];                        /**< Used slots of the ring */
+  Sample_T    *raw;                                 /**< Raw samples ring */
+  Rollup_T    *rollup[HISTORY_ROLLUPS];                  /**< Rollup rings */
+  double       sum[HISTORY_ROLLUPS];  /**< Sum of the newest bucket samples */
+  int          n[HISTORY_ROLLUPS];    /**< The newest bucket samples count */
+} Series_T;
+
+static const char *resolutions[] = {"raw", "1m", "1h"};
+static const int   intervals[] = {0, 60, 3600};
+
+static Series_T       *series = NULL;
+static int             series_num = 0;
+static int             history_length = 0;
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* -------------------------------------------------------------- Prototypes */
+
+
+static void allocate();
+static int  add_series(Series_T *, Service_T);
+static void set_series(Series_T *, Service_T, Metric_Type, void *, char *);
+static int  has_series(Series_T *, int, const char *);
+static int  get_value(Series_T *, float *);
+static void add_sample(Series_T *, unsigned int, float);
+static void print_series(Buffer_T *, Series_T *, int);
+static void print_string(Buffer_T *, const char *);
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void History_start() {
+  if (! Run.history_bytes)
+    return;
+
+  LOCK(history_mutex)
+    allocate();
+  END_LOCK;
+}
+
+
+void History_stop() {
+  LOCK(history_mutex)
+  {
+    int i;
+
+    for (i = 0; i < series_num; i++) {
+      int r;
+      FREE(series[i].name);
+      FREE(series[i].raw);
+      for (r = 0; r < HISTORY_ROLLUPS; r++)
+        FREE(series[i].rollup[r]);
+    }
+    FREE(series);
+    series_num = 0;
+    history_length = 0;
+  }
+  END_LOCK;
+}
+
+
+void History_update() {
+  LOCK(history_mutex)
+  {
+    int i;
+
+    for (i = 0; i < series_num; i++) {
+      float value;
+      Series_T *S = &series[i];
+      unsigned int t = (unsigned int)S->s->collected.tv_sec;
+
+      if (t != S->last && get_value(S, &value)) {
+        add_sample(S, t, value);
+        S->last = t;
+      }
+    }
+  }
+  END_LOCK;
+}
+
+
+int History_json(Buffer_T *B, const char *service, const char *metric, const char *resolution) {
+  int rv = FALSE;
+  int resolution_id = HISTORY_RAW;
+
+  ASSERT(B);
+
+  if (resolution) {
+    for (resolution_id = HISTORY_HOUR; resolution_id >= 0; resolution_id--)
+      if (IS(resolution, resolutions[resolution_id]))
+        break;
+    if (resolution_id < 0)
+      return FALSE;
+  }
+
+  LOCK(history_mutex)
+  {
+    int i;
+
+    for (i = 0; service && i < series_num; i++)
+      if (! strcmp(service, series[i].s->name))
+        break;
+    if ((rv = (! service || i < series_num))) {
+      int first = TRUE;
+
+      Util_stringbuffer(B, "{\"resolution\":\"%s\",\"interval\":%d,\"series\":[", resolutions[resolution_id], intervals[resolution_id]);
+      for (i = 0; i < series_num; i++) {
+        Series_T *S = &series[i];
+
+        if ((service && strcmp(service, S->s->name)) || (metric && strcmp(metric, S->name)))
+          continue;
+        if (! first)
+          Util_stringbuffer(B, ",");
+        print_series(B, S, resolution_id);
+        first = FALSE;
+      }
+      Util_stringbuffer(B, "]}");
+    }
+  }
+  END_LOCK;
+
+  return rv;
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Build the series table, the ring length is the largest which fits the
+ * history memory budget
+ */
+static void allocate() {
+  int i = 0;
+  unsigned long long size;
+  Service_T s;
+
+  for (s = servicelist_conf; s; s = s->next_conf)
+    series_num += add_series(NULL, s);
+  if (! series_num)
+    return;
+
+  /* Every series has three rings of the same length */
+  size = sizeof(Sample_T) + HISTORY_ROLLUPS * sizeof(Rollup_T);
+  if (Run.history_bytes / series_num < sizeof(Series_T) + 2 * size) {
+    LogError("%s: History size %llu B is too small for %d metrics -- history disabled\n", prog, Run.history_bytes, series_num);
+    series_num = 0;
+    return;
+  }
+  history_length = (int)((Run.history_bytes / series_num - sizeof(Series_T)) / size);
+
+  series = xcalloc(series_num, sizeof(Series_T));
+  for (s = servicelist_conf; s; s = s->next_conf)
+    i += add_series(&series[i], s);
+  for (i = 0; i < series_num; i++) {
+    int r;
+    series[i].raw = xcalloc(history_length, sizeof(Sample_T));
+    for (r = 0; r < HISTORY_ROLLUPS; r++)
+      series[i].rollup[r] = xcalloc(history_length, sizeof(Rollup_T));
+  }
+  DEBUG("%s: History of %d metrics, %d samples per resolution\n", prog, series_num, history_length);
+}
+
+
+/**
+ * Set up the series of the service's metrics
+ * @param S The series array to fill or NULL to count the series only
+ * @param s The service
+ * @return The number of the service's series
+ */
+static int add_series(Series_T *S, Service_T s) {
+  int i = 0;
+  int j = 0;
+  Port_T p;
+  Icmp_T icmp;
+
+  switch (s->type) {
+    case TYPE_SYSTEM:
+      if (S) {
+        set_series(&S[i + 0], s, Metric_Load, NULL, xstrdup("load"));
+        set_series(&S[i + 1], s, Metric_CpuUser, NULL, xstrdup("cpu_user"));
+        set_series(&S[i + 2], s, Metric_CpuSystem, NULL, xstrdup("cpu_system"));
+        set_series(&S[i + 3], s, Metric_CpuWait, NULL, xstrdup("cpu_wait"));
+        set_series(&S[i + 4], s, Metric_SystemMemory, NULL, xstrdup("memory"));
+        set_series(&S[i + 5], s, Metric_Swap, NULL, xstrdup("swap"));
+      }
+      i += 6;
+      break;
+    case TYPE_PROCESS:
+      if (S) {
+        set_series(&S[i + 0], s, Metric_Cpu, NULL, xstrdup("cpu"));
+        set_series(&S[i + 1], s, Metric_CpuTotal, NULL, xstrdup("cpu_total"));
+        set_series(&S[i + 2], s, Metric_Memory, NULL, xstrdup("memory"));
+        set_series(&S[i + 3], s, Metric_MemoryTotal, NULL, xstrdup("memory_total"));
+        set_series(&S[i + 4], s, Metric_Children, NULL, xstrdup("children"));
+      }
+      i += 5;
+      break;
+    case TYPE_FILESYSTEM:
+      if (S) {
+        set_series(&S[i + 0], s, Metric_Space, NULL, xstrdup("space"));
+        set_series(&S[i + 1], s, Metric_Inode, NULL, xstrdup("inode"));
+      }
+      i += 2;
+      break;
+    case TYPE_FILE:
+      if (S)
+        set_series(&S[i], s, Metric_Size, NULL, xstrdup("size"));
+      i++;
+      break;
+    default:
+      break;
+  }
+
+  for (p = s->portlist; p; p = p->next, i++, j++) {
+    if (S) {
+      char *name;
+      if (p->family == AF_UNIX)
+        name = Util_getString("response:%s", p->pathname);
+      else
+        name = Util_getString("response:%s:%d", p->hostname, p->port);
+      if (j && has_series(&S[i - j], j, name)) {
+        /* Another test of the same port, e.g. with a different request */
+        char *indexed = Util_getString("%s:%d", name, j + 1);
+        FREE(name);
+        name = indexed;
+      }
+      set_series(&S[i], s, Metric_Response, p, name);
+    }
+  }
+
+  j = 0;
+
+  for (icmp = s->icmplist; icmp; icmp = icmp->next, i++, j++) {
+    if (S)
+      set_series(&S[i], s, Metric_Icmp, icmp, j ? Util_getString("icmp:%d", j + 1) : xstrdup("icmp"));
+  }
+
+  return i;
+}
+
+
+static void set_series(Series_T *S, Service_T s, Metric_Type type, void *object, char *name) {
+  S->s      = s;
+  S->type   = type;
+  S->object = object;
+  S->name   = name;
+}
+
+
+/**
+ * Check if one of the first n series has the given name
+ * @return TRUE if the name is used, otherwise FALSE
+ */
+static int has_series(Series_T *S, int n, const char *name) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (IS(S[i].name, name))
+      return TRUE;
+
+  return FALSE;
+}
+
+
+/**
+ * Get the metric's value collected in the last check
+ * @return TRUE if the value is valid, otherwise FALSE
+ */
+static int get_value(Series_T *S, float *value) {
+  Service_T s = S->s;
+
+  if (s->monitor != MONITOR_YES)
+    return FALSE;
+
+  switch (S->type) {
+    case Metric_Response:
+      *value = ((Port_T)S->object)->response;
+      return *value >= 0;
+    case Metric_Icmp:
+      *value = ((Icmp_T)S->object)->response;
+      return *value >= 0;
+    default:
+      break;
+  }
+
+  if (! Util_hasServiceStatus(s))
+    return FALSE;
+
+  switch (S->type) {
+    case Metric_Load:
+      *value = systeminfo.loadavg[0];
+      break;
+    case Metric_CpuUser:
+      *value = systeminfo.total_cpu_user_percent / 10.;
+      break;
+    case Metric_CpuSystem:
+      *value = systeminfo.total_cpu_syst_percent / 10.;
+      break;
+    case Metric_CpuWait:
+      *value = systeminfo.total_cpu_wait_percent / 10.;
+      break;
+    case Metric_SystemMemory:
+      *value = systeminfo.total_mem_percent / 10.;
+      break;
+    case Metric_Swap:
+      *value = systeminfo.total_swap_percent / 10.;
+      break;
+    case Metric_Cpu:
+      *value = s->inf->priv.process.cpu_percent / 10.;
+      break;
+    case Metric_CpuTotal:
+      *value = s->inf->priv.process.total_cpu_percent / 10.;
+      break;
+    case Metric_Memory:
+      *value = s->inf->priv.process.mem_kbyte;
+      break;
+    case Metric_MemoryTotal:
+      *value = s->inf->priv.process.total_mem_kbyte;
+      break;
+    case Metric_Children:
+      *value = s->inf->priv.process.children;
+      break;
+    case Metric_Space:
+      *value = s->inf->priv.filesystem.space_percent / 10.;
+      break;
+    case Metric_Inode:
+      if (s->inf->priv.filesystem.f_files <= 0)
+        return FALSE;
+      *value = s->inf->priv.filesystem.inode_percent / 10.;
+      break;
+    case Metric_Size:
+      *value = s->inf->priv.file.st_size;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+
+/**
+ * Add the sample to the raw ring and update the newest bucket of the
+ * rollup rings, a new bucket is started if the sample belongs to the
+ * next interval
+ */
+static void add_sample(Series_T *S, unsigned int t, float value) {
+  int r;
+
+  S->head[HISTORY_RAW] = (S->head[HISTORY_RAW] + 1) % history_length;
+  S->raw[S->head[HISTORY_RAW]].time = t;
+  S->raw[S->head[HISTORY_RAW]].value = value;
+  if (S->count[HISTORY_RAW] < history_length)
+    S->count[HISTORY_RAW]++;
+
+  for (r = 0; r < HISTORY_ROLLUPS; r++) {
+    Rollup_T *R;
+    int ring = r + 1;
+    unsigned int start = t - t % intervals[ring];
+
+    if (! S->count[ring] || S->rollup[r][S->head[ring]].time != start) {
+      S->head[ring] = (S->head[ring] + 1) % history_length;
+      if (S->count[ring] < history_length)
+        S->count[ring]++;
+      R = &S->rollup[r][S->head[ring]];
+      R->time = start;
+      R->avg = R->min = R->max = value;
+      S->sum[r] = value;
+      S->n[r] = 1;
+    } else {
+      R = &S->rollup[r][S->head[ring]];
+      S->sum[r] += value;
+      S->n[r]++;
+      R->avg = S->sum[r] / S->n[r];
+      if (value < R->min)
+        R->min = value;
+      if (value > R->max)
+        R->max = value;
+    }
+  }
+}
+
+
+static void print_series(Buffer_T *B, Series_T *S, int ring) {
+  int i;
+  int index = S->head[ring] - S->count[ring] + 1 + history_length;
+
+  Util_stringbuffer(B, "{\"service\":");
+  print_string(B, S->s->name);
+  Util_stringbuffer(B, ",\"metric\":");
+  print_string(B, S->name);
+  Util_stringbuffer(B, ",\"points\":[");
+  for (i = 0; i < S->count[ring]; i++, index++) {
+    if (ring == HISTORY_RAW) {
+      Sample_T *P = &S->raw[index % history_length];
+      Util_stringbuffer(B, "%s[%u,%.6g]", i ? "," : "", P->time, P->value);
+    } else {
+      Rollup_T *R = &S->rollup[ring - 1][index % history_length];
+      Util_stringbuffer(B, "%s[%u,%.6g,%.6g,%.6g]", i ? "," : "", R->time, R->avg, R->min, R->max);
+    }
+  }
+  Util_stringbuffer(B, "]}");
+}
+
+
+/**
+ * Append the JSON string with the quotes and the special characters
+ * escaped
+ */
+static void print_string(Buffer_T *B, const char *s) {
+  Util_stringbuffer(B, "\"");
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      Util_stringbuffer(B, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      Util_stringbuffer(B, "\\u%04x", *s);
+    else
+      Util_stringbuffer(B, "%c", *s);
+  }
+  Util_stringbuffer(B, "\"");
+}
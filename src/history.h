@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_HISTORY_H
+#define MONIT_HISTORY_H
+
+
+/**
+ *  In-memory history of the service metrics. Every metric of a service,
+ *  such as the process CPU usage or a port's response time, has a
+ *  series with three fixed size rings: the raw samples collected in
+ *  each cycle and the one minute and one hour rollups (average, minimum
+ *  and maximum), which are updated incrementally with every sample.
+ *  The memory is allocated once, the ring length is derived from the
+ *  memory budget set by the 'set history' statement.
+ *
+ *  @file
+ */
+
+
+/**
+ * Allocate the series of the monitored services if the history is
+ * enabled. Must be called after the service list was created.
+ */
+void History_start();
+
+
+/**
+ * Release the series. Must be called before the service list is
+ * released.
+ */
+void History_stop();
+
+
+/**
+ * Add the values collected in the cycle to the series. A service's
+ * sample is recorded only if it was checked since the last update and
+ * its data are valid.
+ */
+void History_update();
+
+
+/**
+ * Append the history in the JSON format to the buffer. The document has
+ * the form {"resolution":"1m","interval":60,"series":[{"service":"name",
+ * "metric":"cpu","points":[[time,value],...]},...]}, the raw points are
+ * [time,value] pairs and the rollup points are [time,average,minimum,
+ * maximum], ordered from the oldest to the newest.
+ * @param B The buffer to append to
+ * @param service The service name or NULL for all services
+ * @param metric The metric name or NULL for all metrics
+ * @param resolution "raw", "1m", "1h" or NULL for raw
+ * @return TRUE if succeeded, FALSE if the service or the resolution is
+ * unknown
+ */
+int History_json(Buffer_T *B, const char *service, const char *metric, const char *resolution);
+
+
+#endif
@@ -36,6 +36,10 @@
 #include <errno.h>
 #endif
 
+#ifdef HAVE_STDARG_H
+#include <stdarg.h>
+#endif
+
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -73,6 +77,7 @@
 #include "alert.h"
 #include "process.h"
 #include "device.h"
+#include "net.h"
 
 #define ACTION(c) !strncasecmp(req->url, c, sizeof(c))
 
@@ -87,10 +92,90 @@
 #define STATUS2     "/_status2"
 #define RUN         "/_runtime"
 #define VIEWLOG     "/_viewlog"
+#define HISTORY     "/_history"
+#define METRICS     "/_metrics"
 #define DOACTION    "/_doaction"
 
+/* The metrics are rendered into a buffer of this size which is flushed
+ * to the socket when full */
+#define METRICS_BUFSIZE 16384
+
+typedef struct mymetrics {
+  Socket_T S;                                         /**< Client socket */
+  int      failed;                       /**< TRUE if the write failed */
+  int      used;                                  /**< Used buffer bytes */
+  char     buf[METRICS_BUFSIZE];                       /**< Output buffer */
+} *Metrics_T;
+
+typedef enum {
+  Metric_ServiceStatus = 0,
+  Metric_ServiceMonitored,
+  Metric_SystemLoad1,
+  Metric_SystemLoad5,
+  Metric_SystemLoad15,
+  Metric_SystemCpuUser,
+  Metric_SystemCpuSystem,
+  Metric_SystemCpuWait,
+  Metric_SystemMemory,
+  Metric_SystemMemoryPercent,
+  Metric_SystemSwap,
+  Metric_SystemSwapPercent,
+  Metric_ProcessPid,
+  Metric_ProcessUptime,
+  Metric_ProcessChildren,
+  Metric_ProcessCpu,
+  Metric_ProcessCpuTotal,
+  Metric_ProcessMemory,
+  Metric_ProcessMemoryTotal,
+  Metric_FilesystemSpace,
+  Metric_FilesystemSpacePercent,
+  Metric_FilesystemInode,
+  Metric_FilesystemInodePercent,
+  Metric_FileSize
+} Metric_Family;
+
+/* The service metric families, in the Metric_Family order */
+static struct {
+  const char *name;
+  int         type;            /**< Service type or -1 for all services */
+  const char *help;
+} metricfamilies[] = {
+  {"monit_service_status",               -1, "Service error bitmap, 0 if the service is ok"},
+  {"monit_service_monitored",            -1, "1 if the service is monitored"},
+  {"monit_system_load1",                 TYPE_SYSTEM, "Load average over 1 minute"},
+  {"monit_system_load5",                 TYPE_SYSTEM, "Load average over 5 minutes"},
+  {"monit_system_load15",                TYPE_SYSTEM, "Load average over 15 minutes"},
+  {"monit_system_cpu_user_percent",      TYPE_SYSTEM, "CPU usage in user space"},
+  {"monit_system_cpu_system_percent",    TYPE_SYSTEM, "CPU usage in kernel space"},
+  {"monit_system_cpu_wait_percent",      TYPE_SYSTEM, "CPU waiting for I/O"},
+  {"monit_system_memory_bytes",          TYPE_SYSTEM, "Memory in use"},
+  {"monit_system_memory_percent",        TYPE_SYSTEM, "Memory in use"},
+  {"monit_system_swap_bytes",            TYPE_SYSTEM, "Swap in use"},
+  {"monit_system_swap_percent",          TYPE_SYSTEM, "Swap in use"},
+  {"monit_process_pid",                  TYPE_PROCESS, "Process id"},
+  {"monit_process_uptime_seconds",       TYPE_PROCESS, "Process uptime"},
+  {"monit_process_children",             TYPE_PROCESS, "Number of child processes"},
+  {"monit_process_cpu_percent",          TYPE_PROCESS, "Process CPU usage"},
+  {"monit_process_cpu_total_percent",    TYPE_PROCESS, "Process CPU usage including the children"},
+  {"monit_process_memory_bytes",         TYPE_PROCESS, "Process memory"},
+  {"monit_process_memory_total_bytes",   TYPE_PROCESS, "Process memory including the children"},
+  {"monit_filesystem_space_bytes",       TYPE_FILESYSTEM, "Used space"},
+  {"monit_filesystem_space_percent",     TYPE_FILESYSTEM, "Used space"},
+  {"monit_filesystem_inode",             TYPE_FILESYSTEM, "Used inodes"},
+  {"monit_filesystem_inode_percent",     TYPE_FILESYSTEM, "Used inodes"},
+  {"monit_file_size_bytes",              TYPE_FILE, "File size"}
+};
+
+static const char *metrictypes[] = {"filesystem", "directory", "file", "process", "host", "system", "fifo", "status"};
+
+/* The decoded PIXEL_GIF, shared by the worker threads */
+static unsigned char *pixel= NULL;
+static int pixel_length= 0;
+static pthread_once_t pixel_once= PTHREAD_ONCE_INIT;
+
 /* Private prototypes */
 static int is_readonly(HttpRequest);
+static void init_pixel();
 static void printPixel(HttpResponse);
 static void doGet(HttpRequest, HttpResponse);
 static void doPost(HttpRequest, HttpResponse);
@@ -107,6 +192,8 @@ static void do_ping(HttpRequest, HttpResponse);
 static void do_getid(HttpRequest, HttpResponse);
 static void do_runtime(HttpRequest, HttpResponse);
 static void do_viewlog(HttpRequest, HttpResponse);
+static void do_history(HttpRequest, HttpResponse);
+static void do_metrics(HttpRequest, HttpResponse);
 static void handle_action(HttpRequest, HttpResponse);
 static void handle_do_action(HttpRequest, HttpResponse);
 static void handle_run(HttpRequest, HttpResponse);
@@ -142,6 +229,12 @@ static void print_status(HttpRequest, HttpResponse, int);
 static void status_service_txt(Service_T, HttpResponse, short);
 static char *get_service_status_html(Service_T);
 static char *get_service_status_text(Service_T);
+static int get_metric(Service_T, Metric_Family, double *);
+static void print_metrics_port(Metrics_T);
+static void print_metrics_icmp(Metrics_T);
+static void print_metric_label(Metrics_T, const char *, const char *);
+static void metrics_print(Metrics_T, const char *, ...);
+static void metrics_flush(Metrics_T);
 
 
 /**
@@ -224,6 +317,10 @@ static void doGet(HttpRequest req, HttpResponse res) {
     print_status(req, res, 1);
   } else if(ACTION(STATUS2)) {
     print_status(req, res, 2);
+  } else if(ACTION(HISTORY)) {
+    do_history(req, res);
+  } else if(ACTION(METRICS)) {
+    do_metrics(req, res);
   } else if(ACTION(DOACTION)) {
     handle_do_action(req, res);
   } else {
@@ -366,8 +463,20 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
       snprintf(slots, STRLEN, "%d", Run.eventlist_slots);
     out_print(res,
               "<tr><td>Event queue</td>"
-              "<td>base directory %s with %d slots</td></tr>",
-              Run.eventlist_dir, Run.eventlist_slots);
+              "<td>base directory %s with %s slots</td></tr>",
+              Run.eventlist_dir, slots);
+    if(Run.eventlist_bytes)
+      out_print(res,
+                "<tr><td>Event queue size</td><td>%llu bytes</td></tr>",
+                Run.eventlist_bytes);
+    if(Run.eventlist_policy != QUEUE_DROP_NONE)
+      out_print(res,
+                "<tr><td>Event queue full</td><td>drop %s</td></tr>",
+                Run.eventlist_policy == QUEUE_DROP_OLDEST ? "oldest" : "succeeded");
+    out_print(res,
+              "<tr><td>Event queue usage</td>"
+              "<td>%d events, %llu bytes</td></tr>",
+              Journal_pending(), Journal_bytes());
   }
 
   if(Run.mmonits) {
@@ -413,6 +522,23 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
   out_print(res,
             "<tr><td>Poll time</td><td>%d seconds with start delay %d seconds</td></tr>",
             Run.polltime, Run.startdelay);
+  {
+    unsigned long hits, misses;
+    resolver_statistics(&hits, &misses);
+    out_print(res,
+              "<tr><td>Resolver cache</td><td>%lu hits, %lu misses</td></tr>",
+              hits, misses);
+  }
+  if(Run.checksumcache) {
+    unsigned long hits, misses;
+    checksum_statistics(&hits, &misses);
+    out_print(res,
+              "<tr><td>Checksum cache</td><td>%lu hits, %lu misses",
+              hits, misses);
+    if(Run.checksumrehash)
+      out_print(res, ", full rehash every %d cycles", Run.checksumrehash);
+    out_print(res, "</td></tr>");
+  }
   out_print(res,
             "<tr><td>httpd bind address</td><td>%s</td></tr>",
             Run.bind_addr?Run.bind_addr:"Any/All");
@@ -574,6 +700,75 @@ static void do_viewlog(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_history(HttpRequest req, HttpResponse res) {
+  
+  if(!Run.history_bytes) {
+    send_error(res, SC_NOT_FOUND, "The metrics history is not enabled");
+    return;
+  }
+  
+  if(!History_json(&res->output, get_parameter(req, "service"),
+                   get_parameter(req, "metric"), get_parameter(req, "resolution"))) {
+    send_error(res, SC_NOT_FOUND, "There is no service by that name or unknown resolution");
+    return;
+  }
+  set_content_type(res, "application/json");
+  
+}
+
+
+/**
+ * Print the metrics in the OpenMetrics text format. The response is
+ * streamed to the client through a fixed size buffer, so the memory
+ * used doesn't depend on the number of services. No lock is held, the
+ * values are read like the status page does, so the scrape doesn't
+ * wait for the running validation.
+ */
+static void do_metrics(HttpRequest req, HttpResponse res) {
+  int f;
+  time_t uptime;
+  Service_T s;
+  struct mymetrics M;
+
+  M.S = res->S;
+  M.failed = FALSE;
+  M.used = 0;
+
+  res->is_committed = TRUE;
+  metrics_print(&M,
+    "%s 200 OK\r\n"
+    "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+    res->protocol);
+
+  metrics_print(&M, "# TYPE monit_uptime_seconds gauge\n# HELP monit_uptime_seconds Monit daemon uptime\n");
+  if((uptime = Util_getProcessUptime(Run.pidfile)) >= 0)
+    metrics_print(&M, "monit_uptime_seconds %ld\n", (long)uptime);
+
+  for(f = 0; f < sizeof(metricfamilies) / sizeof(metricfamilies[0]) && !M.failed; f++) {
+    metrics_print(&M, "# TYPE %s gauge\n# HELP %s %s\n", metricfamilies[f].name, metricfamilies[f].name, metricfamilies[f].help);
+    for(s = servicelist_conf; s && !M.failed; s = s->next_conf) {
+      double value;
+
+      if((metricfamilies[f].type == -1 || metricfamilies[f].type == s->type) && get_metric(s, f, &value)) {
+        metrics_print(&M, "%s", metricfamilies[f].name);
+        print_metric_label(&M, "{service", s->name);
+        if(f == Metric_ServiceStatus || f == Metric_ServiceMonitored)
+          print_metric_label(&M, ",type", metrictypes[s->type]);
+        metrics_print(&M, "} %.15g\n", value);
+      }
+    }
+  }
+  print_metrics_port(&M);
+  print_metrics_icmp(&M);
+
+  metrics_print(&M, "# EOF\n");
+  metrics_flush(&M);
+  
+}
+
+
 static void handle_action(HttpRequest req, HttpResponse res) {
   int doaction;
   char *name = req->url;
@@ -841,23 +1036,26 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
 }
 
 
+static void init_pixel() {
+
+  pixel= xcalloc(sizeof(unsigned char), strlen(PIXEL_GIF));
+  pixel_length= decode_base64(pixel, PIXEL_GIF);
+
+}
+
+
 static void printPixel(HttpResponse res) {
 
-  static int l;
   Socket_T S= res->S;
-  static unsigned char *pixel= NULL;
   
-  if(! pixel) {
-    pixel= xcalloc(sizeof(unsigned char), strlen(PIXEL_GIF));
-    l= decode_base64(pixel, PIXEL_GIF);
-  }
-  if (l) {
+  pthread_once(&pixel_once, init_pixel);
+  if (pixel_length) {
     res->is_committed= TRUE;
     socket_print(S, "HTTP/1.0 200 OK\r\n");
-    socket_print(S, "Content-length: %d\r\n", l);
+    socket_print(S, "Content-length: %d\r\n", pixel_length);
     socket_print(S, "Content-Type: image/gif\r\n");
     socket_print(S, "Connection: close\r\n\r\n");
-    socket_write(S, pixel, l);
+    socket_write(S, pixel, pixel_length);
   }
   
 }
@@ -1674,6 +1872,14 @@ static void print_service_rules_match(HttpResponse res, Service_T s) {
       out_print(res, "<tr><td>Associated regex</td><td>If If %smatch \"%s\" %s ", ml->not ? "not " : "", ml->match_string, Util_getEventratio(a->failed, buf, sizeof(buf)));
       out_print(res, "then %s</td></tr>", Util_describeAction(a->failed, buf, sizeof(buf)));
     }
+    if(s->matchlimit) {
+      out_print(res, "<tr><td>Match limit</td><td>");
+      if(s->matchlimit->bytes)
+        out_print(res, "%llu B ", s->matchlimit->bytes);
+      if(s->matchlimit->lines)
+        out_print(res, "%lu lines ", s->matchlimit->lines);
+      out_print(res, "per cycle%s</td></tr>", s->matchlimit->skip ? ", skip to tail" : "");
+    }
   }
 }
 
@@ -1891,8 +2097,10 @@ static void print_service_params_icmp(HttpResponse res, Service_T s) {
 
     if(!Util_hasServiceStatus(s)) {
 
-      for(i= s->icmplist; i; i= i->next)
+      for(i= s->icmplist; i; i= i->next) {
         out_print(res, "<tr><td>ICMP Response time</td><td>-</td></tr>");
+        out_print(res, "<tr><td>ICMP Packet loss</td><td>-</td></tr>");
+      }
 
     } else {
 
@@ -1902,6 +2110,8 @@ static void print_service_params_icmp(HttpResponse res, Service_T s) {
         } else {
           out_print(res, "<tr><td>ICMP Response time</td><td>%.3fs [%s]</td></tr>", i->response, icmpnames[i->type]);
         }
+        if(i->loss >= 0)
+          out_print(res, "<tr><td>ICMP Packet loss</td><td>%.0f%% [%s]</td></tr>", i->loss, icmpnames[i->type]);
       }
     }
   }
@@ -2098,6 +2308,13 @@ static void print_service_params_match(HttpResponse res, Service_T s) {
         "<tr><td>Match regex</td><td><font%s>%s</td></tr>",
         (s->error & Event_Content)?" color='#ff0000'":"",
         (s->error & Event_Content)?"yes":"no");
+
+      if(s->matchlimit)
+        out_print(res,
+          "<tr><td>Match backlog</td><td>%llu B</td></tr>"
+          "<tr><td>Match skipped</td><td>%llu B</td></tr>",
+          (unsigned long long) s->inf->priv.file.match_backlog,
+          s->inf->priv.file.match_skipped);
     }
   }
 }
@@ -2264,9 +2481,7 @@ static void print_status(HttpRequest req, HttpResponse res, int version)
 
   if(stringFormat && Util_startsWith(stringFormat, "xml"))
   {
-    char *D = status_xml(NULL, level, version, socket_get_local_host(req->S));
-    out_print(res, "%s", D);
-    FREE(D);
+    status_xml_buffer(&res->output, NULL, level, version, socket_get_local_host(req->S));
     set_content_type(res, "text/xml");
   }
   else
@@ -2331,6 +2546,13 @@ static void status_service_txt(Service_T s, HttpResponse res, short level) {
         out_print(res,
                   "  %-33s %llu B\n",
                   "size", (unsigned long long) s->inf->priv.file.st_size);
+        if(s->matchlimit) {
+          out_print(res,
+                    "  %-33s %llu B\n"
+                    "  %-33s %llu B\n",
+                    "match backlog", (unsigned long long) s->inf->priv.file.match_backlog,
+                    "match skipped", s->inf->priv.file.match_skipped);
+        }
         if(s->checksum) {
           out_print(res,
                     "  %-33s %s(%s)\n",
@@ -2406,6 +2628,10 @@ static void status_service_txt(Service_T s, HttpResponse res, short level) {
                     "  %-33s %.3fs [%s]\n",
                     "icmp response time", i->is_available ? i->response : 0.,
                     icmpnames[i->type]);
+          if(i->loss >= 0)
+            out_print(res,
+                      "  %-33s %.0f%% [%s]\n",
+                      "icmp packet loss", i->loss, icmpnames[i->type]);
         }
       }
       if((s->type == TYPE_HOST || s->type == TYPE_PROCESS) && s-> portlist) {
@@ -2568,3 +2794,226 @@ static char *get_service_status_text(Service_T s) {
 
 }
 
+
+/**
+ * Get the service's metric value
+ * @return TRUE if the value is available, otherwise FALSE
+ */
+static int get_metric(Service_T s, Metric_Family f, double *value) {
+  switch(f) {
+    case Metric_ServiceStatus:
+      *value = s->error;
+      return TRUE;
+    case Metric_ServiceMonitored:
+      *value = s->monitor == MONITOR_YES;
+      return TRUE;
+    default:
+      break;
+  }
+
+  if(!Util_hasServiceStatus(s))
+    return FALSE;
+
+  switch(f) {
+    case Metric_SystemLoad1:
+      *value = systeminfo.loadavg[0];
+      break;
+    case Metric_SystemLoad5:
+      *value = systeminfo.loadavg[1];
+      break;
+    case Metric_SystemLoad15:
+      *value = systeminfo.loadavg[2];
+      break;
+    case Metric_SystemCpuUser:
+      *value = systeminfo.total_cpu_user_percent / 10.;
+      break;
+    case Metric_SystemCpuSystem:
+      *value = systeminfo.total_cpu_syst_percent / 10.;
+      break;
+    case Metric_SystemCpuWait:
+      *value = systeminfo.total_cpu_wait_percent / 10.;
+      break;
+    case Metric_SystemMemory:
+      *value = systeminfo.total_mem_kbyte * 1024.;
+      break;
+    case Metric_SystemMemoryPercent:
+      *value = systeminfo.total_mem_percent / 10.;
+      break;
+    case Metric_SystemSwap:
+      *value = systeminfo.total_swap_kbyte * 1024.;
+      break;
+    case Metric_SystemSwapPercent:
+      *value = systeminfo.total_swap_percent / 10.;
+      break;
+    case Metric_ProcessPid:
+      *value = s->inf->priv.process.pid;
+      break;
+    case Metric_ProcessUptime:
+      *value = s->inf->priv.process.uptime;
+      break;
+    case Metric_ProcessChildren:
+      *value = s->inf->priv.process.children;
+      break;
+    case Metric_ProcessCpu:
+      *value = s->inf->priv.process.cpu_percent / 10.;
+      break;
+    case Metric_ProcessCpuTotal:
+      *value = s->inf->priv.process.total_cpu_percent / 10.;
+      break;
+    case Metric_ProcessMemory:
+      *value = s->inf->priv.process.mem_kbyte * 1024.;
+      break;
+    case Metric_ProcessMemoryTotal:
+      *value = s->inf->priv.process.total_mem_kbyte * 1024.;
+      break;
+    case Metric_FilesystemSpace:
+      *value = (double)s->inf->priv.filesystem.space_total * s->inf->priv.filesystem.f_bsize;
+      break;
+    case Metric_FilesystemSpacePercent:
+      *value = s->inf->priv.filesystem.space_percent / 10.;
+      break;
+    case Metric_FilesystemInode:
+      if(s->inf->priv.filesystem.f_files <= 0)
+        return FALSE;
+      *value = s->inf->priv.filesystem.inode_total;
+      break;
+    case Metric_FilesystemInodePercent:
+      if(s->inf->priv.filesystem.f_files <= 0)
+        return FALSE;
+      *value = s->inf->priv.filesystem.inode_percent / 10.;
+      break;
+    case Metric_FileSize:
+      *value = s->inf->priv.file.st_size;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+
+/**
+ * Print the port test results. The index label is the position of the
+ * test in the service's port list, so the label sets are unique even if
+ * the service tests the same port several times.
+ */
+static void print_metrics_port(Metrics_T M) {
+  int family;
+  int index;
+  Port_T p;
+  Service_T s;
+  const char *names[] = {"monit_port_up", "monit_port_response_seconds"};
+  const char *help[] = {"1 if the port test succeeded", "Port connection and protocol test time"};
+
+  for(family = 0; family < 2 && !M->failed; family++) {
+    metrics_print(M, "# TYPE %s gauge\n# HELP %s %s\n", names[family], names[family], help[family]);
+    for(s = servicelist_conf; s && !M->failed; s = s->next_conf) {
+      if(s->monitor != MONITOR_YES)
+        continue;
+      for(p = s->portlist, index = 1; p; p = p->next, index++) {
+        if(family == 1 && p->response < 0)
+          continue;
+        metrics_print(M, "%s", names[family]);
+        print_metric_label(M, "{service", s->name);
+        metrics_print(M, ",index=\"%d\"", index);
+        if(p->family == AF_UNIX) {
+          print_metric_label(M, ",path", p->pathname);
+        } else {
+          print_metric_label(M, ",host", p->hostname);
+          metrics_print(M, ",port=\"%d\"", p->port);
+        }
+        print_metric_label(M, ",protocol", p->protocol->name);
+        print_metric_label(M, ",request", p->request);
+        metrics_print(M, "} %.15g\n", family ? p->response : (double)p->is_available);
+      }
+    }
+  }
+}
+
+
+/**
+ * Print the ping test results, the index label is the position of the
+ * test in the service's icmp list
+ */
+static void print_metrics_icmp(Metrics_T M) {
+  int family;
+  int index;
+  Icmp_T i;
+  Service_T s;
+  const char *names[] = {"monit_icmp_up", "monit_icmp_response_seconds", "monit_icmp_loss_ratio"};
+  const char *help[] = {"1 if the host answered the ping", "Ping response time", "Ratio of the ping requests without reply"};
+
+  for(family = 0; family < 3 && !M->failed; family++) {
+    metrics_print(M, "# TYPE %s gauge\n# HELP %s %s\n", names[family], names[family], help[family]);
+    for(s = servicelist_conf; s && !M->failed; s = s->next_conf) {
+      if(s->monitor != MONITOR_YES)
+        continue;
+      for(i = s->icmplist, index = 1; i; i = i->next, index++) {
+        if((family == 1 && i->response < 0) || (family == 2 && i->loss < 0))
+          continue;
+        metrics_print(M, "%s", names[family]);
+        print_metric_label(M, "{service", s->name);
+        metrics_print(M, ",index=\"%d\"", index);
+        metrics_print(M, "} %.15g\n", family == 2 ? i->loss / 100. : family ? i->response : (double)i->is_available);
+      }
+    }
+  }
+}
+
+
+/**
+ * Print the label with the value escaped, the name includes the
+ * preceding separator
+ */
+static void print_metric_label(Metrics_T M, const char *name, const char *value) {
+  const char *p;
+
+  metrics_print(M, "%s=\"", name);
+  for(p = value; p && *p; p++) {
+    if(*p == '"' || *p == '\\')
+      metrics_print(M, "\\%c", *p);
+    else if(*p == '\n')
+      metrics_print(M, "\\n");
+    else if(M->used < METRICS_BUFSIZE - 1)
+      M->buf[M->used++] = *p;
+    else
+      metrics_print(M, "%c", *p);
+  }
+  metrics_print(M, "\"");
+}
+
+
+/**
+ * Append the formatted string to the metrics buffer, the buffer is
+ * flushed to the socket first if the string doesn't fit
+ */
+static void metrics_print(Metrics_T M, const char *m, ...) {
+  int n;
+  va_list ap;
+
+  if(M->failed)
+    return;
+
+  va_start(ap, m);
+  n = vsnprintf(M->buf + M->used, METRICS_BUFSIZE - M->used, m, ap);
+  va_end(ap);
+  if(n >= METRICS_BUFSIZE - M->used) {
+    metrics_flush(M);
+    va_start(ap, m);
+    n = vsnprintf(M->buf, METRICS_BUFSIZE, m, ap);
+    va_end(ap);
+    if(n >= METRICS_BUFSIZE)
+      n = METRICS_BUFSIZE - 1;
+  }
+  if(n > 0)
+    M->used += n;
+}
+
+
+static void metrics_flush(Metrics_T M) {
+  if(M->used && !M->failed && socket_write(M->S, M->buf, M->used) < 0) {
+    DEBUG("Metrics: error sending data -- %s\n", STRERROR);
+    M->failed = TRUE;
+  }
+  M->used = 0;
+}
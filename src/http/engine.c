@@ -96,9 +96,11 @@
  *  request and response to the processor module.
  *
  *  NOTE
- *    This server does not use threads or forks; Requests are
- *    serialized and pending requests will be popped from the
- *    connection queue when the current request finish.
+ *    The accepted connections are queued and served by a pool of
+ *    HTTPD_WORKERS threads, so a slow client does not block the other
+ *    clients. If all threads are busy and the queue is full, pending
+ *    connections wait in the listen queue. An idle persistent
+ *    connection gives up its thread when other connections wait.
  *
  *    Since this server is written for monit, low traffic is expected.
  *    Connect from not-authenicated clients will be closed down
@@ -119,11 +121,22 @@
 /* ------------------------------------------------------------- Definitions */
 
 
+/* Number of threads serving the connections */
+#define HTTPD_WORKERS 8
+
+/* Maximum number of accepted connections waiting for a thread */
+#define HTTPD_QUEUE   64
+
 static int myServerSocket= 0;
 static HostsAllow hostlist= NULL;
 static volatile int stopped= FALSE;
 ssl_server_connection *mySSLServerConnection= NULL;
 static pthread_mutex_t hostlist_mutex= PTHREAD_MUTEX_INITIALIZER;
+static Socket_T connection_queue[HTTPD_QUEUE];
+static int connection_head= 0;
+static int connection_count= 0;
+static pthread_mutex_t connection_mutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connection_cond= PTHREAD_COND_INITIALIZER;
 struct ulong_net {
   unsigned long network;
   unsigned long mask;
@@ -140,6 +153,9 @@ static int  is_host_allow(const struct in_addr);
 static void destroy_host_allow(HostsAllow);
 static Socket_T socket_producer(int, int, void*);
 static int  parse_network(char *, struct ulong_net *);
+static void connection_put(Socket_T);
+static Socket_T connection_get();
+static void *connection_worker(void *);
 
 /* ------------------------------------------------------------------ Public */
 
@@ -152,7 +168,10 @@ static int  parse_network(char *, struct ulong_net *);
  */
 void start_httpd(int port, int backlog, char *bindAddr) {
 
+  int i;
+  int workers= 0;
   Socket_T S= NULL;
+  pthread_t worker[HTTPD_WORKERS];
 
   stopped= Run.stopped;
 
@@ -193,16 +212,38 @@ void start_httpd(int port, int backlog, char *bindAddr) {
 #endif
     }
     
+    for(i= 0; i < HTTPD_WORKERS; i++) {
+      int status;
+
+      if((status= pthread_create(&worker[workers], NULL, connection_worker, NULL)) != 0) {
+        LogError("http server: Could not create the worker thread -- %s\n", strerror(status));
+        break;
+      }
+      workers++;
+    }
+    
     while(! stopped) {
       
       if(!(S= socket_producer(myServerSocket, port, mySSLServerConnection))) {
 	continue;
       }
 
-      http_processor(S);
+      /* Serve the request directly if no worker could be started */
+      if(workers)
+        connection_put(S);
+      else
+        http_processor(S);
       
     }
 
+    LOCK(connection_mutex)
+      pthread_cond_broadcast(&connection_cond);
+    END_LOCK;
+    for(i= 0; i < workers; i++)
+      pthread_join(worker[i], NULL);
+    while((S= connection_get()))
+      socket_free(&S);
+
     delete_ssl_server_socket(mySSLServerConnection);  
     close_socket(myServerSocket);
 
@@ -218,6 +259,11 @@ void stop_httpd() {
 
   stopped= TRUE;
 
+  /* Wake up the threads waiting for the connection queue */
+  LOCK(connection_mutex)
+    pthread_cond_broadcast(&connection_cond);
+  END_LOCK;
+
 }
 
 
@@ -363,6 +409,23 @@ int has_hosts_allow() {
 }
 
 
+/**
+ * Are any accepted connections waiting for a worker thread?
+ * @return TRUE if the connection queue is non-empty, otherwise FALSE
+ */
+int has_waiting_connections() {
+
+  int rv;
+
+  LOCK(connection_mutex)
+      rv= (connection_count > 0);
+  END_LOCK;
+
+  return rv;
+
+}
+
+
 /** 
  * Free the host allow list
  */
@@ -670,6 +733,71 @@ static Socket_T socket_producer(int server, int port, void *sslserver) {
 }
 
 
+/**
+ * Add the accepted connection to the queue, wait if the queue is full
+ */
+static void connection_put(Socket_T S) {
+
+  LOCK(connection_mutex)
+  
+  while(connection_count == HTTPD_QUEUE && ! stopped)
+    pthread_cond_wait(&connection_cond, &connection_mutex);
+  
+  if(stopped) {
+    socket_free(&S);
+  } else {
+    connection_queue[(connection_head + connection_count) % HTTPD_QUEUE]= S;
+    connection_count++;
+    pthread_cond_broadcast(&connection_cond);
+  }
+  
+  END_LOCK;
+
+}
+
+
+/**
+ * Remove the first connection from the queue, wait until there is
+ * some. Returns NULL if the server was stopped and the queue is empty.
+ */
+static Socket_T connection_get() {
+
+  Socket_T S= NULL;
+
+  LOCK(connection_mutex)
+  
+  while(! connection_count && ! stopped)
+    pthread_cond_wait(&connection_cond, &connection_mutex);
+  
+  if(connection_count) {
+    S= connection_queue[connection_head];
+    connection_head= (connection_head + 1) % HTTPD_QUEUE;
+    connection_count--;
+    pthread_cond_broadcast(&connection_cond);
+  }
+  
+  END_LOCK;
+
+  return S;
+
+}
+
+
+/**
+ * The worker thread serving the queued connections
+ */
+static void *connection_worker(void *arg) {
+
+  Socket_T S;
+
+  while(! stopped && (S= connection_get()))
+    http_processor(S);
+
+  return NULL;
+
+}
+
+
 /* ----------------------------------------------------------------- Cleanup */
 
 
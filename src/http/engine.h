@@ -51,6 +51,7 @@ void stop_httpd();
 int add_host_allow(char *);
 int add_net_allow(char *);
 int has_hosts_allow();
+int has_waiting_connections();
 void destroy_hosts_allow();
 
 
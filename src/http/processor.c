@@ -67,6 +67,10 @@
 #include <string.h>
 #endif
 
+#ifdef HAVE_CTYPE_H
+#include <ctype.h>
+#endif
+
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
@@ -81,6 +85,7 @@
 
 #include "processor.h"
 #include "base64.h"
+#include "engine.h"
 
 
 /**
@@ -113,7 +118,10 @@
 /* -------------------------------------------------------------- Prototypes */
 
 
-static void do_service(Socket_T);
+static int do_service(Socket_T, int);
+static int is_keepalive(HttpRequest);
+static int wait_request(Socket_T);
+static int has_token(const char *, const char *);
 static void destroy_entry(void *);
 static char *get_date(char *, int);
 static char *get_server(char *, int); 
@@ -138,15 +146,21 @@ static int get_next_token(char *s, int *cursor, char **r);
 
 /**
  * Process a HTTP request. This is done by dispatching to the service
- * function. 
+ * function. If the client asks for persistent connection, the
+ * following requests are processed until the client closes the
+ * connection, stays idle for KEEPALIVE_TIMEOUT seconds or
+ * KEEPALIVE_MAX requests were served. The connection is not kept
+ * while other connections wait for a worker thread.
  * @param s A Socket_T representing the client connection
  */
 void *http_processor(Socket_T s) {
+  int requests= 0;
 
   if(! can_read(socket_get_socket(s), REQUEST_TIMEOUT)) {
     internal_error(s, SC_REQUEST_TIMEOUT, "Time out when handling the Request");
   } else {
-    do_service(s);
+    while(do_service(s, ++requests < KEEPALIVE_MAX && ! has_waiting_connections()) && wait_request(s))
+      ;
   }
   socket_free(&s);
 
@@ -205,24 +219,13 @@ void send_error(HttpResponse res, int code, const char *msg) {
  */
 void out_print(HttpResponse res, const char *m, ...) {
   if(m) {
-    char *buf;
     va_list ap;
-    long need= 0;
-    ssize_t have= 0;
 
     ASSERT(res);
 
     va_start(ap, m);
-    buf= Util_formatString(m, ap, &need);
+    Util_vstringbuffer(&res->output, m, ap);
     va_end(ap);
-    have= res->bufsize - res->bufused;
-    if(have <= need) {
-      res->bufsize += need + RES_STRLEN;
-      res->outputbuffer= xresize(res->outputbuffer, res->bufsize);
-    }
-    memcpy(&res->outputbuffer[res->bufused], buf, need); 
-    res->bufused+= need;
-    FREE(buf);
   }
 }
 
@@ -441,12 +444,21 @@ const char *get_status_string(int status) {
 /**
  * Receives standard HTTP requests from a client socket and dispatches
  * them to the doXXX methods defined in a cervlet module.
+ * @param s A Socket_T representing the client connection
+ * @param keepalive TRUE if the connection may be kept open
+ * @return TRUE if the connection should be kept open for the next
+ * request, otherwise FALSE
  */
-static void do_service(Socket_T s) {
+static int do_service(Socket_T s, int keepalive) {
+  int rv= FALSE;
   volatile HttpResponse res= create_HttpResponse(s);
   volatile HttpRequest req= create_HttpRequest(s);
   
   if(res && req) {
+    /* Answer HTTP/1.1 clients in kind, so they keep the connection */
+    if(IS(req->protocol, "1.1"))
+      res->protocol= SERVER_PROTOCOL11;
+    res->is_keepalive= keepalive && is_keepalive(req);
     if(is_authenticated(req, res)) {
       if(IS(req->method, METHOD_GET)) {
 	Impl.doGet(req, res);
@@ -456,9 +468,67 @@ static void do_service(Socket_T s) {
 	send_error(res, SC_NOT_IMPLEMENTED, "Method not implemented");
       }
     }
+    /* If the cervlet sent the response itself, the content length is
+     * unknown and the response ends by closing the connection */
+    if(res->is_committed)
+      res->is_keepalive= FALSE;
     send_response(res);
+    rv= res->is_keepalive;
   }
   done(req, res);
+  return rv;
+}
+
+
+/**
+ * Wait for the next request on a persistent connection. The wait is
+ * abandoned if other connections are waiting for a worker thread, so
+ * idle clients cannot hold all workers.
+ * @return TRUE if the next request can be read, otherwise FALSE
+ */
+static int wait_request(Socket_T s) {
+  int i;
+
+  for(i= 0; i < KEEPALIVE_TIMEOUT; i++) {
+    if(socket_can_read(s, 1))
+      return TRUE;
+    if(has_waiting_connections())
+      return FALSE;
+  }
+  return FALSE;
+}
+
+
+/**
+ * Returns TRUE if the client asks for persistent connection. It is
+ * the default in HTTP/1.1, HTTP/1.0 clients have to ask explicitly.
+ */
+static int is_keepalive(HttpRequest req) {
+  const char *connection= get_header(req, "Connection");
+
+  if(has_token(connection, "close"))
+    return FALSE;
+  if(has_token(connection, "keep-alive"))
+    return TRUE;
+  return ! IS(req->protocol, "1.0");
+}
+
+
+/**
+ * Returns TRUE if the comma separated header value list contains the
+ * given token
+ */
+static int has_token(const char *list, const char *token) {
+  int n= strlen(token);
+
+  while(list && *list) {
+    while(*list == ',' || isspace((int)*list))
+      list++;
+    if(! strncasecmp(list, token, n) && (! list[n] || list[n] == ',' || isspace((int)list[n])))
+      return TRUE;
+    list= strchr(list, ',');
+  }
+  return FALSE;
 }
 
 
@@ -467,9 +537,10 @@ static void do_service(Socket_T s) {
  */
 static char *get_date(char *result, int size) {
   time_t now;
+  struct tm tm_now;
   
   time(&now);
-  if(strftime(result, size, DATEFMT, gmtime(&now)) <= 0) {
+  if(strftime(result, size, DATEFMT, gmtime_r(&now, &tm_now)) <= 0) {
     *result= 0;
   }
   return result;
@@ -496,21 +567,35 @@ static void send_response(HttpResponse res) {
     char date[STRLEN];
     char server[STRLEN];
     char *headers= get_headers(res);
+    char *head;
+    size_t headlen;
 
     res->is_committed= TRUE;
     get_date(date, STRLEN);
     get_server(server, STRLEN);
-    socket_print(S, "%s %d %s\r\n", res->protocol, res->status,
-		 res->status_msg);
-    socket_print(S, "Date: %s\r\n", date);
-    socket_print(S, "Server: %s\r\n", server);
-    socket_print(S, "Content-Length: %d\r\n", res->bufused);
-    socket_print(S, "Connection: close\r\n");
-    if(headers)
-	socket_print(S, "%s", headers);
-    socket_print(S, "\r\n");
-    if(res->bufused)
-	socket_write(S, res->outputbuffer, res->bufused);
+    /* The status line, headers and content are sent in one write, small
+     * writes would be delayed on the persistent connection by the Nagle
+     * algorithm */
+    head= Util_getString("%s %d %s\r\n"
+                         "Date: %s\r\n"
+                         "Server: %s\r\n"
+                         "Content-Length: %d\r\n"
+                         "%s"
+                         "%s"
+                         "\r\n",
+                         res->protocol, res->status, res->status_msg,
+                         date,
+                         server,
+                         (int)res->output.bufused,
+                         res->is_keepalive?"Connection: keep-alive\r\n":"Connection: close\r\n",
+                         headers?headers:"");
+    headlen= strlen(head);
+    if(res->output.bufused) {
+      head= xresize(head, headlen + res->output.bufused);
+      memcpy(head + headlen, res->output.buf, res->output.bufused);
+    }
+    socket_write(S, head, headlen + res->output.bufused);
+    FREE(head);
     FREE(headers);
   }
 }
@@ -567,11 +652,9 @@ static HttpResponse create_HttpResponse(Socket_T S) {
 
   NEW(res);
   res->S= S;
-  res->bufsize= 0;
-  res->bufused= 0;
   res->status= SC_OK;
-  res->outputbuffer= NULL;
   res->is_committed= FALSE;
+  res->is_keepalive= FALSE;
   res->protocol= SERVER_PROTOCOL;
   res->status_msg= get_status_string(SC_OK);
   return res;
@@ -660,8 +743,9 @@ static int create_parameters(HttpRequest req) {
 static void reset_response(HttpResponse res) {
   if(res->headers)
     destroy_entry(res->headers);
-  memset(res->outputbuffer, 0, res->bufsize);
-  res->bufused= 0;
+  if(res->output.buf)
+    *res->output.buf= 0;
+  res->output.bufused= 0;
   res->headers= NULL; /* Release Pragma */
 }
 
@@ -699,7 +783,7 @@ static void destroy_HttpRequest(HttpRequest req) {
  */
 static void destroy_HttpResponse(HttpResponse res) {
   if(res) {
-    FREE(res->outputbuffer);
+    FREE(res->output.buf);
     if(res->headers) 
       destroy_entry(res->headers);
     FREE(res);
@@ -39,6 +39,7 @@
 #define SERVER_VERSION     VERSION
 #define SERVER_URL         "http://mmonit.com/monit/"
 #define SERVER_PROTOCOL    "HTTP/1.0"
+#define SERVER_PROTOCOL11  "HTTP/1.1"
 #define DATEFMT             "%a, %d %b %Y %H:%M:%S GMT"
 
 /* Protocol methods supported */
@@ -55,6 +56,10 @@
 /* Request timeout in seconds */
 #define REQUEST_TIMEOUT    30 
 
+/* Persistent connection idle timeout in seconds and maximum requests */
+#define KEEPALIVE_TIMEOUT  5
+#define KEEPALIVE_MAX      100
+
 #define TRUE               1
 #define FALSE              0
 
@@ -83,13 +88,12 @@ typedef struct response {
   int status;
   Socket_T S;
   const char *protocol;
-  size_t bufsize;
-  size_t bufused;
+  Buffer_T output;
   int is_committed;
+  int is_keepalive;
   HttpHeader headers;
   ssl_connection *ssl;
   const char *status_msg; 
-  unsigned char *outputbuffer;
 } *HttpResponse;
 
 
@@ -0,0 +1,724 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_STDDEF_H
+#include <stddef.h>
+#else
+#define offsetof(st, m) ((size_t) ( (char *)&((st *)(0))->m - (char *)0 ))
+#endif
+
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#include "monit.h"
+#include "journal.h"
+
+
+/**
+ *  Append-only journal of the event queue.
+ *
+ *  The journal is a sequence of segment files named journal.<sequence>.
+ *  The records are appended to the last segment, a new segment is started
+ *  when the last one reached JOURNAL_SEGMENT_SIZE. Each record starts
+ *  with a header holding the data size, the CRC-32 of the data and the
+ *  flags of the pending handlers. The replay reads the segment from its
+ *  acknowledged offset in large batches and writes only the changed
+ *  flags back in place, so the record itself is never rewritten. The
+ *  acknowledged offset advances over the leading acknowledged records,
+ *  the segment is removed when it has no pending record.
+ *
+ *  The count and the size of the pending records are kept in memory,
+ *  they are seeded by the scan when the journal is opened, so the queue
+ *  quota is checked without any I/O. Each record has a priority, the
+ *  records with the priority zero can be dropped first when the queue
+ *  is full.
+ *
+ *  The journal is shared by the threads posting the events and by the
+ *  replay, all operations are serialized by the journal mutex.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define JOURNAL_PREFIX       "journal."
+#define JOURNAL_MAGIC        0x4A524E4C
+#define JOURNAL_SEGMENT_SIZE 1048576
+#define JOURNAL_RECORD_MAX   4194304
+#define JOURNAL_BATCH        65536
+
+/* The on-disk record header, in host byte order */
+typedef struct myrecord {
+  unsigned int magic;                                  /**< JOURNAL_MAGIC */
+  unsigned int size;                                 /**< Record data size */
+  unsigned int checksum;                        /**< CRC-32 of record data */
+  unsigned int flags;      /**< Pending handlers, zero if acknowledged */
+  unsigned int priority;      /**< Eviction priority, zero is dropped first */
+} Record_T;
+
+typedef struct mysegment {
+  unsigned int      seq;                       /**< Segment sequence number */
+  off_t             size;                 /**< Size of the valid records */
+  off_t             ack;   /**< Offset of the first unacknowledged record */
+  int               pending;                  /**< Unacknowledged records */
+  int               low;    /**< Unacknowledged records with priority zero */
+  unsigned long long bytes;        /**< Size of the unacknowledged records */
+  struct mysegment *next;                        /**< Next (newer) segment */
+} *Segment_T;
+
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t replay_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char           *journal_dir = NULL;
+static Segment_T       segments = NULL;
+static unsigned int    journal_seq = 0;
+static int             journal_fd = -1;
+static int             journal_pending = 0;
+static unsigned long long journal_bytes = 0;
+static unsigned int    journal_generation = 0;   /* Changed when closed */
+static unsigned int    journal_drops = 0;
+static Segment_T       inflight = NULL;   /* The record in the handler */
+static off_t           inflight_offset = 0;
+static unsigned int    crc_table[256];
+
+
+/* -------------------------------------------------------------- Prototypes */
+
+
+static void         close_journal();
+static unsigned int crc32(const void *, size_t);
+static void         segment_path(char *, int, unsigned int);
+static Segment_T    last_segment();
+static void         scan_segment(Segment_T);
+static void         remove_segment(Segment_T);
+static void         account(Segment_T, Record_T *, int);
+static void         forget(Segment_T);
+static void         advance_ack(Segment_T, int);
+static int          replay_segment(Segment_T, int (*)(void *, int, unsigned int *, void *), void *, unsigned int);
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int Journal_open(const char *dir) {
+  int rv = TRUE;
+
+  ASSERT(dir);
+
+  LOCK(journal_mutex)
+  {
+    DIR           *D;
+    struct dirent *de;
+    Segment_T      S;
+
+    if (journal_dir && ! strcmp(journal_dir, dir))
+      goto done;
+
+    close_journal();
+
+    if (! (D = opendir(dir))) {
+      LogError("%s: cannot open the event queue directory %s -- %s\n", prog, dir, STRERROR);
+      rv = FALSE;
+      goto done;
+    }
+    journal_dir = xstrdup(dir);
+
+    /* Keep the segments sorted by the sequence number */
+    while ((de = readdir(D))) {
+      unsigned int seq;
+      char c;
+      Segment_T *p;
+
+      if (sscanf(de->d_name, JOURNAL_PREFIX "%x%c", &seq, &c) != 1)
+        continue;
+      for (p = &segments; *p && (*p)->seq < seq; p = &(*p)->next)
+        ;
+      NEW(S);
+      S->seq = seq;
+      S->next = *p;
+      *p = S;
+      if (seq > journal_seq)
+        journal_seq = seq;
+    }
+    closedir(D);
+
+    for (S = segments; S; ) {
+      Segment_T next = S->next;
+      scan_segment(S);
+      if (! S->pending)
+        remove_segment(S);
+      S = next;
+    }
+
+    if (journal_pending)
+      DEBUG("%s: event queue journal has %d pending event(s)\n", prog, journal_pending);
+  }
+  done:
+  END_LOCK;
+
+  return rv;
+}
+
+
+void Journal_close() {
+  LOCK(journal_mutex)
+    close_journal();
+  END_LOCK;
+}
+
+
+int Journal_append(const void *data, int size, unsigned int flags, unsigned int priority) {
+  int rv = FALSE;
+
+  ASSERT(data);
+  ASSERT(size >= 0);
+  ASSERT(flags);
+
+  LOCK(journal_mutex)
+  {
+    Segment_T S = last_segment();
+    char      path[STRLEN];
+    char     *buf;
+    size_t    length = sizeof(Record_T) + size;
+    Record_T  R;
+
+    if (! journal_dir) {
+      LogError("%s: event queue journal is not open\n", prog);
+      goto done;
+    }
+
+    /* Start a new segment if needed */
+    if (! S || S->size >= JOURNAL_SEGMENT_SIZE) {
+      mode_t mask;
+
+      if (journal_fd != -1) {
+        close(journal_fd);
+        journal_fd = -1;
+      }
+      segment_path(path, sizeof(path), journal_seq + 1);
+      mask = umask(QUEUEMASK);
+      journal_fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0600);
+      umask(mask);
+      if (journal_fd == -1) {
+        LogError("%s: cannot create the event queue journal %s -- %s\n", prog, path, STRERROR);
+        goto done;
+      }
+      fcntl(journal_fd, F_SETFD, FD_CLOEXEC);
+      NEW(S);
+      S->seq = ++journal_seq;
+      if (segments)
+        last_segment()->next = S;
+      else
+        segments = S;
+    } else if (journal_fd == -1) {
+      segment_path(path, sizeof(path), S->seq);
+      if ((journal_fd = open(path, O_RDWR)) == -1) {
+        LogError("%s: cannot open the event queue journal %s -- %s\n", prog, path, STRERROR);
+        goto done;
+      }
+      fcntl(journal_fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    R.magic    = JOURNAL_MAGIC;
+    R.size     = size;
+    R.checksum = crc32(data, size);
+    R.flags    = flags;
+    R.priority = priority;
+    buf = xmalloc(length);
+    memcpy(buf, &R, sizeof(Record_T));
+    memcpy(buf + sizeof(Record_T), data, size);
+
+    /* One write, so the record is either complete or removed */
+    if (pwrite(journal_fd, buf, length, S->size) != (ssize_t)length) {
+      LogError("%s: cannot write to the event queue journal -- %s\n", prog, STRERROR);
+      if (ftruncate(journal_fd, S->size))
+        LogError("%s: cannot truncate the event queue journal -- %s\n", prog, STRERROR);
+    } else {
+      if (! S->pending)
+        S->ack = S->size;
+      S->size += length;
+      account(S, &R, 1);
+      rv = TRUE;
+    }
+    FREE(buf);
+  }
+  done:
+  END_LOCK;
+
+  return rv;
+}
+
+
+void Journal_replay(int (*handler)(void *data, int size, unsigned int *flags, void *ctx), void *ctx) {
+  ASSERT(handler);
+
+  /* One replay at a time, the journal itself is unlocked while the
+   * handler runs */
+  LOCK(replay_mutex)
+  {
+    LOCK(journal_mutex)
+    {
+      Segment_T    S;
+      unsigned int generation = journal_generation;
+
+      for (S = segments; S; ) {
+        Segment_T next;
+        int       stopped = ! replay_segment(S, handler, ctx, generation);
+
+        /* The journal was closed by the handler or by another thread */
+        if (generation != journal_generation)
+          break;
+        next = S->next;
+        if (! S->pending)
+          remove_segment(S);
+        if (stopped)
+          break;
+        S = next;
+      }
+    }
+    END_LOCK;
+  }
+  END_LOCK;
+}
+
+
+int Journal_drop(unsigned int priority, unsigned int *flags) {
+  int rv = FALSE;
+
+  ASSERT(flags);
+
+  LOCK(journal_mutex)
+  {
+    Segment_T S;
+
+    for (S = segments; S && ! rv; S = S->next) {
+      int      fd;
+      off_t    offset;
+      char     path[STRLEN];
+      Record_T R;
+
+      if (! S->pending || (! priority && ! S->low))
+        continue;
+      segment_path(path, sizeof(path), S->seq);
+      if ((fd = open(path, O_RDWR)) == -1) {
+        LogError("%s: cannot open the event queue journal %s -- %s\n", prog, path, STRERROR);
+        continue;
+      }
+      /* Find the oldest pending record with the priority */
+      for (offset = S->ack; offset < S->size; offset += sizeof(Record_T) + R.size) {
+        unsigned int zero = 0;
+
+        if (pread(fd, &R, sizeof(R), offset) != sizeof(R) || R.magic != JOURNAL_MAGIC)
+          break;
+        if (! R.flags || R.priority > priority || (S == inflight && offset == inflight_offset))
+          continue;
+        if (pwrite(fd, &zero, sizeof(zero), offset + offsetof(Record_T, flags)) != sizeof(zero)) {
+          LogError("%s: cannot update the event queue journal %s -- %s\n", prog, path, STRERROR);
+          break;
+        }
+        *flags = R.flags;
+        journal_drops++;
+        account(S, &R, -1);
+        if (offset == S->ack)
+          advance_ack(S, fd);
+        rv = TRUE;
+        break;
+      }
+      close(fd);
+      if (rv && ! S->pending) {
+        remove_segment(S);
+        break;
+      }
+    }
+  }
+  END_LOCK;
+
+  return rv;
+}
+
+
+int Journal_pending() {
+  int pending;
+
+  LOCK(journal_mutex)
+    pending = journal_pending;
+  END_LOCK;
+
+  return pending;
+}
+
+
+unsigned long long Journal_bytes() {
+  unsigned long long bytes;
+
+  LOCK(journal_mutex)
+    bytes = journal_bytes;
+  END_LOCK;
+
+  return bytes;
+}
+
+
+unsigned long long Journal_length(int size) {
+  return sizeof(Record_T) + (unsigned long long)size;
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void close_journal() {
+  Segment_T S, next;
+
+  if (journal_fd != -1) {
+    close(journal_fd);
+    journal_fd = -1;
+  }
+  for (S = segments; S; S = next) {
+    next = S->next;
+    FREE(S);
+  }
+  segments = NULL;
+  inflight = NULL;
+  journal_generation++;
+  journal_seq = 0;
+  journal_pending = 0;
+  journal_bytes = 0;
+  FREE(journal_dir);
+}
+
+
+/**
+ * Compute the CRC-32 (IEEE 802.3) of the data
+ */
+static unsigned int crc32(const void *data, size_t size) {
+  unsigned int crc = 0xFFFFFFFF;
+  const unsigned char *p = data;
+
+  if (! crc_table[1]) {
+    unsigned int i, j;
+    for (i = 0; i < 256; i++) {
+      unsigned int c = i;
+      for (j = 0; j < 8; j++)
+        c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      crc_table[i] = c;
+    }
+  }
+  while (size--)
+    crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+  return crc ^ 0xFFFFFFFF;
+}
+
+
+static void segment_path(char *path, int size, unsigned int seq) {
+  snprintf(path, size, "%s/" JOURNAL_PREFIX "%08x", journal_dir, seq);
+}
+
+
+static Segment_T last_segment() {
+  Segment_T S;
+
+  for (S = segments; S && S->next; S = S->next)
+    ;
+  return S;
+}
+
+
+/**
+ * Read the record headers of the segment to find its pending records.
+ * The segment is truncated after the last complete record, a record
+ * torn by a crash is removed this way.
+ */
+static void scan_segment(Segment_T S) {
+  int         fd;
+  off_t       offset = 0;
+  char        path[STRLEN];
+  struct stat st;
+
+  segment_path(path, sizeof(path), S->seq);
+  if ((fd = open(path, O_RDWR)) == -1 || fstat(fd, &st)) {
+    LogError("%s: cannot read the event queue journal %s -- %s\n", prog, path, STRERROR);
+    if (fd != -1)
+      close(fd);
+    return;
+  }
+
+  S->ack = -1;
+  while (offset < st.st_size) {
+    Record_T R;
+
+    if (pread(fd, &R, sizeof(R), offset) != sizeof(R) || R.magic != JOURNAL_MAGIC || R.size > JOURNAL_RECORD_MAX || offset + (off_t)sizeof(R) + R.size > st.st_size) {
+      LogError("%s: event queue journal %s is damaged at offset %lld, the rest of the file is dropped\n", prog, path, (long long)offset);
+      if (ftruncate(fd, offset))
+        LogError("%s: cannot truncate the event queue journal %s -- %s\n", prog, path, STRERROR);
+      break;
+    }
+    if (R.flags) {
+      if (S->ack == -1)
+        S->ack = offset;
+      account(S, &R, 1);
+    }
+    offset += sizeof(R) + R.size;
+  }
+  close(fd);
+
+  S->size = offset;
+  if (S->ack == -1)
+    S->ack = S->size;
+}
+
+
+/**
+ * Remove the segment from the list and delete its file
+ */
+static void remove_segment(Segment_T S) {
+  Segment_T *p;
+  char path[STRLEN];
+
+  for (p = &segments; *p && *p != S; p = &(*p)->next)
+    ;
+  if (! *p)
+    return;
+  *p = S->next;
+
+  /* The journal fd belongs to the last segment */
+  if (! S->next && journal_fd != -1) {
+    close(journal_fd);
+    journal_fd = -1;
+  }
+
+  segment_path(path, sizeof(path), S->seq);
+  DEBUG("%s: removing acknowledged event queue journal %s\n", prog, path);
+  if (unlink(path) && errno != ENOENT)
+    LogError("%s: cannot remove the event queue journal %s -- %s\n", prog, path, STRERROR);
+  forget(S);
+  FREE(S);
+}
+
+
+/**
+ * Add (sign 1) or subtract (sign -1) the pending record to the counters
+ */
+static void account(Segment_T S, Record_T *R, int sign) {
+  unsigned long long length = sizeof(Record_T) + R->size;
+
+  S->pending += sign;
+  journal_pending += sign;
+  if (! R->priority)
+    S->low += sign;
+  if (sign > 0) {
+    S->bytes += length;
+    journal_bytes += length;
+  } else {
+    S->bytes -= length;
+    journal_bytes -= length;
+  }
+}
+
+
+/**
+ * Subtract all pending records of the segment from the counters
+ */
+static void forget(Segment_T S) {
+  journal_pending -= S->pending;
+  journal_bytes -= S->bytes;
+  S->pending = 0;
+  S->low = 0;
+  S->bytes = 0;
+}
+
+
+/**
+ * Move the acknowledged offset over the acknowledged records
+ */
+static void advance_ack(Segment_T S, int fd) {
+  Record_T R;
+
+  while (S->ack < S->size && pread(fd, &R, sizeof(R), S->ack) == sizeof(R) && R.magic == JOURNAL_MAGIC && ! R.flags)
+    S->ack += sizeof(R) + R.size;
+}
+
+
+/**
+ * Replay the pending records of the segment. The journal mutex is
+ * released while the handler runs, so the alerts and the M/Monit
+ * reports don't block the threads which add events to the queue. The
+ * record in the handler is not dropped meanwhile, the other records can
+ * be dropped and new records appended.
+ * @return FALSE if the handler stopped the replay or the journal was
+ * closed, otherwise TRUE
+ */
+static int replay_segment(Segment_T S, int (*handler)(void *, int, unsigned int *, void *), void *ctx, unsigned int generation) {
+  int     fd;
+  int     rv = TRUE;
+  int     acknowledged = TRUE;
+  off_t   offset = S->ack;
+  size_t  bufsize = JOURNAL_BATCH;
+  char   *buf;
+  char    path[STRLEN];
+
+  if (! S->pending)
+    return TRUE;
+
+  segment_path(path, sizeof(path), S->seq);
+  if ((fd = open(path, O_RDWR)) == -1) {
+    LogError("%s: cannot open the event queue journal %s -- %s\n", prog, path, STRERROR);
+    return TRUE;
+  }
+
+  buf = xmalloc(bufsize);
+  while (rv && offset < S->size && S->pending) {
+    int          grown = FALSE;
+    size_t       p = 0;
+    unsigned int drops = journal_drops;
+    ssize_t      n = pread(fd, buf, MIN(bufsize, (size_t)(S->size - offset)), offset);
+
+    if (n <= 0) {
+      LogError("%s: cannot read the event queue journal %s -- %s\n", prog, path, n ? STRERROR : "end of file");
+      break;
+    }
+
+    /* Handle all complete records of the batch */
+    while (p + sizeof(Record_T) <= (size_t)n) {
+      Record_T R;
+      size_t   length;
+
+      memcpy(&R, buf + p, sizeof(Record_T));
+      length = sizeof(Record_T) + R.size;
+      if (R.magic != JOURNAL_MAGIC || R.size > JOURNAL_RECORD_MAX)
+        break;
+      if (p + length > (size_t)n) {
+        /* The record continues in the next batch */
+        if (! p && length > bufsize) {
+          bufsize = length;
+          buf = xresize(buf, bufsize);
+          grown = TRUE;
+        }
+        break;
+      }
+
+      /* The flags in the batch are stale if a record was dropped */
+      if (drops != journal_drops && pread(fd, &R.flags, sizeof(R.flags), offset + p + offsetof(Record_T, flags)) != sizeof(R.flags)) {
+        LogError("%s: cannot read the event queue journal %s -- %s\n", prog, path, STRERROR);
+        break;
+      }
+
+      if (R.flags) {
+        unsigned int flags = R.flags;
+
+        if (crc32(buf + p + sizeof(Record_T), R.size) != R.checksum) {
+          LogError("%s: event queue journal %s record at offset %lld is corrupted -- dropped\n", prog, path, (long long)(offset + p));
+          flags = 0;
+        } else {
+          int handled;
+
+          inflight = S;
+          inflight_offset = offset + p;
+          assert(pthread_mutex_unlock(&journal_mutex) == 0);
+          handled = handler(buf + p + sizeof(Record_T), R.size, &flags, ctx);
+          assert(pthread_mutex_lock(&journal_mutex) == 0);
+          if (generation != journal_generation) {
+            /* The segment was freed */
+            rv = FALSE;
+            break;
+          }
+          inflight = NULL;
+          if (! handled) {
+            rv = FALSE;
+            break;
+          }
+        }
+
+        if (flags != R.flags) {
+          if (pwrite(fd, &flags, sizeof(flags), offset + p + offsetof(Record_T, flags)) != sizeof(flags)) {
+            LogError("%s: cannot update the event queue journal %s -- %s\n", prog, path, STRERROR);
+            flags = R.flags;
+          } else if (! flags) {
+            account(S, &R, -1);
+          }
+        }
+        if (flags)
+          acknowledged = FALSE;
+      }
+
+      p += length;
+      /* The acknowledged offset covers the leading acknowledged records */
+      if (acknowledged)
+        S->ack = offset + p;
+    }
+    offset += p;
+
+    if (rv && ! p && ! grown) {
+      /* The file was modified outside of monit, count the remaining
+       * records again */
+      forget(S);
+      scan_segment(S);
+      break;
+    }
+  }
+
+  FREE(buf);
+  close(fd);
+
+  return rv;
+}
+
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_JOURNAL_H
+#define MONIT_JOURNAL_H
+
+
+/**
+ *  Append-only journal of the event queue. The records are appended to
+ *  segment files in the queue directory, each record carries a checksum
+ *  of its data and the flags of the handlers which didn't process it
+ *  yet. A record is acknowledged by clearing its flags in place. Every
+ *  segment keeps the offset of its first unacknowledged record, so the
+ *  replay doesn't read the acknowledged records again, and a segment is
+ *  removed once all its records were acknowledged. The directory is
+ *  scanned only when the journal is opened.
+ *
+ *  The record is handed to the kernel by a single write before
+ *  Journal_append() returns, the same as the event file was written
+ *  before. A record torn by a crash is detected by its checksum and
+ *  skipped.
+ *
+ *  @file
+ */
+
+
+/**
+ * Open the journal in the given directory, the existing segments are
+ * scanned to find the unacknowledged records. If the journal is open
+ * in the same directory already, the call does nothing.
+ * @param dir The event queue directory
+ * @return TRUE if succeeded, otherwise FALSE
+ */
+int Journal_open(const char *dir);
+
+
+/**
+ * Close the journal. The records stay in the directory.
+ */
+void Journal_close();
+
+
+/**
+ * Append a record to the journal
+ * @param data The record data
+ * @param size The record data size
+ * @param flags The pending handlers flags, must not be zero
+ * @param priority The eviction priority, the records with the lower
+ * priority can be dropped first by Journal_drop()
+ * @return TRUE if the record was written, otherwise FALSE
+ */
+int Journal_append(const void *data, int size, unsigned int flags, unsigned int priority);
+
+
+/**
+ * Replay the unacknowledged records in the order they were appended.
+ * The handler is called for every record and sets the record's flags
+ * to the handlers which still failed, zero acknowledges the record. The
+ * changed flags are written to the journal. The replay stops if the
+ * handler returns FALSE, the record isn't modified in that case. The
+ * journal isn't locked while the handler runs, the records can be
+ * appended and dropped meanwhile except the record in the handler.
+ * @param handler The record handler
+ * @param ctx The context passed to the handler
+ */
+void Journal_replay(int (*handler)(void *data, int size, unsigned int *flags, void *ctx), void *ctx);
+
+
+/**
+ * Drop the oldest unacknowledged record with the priority not greater
+ * than the given priority. The record is acknowledged without replay.
+ * @param priority The highest priority of the dropped record
+ * @param flags The pending handlers flags of the dropped record
+ * @return TRUE if a record was dropped, FALSE if there is no such record
+ */
+int Journal_drop(unsigned int priority, unsigned int *flags);
+
+
+/**
+ * @return The number of unacknowledged records in the journal
+ */
+int Journal_pending();
+
+
+/**
+ * @return The size of the unacknowledged records in bytes, including
+ * the record headers
+ */
+unsigned long long Journal_bytes();
+
+
+/**
+ * @param size The record data size
+ * @return The journal space taken by a record of the given size,
+ * including the record header, as counted by Journal_bytes()
+ */
+unsigned long long Journal_length(int size);
+
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_CTYPE_H
+#include <ctype.h>
+#endif
+
+#ifdef HAVE_REGEX_H
+#include <regex.h>
+#endif
+
+#include "monit.h"
+#include "matcher.h"
+
+
+/**
+ *  Combined matcher for the content match rules of a service.
+ *
+ *  Each rule's pattern is reduced to the longest literal text which
+ *  any matching line must contain. The literals of all rules are
+ *  compiled into one Aho-Corasick automaton with the transitions over
+ *  the bytes used by the literals only, so the automaton stays small
+ *  even with many rules. A line is scanned once and a rule whose
+ *  literal was not found cannot match, hence its regular expression
+ *  is not executed. Patterns without a required literal, for example
+ *  those using alternation, are always executed.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+struct mymatcher {
+  int      count;                                         /**< Rules count */
+  Match_T *rule;                                   /**< Rules in list order */
+  char   **literal;              /**< Literal required by the rule or NULL */
+  int      literals;                   /**< Number of rules with a literal */
+  int      classes;                         /**< Number of the byte classes */
+  unsigned char map[256];                   /**< Byte to byte class mapping */
+  int      states;                         /**< Number of automaton states */
+  int     *delta;                     /**< Transitions, states * classes */
+  int     *output;               /**< First rule which ends in the state */
+  int     *suffix;   /**< Nearest suffix state with output or -1 if none */
+  int     *next;               /**< Next rule with the same literal or -1 */
+};
+
+
+/* -------------------------------------------------------------- Prototypes */
+
+
+static char *get_literal(const char *);
+static void  build_automaton(Matcher_T);
+static void  scan_literals(Matcher_T, const char *, int *);
+static int   test_rule(Matcher_T, int, const char *, int);
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+Matcher_T Matcher_new(Match_T list) {
+  int i;
+  Match_T ml;
+  Matcher_T M;
+
+  NEW(M);
+  for (ml = list; ml; ml = ml->next)
+    M->count++;
+  M->rule = xcalloc(M->count ? M->count : 1, sizeof(Match_T));
+  M->literal = xcalloc(M->count ? M->count : 1, sizeof(char *));
+  for (i = 0, ml = list; ml; ml = ml->next, i++) {
+    M->rule[i] = ml;
+#ifdef HAVE_REGEX_H
+    M->literal[i] = get_literal(ml->match_string);
+#else
+    M->literal[i] = *ml->match_string ? xstrdup(ml->match_string) : NULL;
+#endif
+    if (M->literal[i]) {
+      M->literals++;
+      DEBUG("Match rule '%s' requires literal '%s'\n", ml->match_string, M->literal[i]);
+    }
+  }
+  build_automaton(M);
+
+  return M;
+}
+
+
+void Matcher_free(Matcher_T *M) {
+  int i;
+
+  ASSERT(M && *M);
+
+  for (i = 0; i < (*M)->count; i++)
+    FREE((*M)->literal[i]);
+  FREE((*M)->literal);
+  FREE((*M)->rule);
+  FREE((*M)->delta);
+  FREE((*M)->output);
+  FREE((*M)->suffix);
+  FREE((*M)->next);
+  FREE(*M);
+}
+
+
+int Matcher_count(Matcher_T M) {
+  ASSERT(M);
+
+  return M->count;
+}
+
+
+Match_T Matcher_match(Matcher_T M, const char *line, int *matched) {
+  int i;
+  int hit = FALSE;
+
+  ASSERT(M && line && matched);
+
+  /* The literals found in the line are marked in the result array first,
+   * the rule's final result then replaces its mark */
+  scan_literals(M, line, matched);
+
+  for (i = 0; i < M->count; i++) {
+    if (! M->rule[i]->ignore) {
+      matched[i] = test_rule(M, i, line, matched[i]) ^ M->rule[i]->not;
+      if (matched[i])
+        hit = TRUE;
+    }
+  }
+
+  if (hit) {
+    for (i = 0; i < M->count; i++) {
+      if (M->rule[i]->ignore && (test_rule(M, i, line, matched[i]) ^ M->rule[i]->not))
+        return M->rule[i];
+    }
+  }
+
+  return NULL;
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Get the longest literal text which must be present in any string
+ * matched by the given extended regular expression. The pattern is
+ * analyzed conservatively: alternation, bracket expressions, groups,
+ * backslash sequences and quantified characters end the literal.
+ * @param pattern The regular expression
+ * @return The literal text (to be freed by the caller) or NULL if the
+ * pattern has no usable literal
+ */
+static char *get_literal(const char *pattern) {
+  int depth = 0;
+  size_t length = 0;
+  size_t bestlength = 0;
+  const char *p;
+  char *run;
+  char *best;
+
+  ASSERT(pattern);
+
+  /* Any alternation makes every literal optional */
+  if (strchr(pattern, '|'))
+    return NULL;
+
+  run = xcalloc(1, strlen(pattern) + 1);
+  best = xcalloc(1, strlen(pattern) + 1);
+
+  for (p = pattern; TRUE; p++) {
+    int literal = FALSE;
+
+    switch (*p) {
+      case '[':
+        /* Skip the bracket expression, including the [:class:], [.coll.]
+         * and [=equiv=] elements which may contain the closing bracket */
+        p++;
+        if (*p == '^')
+          p++;
+        if (*p == ']')
+          p++;
+        while (*p && *p != ']') {
+          if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+            char delimiter = p[1];
+            for (p += 2; *p && ! (*p == delimiter && p[1] == ']'); p++)
+              ;
+            if (*p)
+              p++;
+          }
+          if (*p)
+            p++;
+        }
+        if (! *p)
+          goto invalid;
+        break;
+      case '(':
+        depth++;
+        break;
+      case ')':
+        depth--;
+        break;
+      case '*':
+      case '?':
+      case '{':
+      case '+':
+        {
+          /* The preceding character is optional unless it is followed
+           * only by '+' quantifiers, drop it including the continuation
+           * bytes of a multibyte character */
+          int optional = FALSE;
+          for (; *p == '*' || *p == '?' || *p == '{' || *p == '+'; p++) {
+            if (*p != '+')
+              optional = TRUE;
+            if (*p == '{') {
+              while (*p && *p != '}')
+                p++;
+              if (! *p)
+                goto invalid;
+            }
+          }
+          p--;
+          if (optional) {
+            while (length && (run[length - 1] & 0xC0) == 0x80)
+              length--;
+            if (length)
+              length--;
+          }
+        }
+        break;
+      case '\\':
+        p++;
+        if (! *p)
+          goto invalid;
+        /* Escaped punctuation is literal, other sequences are extensions
+         * such as \w or \b */
+        literal = ! isalnum((unsigned char)*p);
+        break;
+      case '.':
+      case '^':
+      case '$':
+      case 0:
+        break;
+      default:
+        literal = TRUE;
+        break;
+    }
+
+    /* The characters inside of a group may be optional */
+    if (literal && depth == 0) {
+      run[length++] = *p;
+    } else {
+      if (length > bestlength) {
+        memcpy(best, run, length);
+        bestlength = length;
+      }
+      length = 0;
+    }
+    if (! *p)
+      break;
+  }
+
+  FREE(run);
+  if (bestlength) {
+    best[bestlength] = 0;
+    return best;
+  }
+  FREE(best);
+  return NULL;
+
+  invalid:
+  FREE(run);
+  FREE(best);
+  return NULL;
+}
+
+
+/**
+ * Build the Aho-Corasick automaton from the rules' literals
+ */
+static void build_automaton(Matcher_T M) {
+  int i;
+  int c;
+  int states = 1;
+  int head = 0;
+  int tail = 0;
+  int *fail;
+  int *queue;
+
+  /* Map the bytes used by the literals to the classes 1..n, all other
+   * bytes share the class 0 */
+  M->classes = 1;
+  for (i = 0; i < M->count; i++) {
+    unsigned char *p;
+    for (p = (unsigned char *)M->literal[i]; p && *p; p++)
+      if (! M->map[*p])
+        M->map[*p] = M->classes++;
+    if (M->literal[i])
+      states += strlen(M->literal[i]);
+  }
+
+  M->delta  = xcalloc(states * M->classes, sizeof(int));
+  M->output = xcalloc(states, sizeof(int));
+  M->suffix = xcalloc(states, sizeof(int));
+  M->next   = xcalloc(M->count ? M->count : 1, sizeof(int));
+  fail      = xcalloc(states, sizeof(int));
+  queue     = xcalloc(states, sizeof(int));
+
+  for (i = 0; i < states * M->classes; i++)
+    M->delta[i] = -1;
+  for (i = 0; i < states; i++) {
+    M->output[i] = -1;
+    M->suffix[i] = -1;
+  }
+
+  /* Trie */
+  M->states = 1;
+  for (i = 0; i < M->count; i++) {
+    int state = 0;
+    unsigned char *p;
+    M->next[i] = -1;
+    if (! M->literal[i])
+      continue;
+    for (p = (unsigned char *)M->literal[i]; *p; p++) {
+      int *t = &M->delta[state * M->classes + M->map[*p]];
+      if (*t == -1)
+        *t = M->states++;
+      state = *t;
+    }
+    /* Append to keep the rules with the same literal in list order */
+    if (M->output[state] == -1) {
+      M->output[state] = i;
+    } else {
+      int r;
+      for (r = M->output[state]; M->next[r] != -1; r = M->next[r])
+        ;
+      M->next[r] = i;
+    }
+  }
+
+  /* Failure and dictionary suffix links in breadth-first order, the
+   * missing transitions are completed so the scan is one lookup per
+   * byte */
+  for (c = 0; c < M->classes; c++) {
+    int *t = &M->delta[c];
+    if (*t == -1) {
+      *t = 0;
+    } else {
+      fail[*t] = 0;
+      queue[tail++] = *t;
+    }
+  }
+  while (head < tail) {
+    int u = queue[head++];
+    for (c = 0; c < M->classes; c++) {
+      int *t = &M->delta[u * M->classes + c];
+      if (*t == -1) {
+        *t = M->delta[fail[u] * M->classes + c];
+      } else {
+        int v = *t;
+        fail[v] = M->delta[fail[u] * M->classes + c];
+        M->suffix[v] = M->output[fail[v]] != -1 ? fail[v] : M->suffix[fail[v]];
+        queue[tail++] = v;
+      }
+    }
+  }
+
+  FREE(fail);
+  FREE(queue);
+}
+
+
+/**
+ * Scan the line and mark the rules whose literal was found
+ */
+static void scan_literals(Matcher_T M, const char *line, int *found) {
+  int state = 0;
+  int remaining = M->literals;
+  const unsigned char *p;
+
+  memset(found, 0, M->count * sizeof(int));
+
+  for (p = (const unsigned char *)line; *p && remaining; p++) {
+    int t;
+    state = M->delta[state * M->classes + M->map[*p]];
+    for (t = M->output[state] != -1 ? state : M->suffix[state]; t != -1; t = M->suffix[t]) {
+      int r;
+      for (r = M->output[t]; r != -1; r = M->next[r]) {
+        if (! found[r]) {
+          found[r] = TRUE;
+          remaining--;
+        }
+      }
+    }
+  }
+}
+
+
+/**
+ * Test the rule's pattern on the line, the "not" flag is not applied
+ */
+static int test_rule(Matcher_T M, int i, const char *line, int found) {
+  if (M->literal[i] && ! found)
+    return FALSE;
+#ifdef HAVE_REGEX_H
+  return regexec(M->rule[i]->regex_comp, line, 0, NULL, 0) == 0;
+#else
+  /* The literal is the complete match string */
+  return TRUE;
+#endif
+}
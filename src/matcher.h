@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_MATCHER_H
+#define MONIT_MATCHER_H
+
+
+/**
+ *  Combined matcher for the content match rules of a service. The
+ *  literal text which each rule's pattern requires is compiled into
+ *  one Aho-Corasick automaton, so a single scan of the line finds the
+ *  rules which can possibly match. The regular expression is executed
+ *  only for these candidates and for the rules without a usable
+ *  literal.
+ *
+ *  @file
+ */
+
+
+/**
+ * Compile the given match list into a combined matcher. The list must
+ * not be modified while the matcher is in use.
+ * @param list The service's match list
+ * @return A new matcher object
+ */
+Matcher_T Matcher_new(Match_T list);
+
+
+/**
+ * Destroy a matcher object and release allocated resources
+ * @param M A reference to a matcher object
+ */
+void Matcher_free(Matcher_T *M);
+
+
+/**
+ * Get the number of rules in the matcher
+ * @param M A matcher object
+ * @return The number of rules
+ */
+int Matcher_count(Matcher_T M);
+
+
+/**
+ * Match the line against all rules with one scan. On return matched[i]
+ * is TRUE if the i-th non ignore rule of the list matched, with the
+ * rule's "not" flag applied. The ignore rules are tested only if some
+ * non ignore rule matched.
+ * @param M A matcher object
+ * @param line The NUL terminated line to match
+ * @param matched An array of Matcher_count() elements for the result
+ * @return The ignore rule which matched the line or NULL if the line
+ * is not ignored
+ */
+Match_T Matcher_match(Matcher_T M, const char *line, int *matched);
+
+
+#endif
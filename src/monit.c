@@ -131,7 +131,7 @@ ProcessTree_T *oldptree = NULL;
 
 char actionnames[][STRLEN]   = {"ignore", "alert", "restart", "stop", "exec", "unmonitor", "start", "monitor", ""};
 char modenames[][STRLEN]     = {"active", "passive", "manual"};
-char checksumnames[][STRLEN] = {"UNKNOWN", "MD5", "SHA1"};
+char checksumnames[][STRLEN] = {"UNKNOWN", "MD5", "SHA1", "SHA256", "XXH64"};
 char operatornames[][STRLEN] = {"greater than", "less than", "equal to", "not equal to"};
 char operatorshortnames[][3] = {">", "<", "=", "!="};
 char monitornames[][STRLEN]  = {"not monitored", "monitored", "initializing"};
@@ -236,9 +236,17 @@ static void do_init() {
   /*
    * Initialize the Runtime mutex. This mutex
    * is used to synchronize handling of global
-   * service data
+   * service data. The mutex is recursive as
+   * the event handling may post new events
    */
-  status = pthread_mutex_init(&Run.mutex, NULL);
+  {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    status = pthread_mutex_init(&Run.mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+  }
   if (status != 0) {
     LogError("%s: Cannot initialize mutex -- %s\n", prog, strerror(status));
     exit(1);
@@ -340,10 +348,19 @@ static void do_reinit() {
   if (Run.dohttpd)
     monit_http(STOP_HTTP);
 
+  /* Deliver or save the pending notifications */
+  Event_delivery_stop();
+
   /* Save the current state (no changes are possible now
      since the http thread is stopped) */
   State_save();
 
+  /* Stop watching the paths of the services to be released */
+  Watch_stop();
+
+  /* Release the metrics history of the services */
+  History_stop();
+
   /* Run the garbage collector */
   gc();
 
@@ -375,11 +392,20 @@ static void do_reinit() {
 
   /* Update service data from the state repository */
   State_update();
+
+  /* Watch the paths of the services */
+  Watch_start();
+
+  /* Record the metrics history of the services */
+  History_start();
   
   /* Start http interface */
   if (can_http())
     monit_http(START_HTTP);
 
+  /* Start the notification delivery */
+  Event_delivery_start();
+
   /* send the monit startup notification */
   Event_post(Run.system, Event_Instance, STATE_CHANGED, Run.system->action_MONIT_RELOAD, "Monit reloaded");
 
@@ -492,6 +518,9 @@ static void do_exit() {
 
     /* send the monit stop notification */
     Event_post(Run.system, Event_Instance, STATE_CHANGED, Run.system->action_MONIT_STOP, "Monit stopped");
+
+    /* Deliver or save the pending notifications */
+    Event_delivery_stop();
   }
   gc();
   exit(0);
@@ -532,6 +561,10 @@ static void do_default() {
     if (State_shouldUpdate())
       State_update();
 
+    Watch_start();
+
+    History_start();
+
     atexit(file_finalize);
   
     if (Run.startdelay) {
@@ -549,6 +582,9 @@ static void do_default() {
 
     if (can_http())
       monit_http(START_HTTP);
+
+    /* Start the notification delivery */
+    Event_delivery_start();
     
     /* send the monit startup notification */
     Event_post(Run.system, Event_Instance, STATE_CHANGED, Run.system->action_MONIT_START, "Monit started");
@@ -562,9 +598,15 @@ static void do_default() {
       validate();
       State_save();
 
-      /* In the case that there is no pending action then sleep */
-      if (!Run.doaction)
-        sleep(Run.polltime);
+      /* In the case that there is no pending action then sleep. If the
+       * path of a service watched for immediate check changes, the sleep
+       * is interrupted and the service is checked right away */
+      if (!Run.doaction) {
+        time_t now, wakeup = time(NULL) + Run.polltime;
+        while ((now = time(NULL)) < wakeup && Watch_wait(wakeup - now) &&
+               !Run.doaction && !Run.dowakeup && !Run.stopped && !Run.doreload)
+          validate_changed();
+      }
 
       if (Run.dowakeup) {
         Run.dowakeup = FALSE;
@@ -105,6 +105,7 @@
 #define MYSTATEFILE        "monit.state"
 #define MYIDFILE           "monit.id"
 #define MYEVENTLISTBASE    "/var/monit"
+#define HISTORY_SIZE       1048576
 
 #define LOCALHOST          "localhost"
 
@@ -138,6 +139,14 @@
 #define MODE_PASSIVE       1
 #define MODE_MANUAL        2
 
+#define WATCH_NONE         0
+#define WATCH_CHANGES      1
+#define WATCH_IMMEDIATE    2
+
+#define QUEUE_DROP_NONE      0
+#define QUEUE_DROP_OLDEST    1
+#define QUEUE_DROP_SUCCEEDED 2
+
 #define OPERATOR_GREATER   0
 #define OPERATOR_LESS      1
 #define OPERATOR_EQUAL     2
@@ -197,6 +206,8 @@
 #define HASH_UNKNOWN       0
 #define HASH_MD5           1
 #define HASH_SHA1          2
+#define HASH_SHA256        3
+#define HASH_XXH64         4
 #define DEFAULT_HASH       HASH_MD5   
 /* Length of the longest message digest in bytes */
 #define MD_SIZE            65
@@ -345,6 +356,9 @@ typedef struct mymmonit {
   URL_T url;                                             /**< URL definition */
   Ssl_T ssl;                                             /**< SSL definition */
   int   timeout;              /**< The timeout to wait for connection or i/o */
+  int   keepalive;          /**< TRUE if the connection is kept open (HTTP/1.1) */
+  int   compress;                /**< TRUE if the message is sent gzip encoded */
+  int   delta;  /**< TRUE if the status reports contain changed services only */
 
   /** For internal use */
   struct mymmonit *next;                         /**< next receiver in chain */
@@ -511,6 +525,8 @@ typedef struct myicmp {
   int timeout;              /**< The timeout in seconds to wait for response */
   int is_available;                     /**< TRUE if the server is available */
   double response;                              /**< ICMP ECHO response time */
+  double loss;      /**< Percent of the ICMP ECHO requests lost or -1 */
+  int is_tested;          /**< TRUE if the host was pinged in the ICMP batch */
   EventAction_T action;  /**< Description of the action upon event occurence */
   
   /** For internal use */
@@ -603,6 +619,16 @@ typedef struct mychecksum {
 } *Checksum_T;
 
 
+/** Defines the file metadata which identifies a cached checksum */
+typedef struct mychecksumkey {
+  dev_t     dev;                                                 /**< Device */
+  ino_t     ino;                                                  /**< Inode */
+  off_t     size;                                                  /**< Size */
+  long long mtime;                      /**< Modification time in nanoseconds */
+  long long ctime;                     /**< Status change time in nanoseconds */
+} ChecksumKey_T;
+
+
 /** Defines permission object */
 typedef struct myperm {
   int       perm;                                     /**< Access permission */
@@ -625,6 +651,18 @@ typedef struct mymatch {
 } *Match_T;
 
 
+/** Defines the content match limit per cycle */
+typedef struct mymatchlimit {
+  unsigned long long bytes;        /**< Bytes matched per cycle limit or 0 */
+  unsigned long lines;             /**< Lines matched per cycle limit or 0 */
+  int  skip;               /**< TRUE if the backlog is skipped to the tail */
+} *MatchLimit_T;
+
+
+/** Defines the combined matcher of the service's match list */
+typedef struct mymatcher *Matcher_T;
+
+
 /** Defines uid object */
 typedef struct myuid {
   uid_t     uid;                                            /**< Owner's uid */
@@ -680,9 +718,14 @@ typedef struct myinfo {
     struct {
       off_t st_size;                                               /**< Size */
       off_t readpos;                        /**< Position for regex matching */
+      off_t match_backlog;       /**< Bytes left to match by the next cycle */
+      unsigned long long match_skipped; /**< Bytes skipped by match limit */
       ino_t st_ino;                                               /**< Inode */
       ino_t st_ino_prev;              /**< Previous inode for regex matching */
       MD_T  cs_sum;                                            /**< Checksum */
+      ChecksumKey_T cs_key;           /**< File metadata of the cached checksum */
+      int   cs_cached;                    /**< TRUE if the cs_key is valid */
+      int   cs_cycles;         /**< Cycles since the checksum was computed */
     } file;
 
     struct {
@@ -720,6 +763,8 @@ typedef struct myservice {
   int  def_every;              /**< TRUE if every is defined for the service */
   int  visited;      /**< Service visited flag, set if dependencies are used */
   int  depend_visited;/**< Depend visited flag, set if dependencies are used */
+  int  watch;                             /**< Path change watch mode flag */
+  int  changed;          /**< TRUE if the watched path changed since check */
   Command_T start;                    /**< The start command for the service */
   Command_T stop;                      /**< The stop command for the service */
 
@@ -737,6 +782,8 @@ typedef struct myservice {
   Resource_T  resourcelist;                          /**< Resouce check list */
   Size_T      sizelist;                                 /**< Size check list */
   Match_T     matchlist;                             /**< Content Match list */
+  Matcher_T   matcher;                    /**< Compiled content Match list */
+  MatchLimit_T matchlimit;              /**< Content Match limit per cycle */
   Timestamp_T timestamplist;                       /**< Timestamp check list */
   Uid_T       uid;                                            /**< Uid check */
   
@@ -783,12 +830,17 @@ typedef struct myservice {
     struct myevent   *next;                         /**< next event in chain */
     struct myevent   *previous;                 /**< previous event in chain */
   } *eventlist;                                     /**< Pending events list */
+  struct myevent  **eventindex;  /**< Pending events hash by action and id */
+  int               eventindex_size;         /**< Index size, a power of two */
+  int               eventindex_count;              /**< Events in the index */
 
   /** Context specific parameters */
   char *path;  /**< Path to the filesys, file, directory or process pid file */
   
   /** For internal use */
   pthread_mutex_t   mutex;        /**< Mutex used for action synchronization */
+  unsigned long long report_acked;   /**< Status hash acknowledged by M/Monit */
+  unsigned long long report_sent;       /**< Status hash of the last report */
   struct myservice *next;                         /**< next service in chain */
   struct myservice *next_conf;      /**< next service according to conf file */
   struct myservice *next_depend;           /**< next depend service in chain */
@@ -840,7 +892,13 @@ struct myrun {
   Service_T system;                          /**< The general system service */
   char *eventlist_dir;                   /**< The event queue base directory */
   int  eventlist_slots;          /**< The event queue size - number of slots */
+  unsigned long long eventlist_bytes;  /**< The event queue size in bytes or 0 */
+  int  eventlist_policy;         /**< The event queue full policy (QUEUE_DROP) */
   int  expectbuffer; /**< Generic protocol expect buffer - STRLEN by default */
+  int  workers;              /**< Number of concurrent service check threads */
+  int  checksumcache;                /**< TRUE if the checksum cache is used */
+  int  checksumrehash;  /**< Cached checksum full rehash interval in cycles */
+  unsigned long long history_bytes; /**< Metrics history memory budget or 0 */
 
        /** An object holding program relevant "environment" data, see; env.c */
   struct myenvironment {
@@ -902,6 +960,10 @@ extern char sslnames[][STRLEN];
 
 #include "util.h"
 #include "file.h"
+#include "matcher.h"
+#include "watch.h"
+#include "history.h"
+#include "journal.h"
 
 /* FIXME: move remaining prototypes into seperate header-files */
 
@@ -930,6 +992,8 @@ void vsyslog (int, const char *, va_list);
 #endif /* HAVE_SYSLOG */
 #endif /* HAVE_VSYSLOG */
 int   validate();
+int   validate_changed();
+void  checksum_statistics(unsigned long *, unsigned long *);
 void  daemonize();
 void  gc();
 void  gc_mail_list(Mail_T *);
@@ -938,6 +1002,7 @@ void  gc_event(Event_T *e);
 int   kill_daemon(int);
 int   exist_daemon(); 
 int   sendmail(Mail_T);
+void  sendmail_close();
 int   sock_msg(int, char *, ...);
 void  init_env();
 void *xmalloc (int);
@@ -970,7 +1035,11 @@ void reset_procinfo(Service_T);
 int  check_service_status(Service_T);
 void printhash(char *);  
 char *status_xml(Event_T, short, int, const char *);
+void status_xml_buffer(Buffer_T *, Event_T, short, int, const char *);
+char *status_xml_report(int, const char *);
+void status_xml_acknowledge();
 int  handle_mmonit(Event_T);
+void mmonit_close();
 int  do_wakeupcall();
 
 #endif
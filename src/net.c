@@ -88,6 +88,10 @@
 #include <sys/time.h>
 #endif
 
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
 #ifdef HAVE_SYS_FILIO_H
 #include <sys/filio.h>
 #endif
@@ -152,12 +156,39 @@
 
 #define DATALEN 64
 
+/* Maximum number of echo requests in one batch, limited by the sequence number */
+#define ICMP_MAXREQUESTS 65535
+
+/* Seconds to cache the resolved and the unresolved hostname */
+#define RESOLVER_TTL          300
+#define RESOLVER_NEGATIVE_TTL 30
+
+/* Resolved address of the hostname */
+typedef struct myresolvercache {
+  char *hostname;                                 /**< The resolved hostname */
+  struct in_addr address;                       /**< The address of the host */
+  int resolved;           /**< TRUE if the address is valid, otherwise FALSE */
+  int refreshing;        /**< TRUE if the entry is being refreshed by thread */
+  time_t expire;            /**< The time when the entry should be refreshed */
+
+  /** For internal use */
+  struct myresolvercache *next;                      /**< next entry in list */
+} *ResolverCache_T;
+
+static ResolverCache_T resolver_cache = NULL;
+static unsigned long   resolver_hits = 0;
+static unsigned long   resolver_misses = 0;
+static pthread_mutex_t resolver_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 /* -------------------------------------------------------------- Prototypes */
 
 
 static int do_connect(int, const struct sockaddr *, socklen_t, int);
+static int resolver_update(const char *, struct in_addr *);
+static void *resolver_refresh(void *);
 static unsigned short checksum_ip(unsigned char *, int);
+static double get_elapsed(struct timeval *);
 
 
 /* ------------------------------------------------------------------ Public */
@@ -170,21 +201,80 @@ static unsigned short checksum_ip(unsigned char *, int);
  */
 int check_host(const char *hostname) {
 
-  struct addrinfo hints;
-  struct addrinfo *res;
+  struct in_addr address;
 
   ASSERT(hostname);
 
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = PF_INET; /* we support just IPv4 currently */
+  return resolve_host(hostname, &address);
 
-  if(getaddrinfo(hostname, NULL, &hints, &res) != 0)
-    return FALSE;
+}
 
-  freeaddrinfo(res);
 
-  return TRUE;
+/**
+ * Resolve the IPv4 address of the hostname. The address is cached, so the
+ * checks don't wait for the resolver: the expired entry is refreshed by a
+ * background thread and the cached address is used until the refresh is
+ * done. The failed lookup is cached too, for a shorter time.
+ * @param hostname The host to resolve
+ * @param address The resolved address
+ * @return TRUE if the hostname resolves, otherwise FALSE
+ */
+int resolve_host(const char *hostname, struct in_addr *address) {
+  int rv = FALSE;
+  int found = FALSE;
+  int refresh = FALSE;
+  ResolverCache_T c;
+
+  ASSERT(hostname);
+  ASSERT(address);
+
+  LOCK(resolver_mutex)
+    for (c = resolver_cache; c; c = c->next)
+      if (IS(c->hostname, hostname))
+        break;
+    if (c) {
+      found = TRUE;
+      resolver_hits++;
+      if ((rv = c->resolved))
+        *address = c->address;
+      if (c->expire <= time(NULL) && ! c->refreshing)
+        refresh = c->refreshing = TRUE;
+    } else
+      resolver_misses++;
+  END_LOCK;
+
+  if (! found)
+    return resolver_update(hostname, address);
+
+  if (refresh) {
+    int status;
+    char *name = xstrdup(hostname);
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if ((status = pthread_create(&thread, &attr, resolver_refresh, name)) != 0) {
+      DEBUG("Cannot create the resolver thread, resolving %s directly -- %s\n", hostname, strerror(status));
+      resolver_refresh(name);
+    }
+    pthread_attr_destroy(&attr);
+  }
 
+  return rv;
+}
+
+
+/**
+ * Get the resolver cache statistics
+ * @param hits The number of lookups answered from the cache
+ * @param misses The number of lookups which had to wait for the resolver
+ */
+void resolver_statistics(unsigned long *hits, unsigned long *misses) {
+  LOCK(resolver_mutex)
+    *hits   = resolver_hits;
+    *misses = resolver_misses;
+  END_LOCK;
 }
 
 
@@ -244,28 +334,20 @@ int create_socket(const char *hostname, int port, int type, int timeout) {
 
   int s;
   struct sockaddr_in sin;
-  struct sockaddr_in *sa;
-  struct addrinfo hints;
-  struct addrinfo *result;
   
   ASSERT(hostname);
 
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = AF_INET;
-  if(getaddrinfo(hostname, NULL, &hints, &result) != 0) {
+  memset(&sin, 0, sizeof(struct sockaddr_in));
+  if(! resolve_host(hostname, &sin.sin_addr)) {
     return -1;
   }
 
   if((s= socket(AF_INET, type, 0)) < 0) {
-    freeaddrinfo(result);
     return -1;
   }
 
-  sa = (struct sockaddr_in *)result->ai_addr;
-  memcpy(&sin, sa, result->ai_addrlen);
   sin.sin_family= AF_INET;
   sin.sin_port= htons(port);
-  freeaddrinfo(result);
   
   if(! set_noblock(s)) {
     goto error;
@@ -315,6 +397,103 @@ int create_generic_socket(Port_T p) {
 }
 
 
+/**
+ * Test if many ports accept connections, all at once. The INET sockets
+ * are connected in non-blocking mode and the pending connections are
+ * completed by one poll() loop, each port is given its own timeout. The
+ * UNIX sockets are local and are left to the protocol test, they are
+ * reported available. The connections are closed right away.
+ * @param probe The array of ports to probe, on return the is_available
+ * member is TRUE if the port accepted the connection
+ * @param n The number of ports in the array
+ */
+void check_ports(PortProbe_T *probe, int n) {
+
+  int i, pending = 0;
+  struct pollfd *fds;
+  struct timeval start;
+
+  ASSERT(probe);
+
+  fds = xcalloc(sizeof(struct pollfd), n);
+  gettimeofday(&start, NULL);
+  for (i = 0; i < n; i++) {
+    int s;
+    struct sockaddr_in sin;
+
+    fds[i].fd = -1;
+    probe[i].is_available = probe[i].p->family != AF_INET;
+    if (probe[i].is_available)
+      continue;
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    if (! resolve_host(probe[i].p->hostname, &sin.sin_addr))
+      continue;
+    if ((s = socket(AF_INET, probe[i].p->type, 0)) < 0)
+      continue;
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(probe[i].p->port);
+    if (! set_noblock(s) || fcntl(s, F_SETFD, FD_CLOEXEC) == -1) {
+      close_socket(s);
+      continue;
+    }
+    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) == 0) {
+      probe[i].is_available = TRUE;
+      close_socket(s);
+    } else if (errno == EINPROGRESS) {
+      fds[i].fd = s;
+      fds[i].events = POLLOUT;
+      pending++;
+    } else
+      close_socket(s);
+  }
+
+  while (pending > 0) {
+    int timeout = -1;
+    double elapsed = get_elapsed(&start);
+
+    /* Give up the connections which timed out, wait for the nearest timeout */
+    for (i = 0; i < n; i++) {
+      if (fds[i].fd >= 0) {
+        int left = (int)((probe[i].p->timeout - elapsed) * 1000);
+
+        if (left <= 0) {
+          close_socket(fds[i].fd);
+          fds[i].fd = -1;
+          pending--;
+        } else if (timeout < 0 || left < timeout)
+          timeout = left;
+      }
+    }
+    if (pending == 0)
+      break;
+    if (poll(fds, n, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      if (fds[i].fd >= 0 && fds[i].revents) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && ! error)
+          probe[i].is_available = TRUE;
+        close_socket(fds[i].fd);
+        fds[i].fd = -1;
+        pending--;
+      }
+    }
+  }
+
+  /* Close the connections left by a poll() error */
+  for (i = 0; i < n; i++)
+    if (fds[i].fd >= 0)
+      close_socket(fds[i].fd);
+  FREE(fds);
+
+}
+
+
 /**
  * Create a non-blocking UNIX socket.
  * @param pathname The pathname to use for the unix socket
@@ -644,47 +823,89 @@ int udp_write(int socket, void *b, int len, int timeout) {
  * @param timeout If response will not come within timeout seconds abort
  * @param count How many pings to send
  * @return response time on succes, -1 on error, -2 when monit has no
- * permissions for raw socket (normally requires root or net_icmpaccess
+ * permissions for ICMP socket (normally requires root or net_icmpaccess
  * privilege on Solaris)
  */
 double icmp_echo(const char *hostname, int timeout, int count) {
-  struct sockaddr_in sout;
-  struct sockaddr_in *sa;
-  struct addrinfo hints;
-  struct addrinfo *result;
-  struct ip *iphdrin;
-  int len_out = offsetof(struct icmp, icmp_data) + DATALEN;
-  int len_in = sizeof(struct ip) + sizeof(struct icmp);
-  struct icmp *icmpin = NULL;
-  struct icmp *icmpout = NULL;
-  uint16_t id_in, id_out, seq_in;
-  int r, i, s, n = 0;
-  struct timeval t_in, t_out;
+  IcmpEcho_T echo;
+
+  ASSERT(hostname);
+
+  memset(&echo, 0, sizeof(IcmpEcho_T));
+  echo.hostname = hostname;
+  echo.timeout  = timeout;
+  echo.count    = count;
+  icmp_echo_batch(&echo, 1);
+
+  return echo.response;
+}
+
+
+/**
+ * Send ICMP echo requests to all given hosts using one ICMP socket. The
+ * requests are sent in rounds: in each round one request is sent to every
+ * host which didn't reply yet and has some request left, then the replies
+ * are collected until all hosts replied or the round timed out. The
+ * replies are matched to the hosts by the request sequence number.
+ * @param echo The array of hosts to ping, the response, sent and received
+ * members are set on return
+ * @param n The number of hosts in the array
+ */
+void icmp_echo_batch(IcmpEcho_T *echo, int n) {
+  int type = SOCK_RAW;
+  int i, r, s, round, rounds = 0, total = 0;
+  int *target = NULL;
+  int *pending = NULL;
+  struct sockaddr_in *address = NULL;
+  uint16_t id, seq = 0;
   char buf[STRLEN];
-  double response = -1.;
 #if ! defined NETBSD && ! defined AIX
   int sol_ip;
   unsigned ttl = 255;
 #endif
-  
-  ASSERT(hostname);   
-  ASSERT(len_out < sizeof(buf));
 
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = AF_INET;
-  if (getaddrinfo(hostname, NULL, &hints, &result) != 0) {
-    LogError("ICMP echo for %s -- getaddrinfo failed: %s\n", hostname, STRERROR);
-    return response;
+  ASSERT(echo);
+
+  for (i = 0; i < n; i++) {
+    echo[i].response = -1.;
+    echo[i].loss = -1.;
+    echo[i].sent = echo[i].received = 0;
+    total += echo[i].count;
+    if (echo[i].count > rounds)
+      rounds = echo[i].count;
   }
 
-  if ((s = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
+  /* The sequence number identifies the request, split the batch if there
+   * are more requests than sequence numbers */
+  if (total > ICMP_MAXREQUESTS) {
+    if (n > 1) {
+      icmp_echo_batch(echo, n / 2);
+      icmp_echo_batch(echo + n / 2, n - n / 2);
+      return;
+    }
+    rounds = total = ICMP_MAXREQUESTS;
+  }
+  if (! total)
+    return;
+
+  /* Prefer the raw socket, use the unprivileged ICMP datagram socket if
+   * the system supports it and monit has no permission for raw socket */
+  if ((s = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0 && (errno == EACCES || errno == EPERM)) {
+    DEBUG("ICMP echo -- cannot create raw socket: %s, trying ICMP datagram socket\n", STRERROR);
+    if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)) >= 0)
+      type = SOCK_DGRAM;
+    else if (errno == EPROTONOSUPPORT || errno == EAFNOSUPPORT || errno == EINVAL)
+      errno = EPERM;
+  }
+  if (s < 0) {
     if (errno == EACCES || errno == EPERM) {
-      DEBUG("ICMP echo for %s -- cannot create socket: %s\n", hostname, STRERROR);
-      response = -2.;
+      DEBUG("ICMP echo -- cannot create socket: %s\n", STRERROR);
+      for (i = 0; i < n; i++)
+        echo[i].response = -2.;
     } else {
-      LogError("ICMP echo for %s -- canot create socket: %s\n", hostname, STRERROR);
+      LogError("ICMP echo -- cannot create socket: %s\n", STRERROR);
     }
-    goto error2;
+    return;
   }
 
 #if ! defined NETBSD && ! defined AIX
@@ -698,96 +919,232 @@ double icmp_echo(const char *hostname, int timeout, int count) {
   }
 #endif
   if (setsockopt(s, sol_ip, IP_TTL, (char *)&ttl, sizeof(ttl)) < 0) {
-    LogError("ICMP echo for %s -- setsockopt failed: %s\n", hostname, STRERROR);
-    goto error1;
+    LogError("ICMP echo -- setsockopt failed: %s\n", STRERROR);
+    goto error;
   }
 #endif
 
-  id_out = getpid() & 0xFFFF;
-  icmpout = (struct icmp *)buf;
-  for (i = 0; i < count; i++) {
-    int j;
-    unsigned char *data = (unsigned char *)icmpout->icmp_data;
+  address = xcalloc(sizeof(struct sockaddr_in), n);
+  pending = xcalloc(sizeof(int), n);
+  target  = xcalloc(sizeof(int), total);
 
-    icmpout->icmp_code  = 0;
-    icmpout->icmp_type  = ICMP_ECHO;
-    icmpout->icmp_id    = htons(id_out);
-    icmpout->icmp_seq   = htons(i);
-    icmpout->icmp_cksum = 0;
+  for (i = 0; i < n; i++) {
+    if (! resolve_host(echo[i].hostname, &address[i].sin_addr)) {
+      LogError("ICMP echo for %s -- cannot resolve the hostname\n", echo[i].hostname);
+      continue;
+    }
+    address[i].sin_family = AF_INET;
+    address[i].sin_port   = 0;
+  }
 
-    /* Add originate timestamp to data section */
-    gettimeofday(&t_out, NULL);
-    memcpy(data, &t_out, sizeof(struct timeval));
-    data += sizeof(struct timeval);
+  /* The kernel sets the identifier of the datagram socket requests itself
+   * and passes us only the replies to our requests */
+  id = getpid() & 0xFFFF;
+  for (round = 0; round < rounds && seq < total; round++) {
+    int waiting = 0;
+    int timeout = 0;
+    struct timeval t_now, t_end;
+
+    /* Send the requests of this round */
+    for (i = 0; i < n && seq < total; i++) {
+      int j, len_out = offsetof(struct icmp, icmp_data) + DATALEN;
+      struct icmp *icmpout = (struct icmp *)buf;
+      unsigned char *data = (unsigned char *)icmpout->icmp_data;
+      struct timeval t_out;
+
+      pending[i] = FALSE;
+      if (address[i].sin_family != AF_INET || echo[i].response >= 0 || round >= echo[i].count)
+        continue;
 
-    /* Initialize rest of data section to numeric sequence */
-    for (j = 0; j < DATALEN - sizeof(struct timeval); j++)
-      data[j] = j;
+      icmpout->icmp_code  = 0;
+      icmpout->icmp_type  = ICMP_ECHO;
+      icmpout->icmp_id    = htons(id);
+      icmpout->icmp_seq   = htons(seq);
+      icmpout->icmp_cksum = 0;
 
-    icmpout->icmp_cksum = checksum_ip((unsigned char *)icmpout, len_out);
+      /* Add originate timestamp to data section */
+      gettimeofday(&t_out, NULL);
+      memcpy(data, &t_out, sizeof(struct timeval));
+      data += sizeof(struct timeval);
 
-    sa = (struct sockaddr_in *)result->ai_addr;
-    memcpy(&sout, sa, result->ai_addrlen);
-    sout.sin_family = AF_INET;
-    sout.sin_port   = 0;
+      /* Initialize rest of data section to numeric sequence */
+      for (j = 0; j < DATALEN - sizeof(struct timeval); j++)
+        data[j] = j;
 
-    do {
-      n = sendto(s, (char *)icmpout, len_out, 0, (struct sockaddr *)&sout, sizeof(struct sockaddr));
-    } while(n == -1 && errno == EINTR);
-    if (n < 0) {
-      LogError("ICMP echo request for %s %d/%d failed -- %s\n", hostname, i + 1, count, STRERROR);
-      continue;
+      icmpout->icmp_cksum = checksum_ip((unsigned char *)icmpout, len_out);
+
+      do {
+        r = sendto(s, (char *)icmpout, len_out, 0, (struct sockaddr *)&address[i], sizeof(struct sockaddr_in));
+      } while (r == -1 && errno == EINTR);
+      if (r < 0) {
+        LogError("ICMP echo request for %s %d/%d failed -- %s\n", echo[i].hostname, round + 1, echo[i].count, STRERROR);
+        continue;
+      }
+      target[seq++] = i;
+      echo[i].sent++;
+      pending[i] = TRUE;
+      waiting++;
+      if (echo[i].timeout > timeout)
+        timeout = echo[i].timeout;
     }
-  
-    if (can_read(s, timeout)) {
+
+    /* Collect the replies */
+    gettimeofday(&t_end, NULL);
+    t_end.tv_sec += timeout;
+    while (waiting) {
+      int len_in;
+      uint16_t id_in, seq_in;
+      struct icmp *icmpin;
+      struct sockaddr_in from;
       socklen_t size = sizeof(struct sockaddr_in);
+      struct pollfd fds[1];
+
+      gettimeofday(&t_now, NULL);
+      if ((timeout = (t_end.tv_sec - t_now.tv_sec) * 1000 + (t_end.tv_usec - t_now.tv_usec) / 1000) <= 0)
+        break;
+      fds[0].fd = s;
+      fds[0].events = POLLIN;
+      if ((r = poll(fds, 1, timeout)) < 0 && errno == EINTR)
+        continue;
+      else if (r <= 0)
+        break;
 
       do {
-        n = recvfrom(s, buf, STRLEN, 0, (struct sockaddr *)&sout, &size);
-      } while(n == -1 && errno == EINTR);
-      if (n < 0) {
-        LogError("ICMP echo response for %s %d/%d failed -- %s\n", hostname, i + 1, count, STRERROR);
-        continue;
-      } else if (n < len_in) {
-        LogError("ICMP echo response for %s %d/%d failed -- received %d bytes, expected at least %d bytes\n", hostname, i + 1, count, n, len_in);
+        r = recvfrom(s, buf, STRLEN, 0, (struct sockaddr *)&from, &size);
+      } while (r == -1 && errno == EINTR);
+      if (r < 0) {
+        LogError("ICMP echo response failed -- %s\n", STRERROR);
         continue;
       }
 
-      iphdrin = (struct ip *)buf;
-      icmpin  = (struct icmp *)(buf + iphdrin->ip_hl * 4);
+      /* The raw socket passes the IP header too */
+      len_in  = type == SOCK_RAW ? ((struct ip *)buf)->ip_hl * 4 : 0;
+      if (r < len_in + offsetof(struct icmp, icmp_data) + sizeof(struct timeval)) {
+        DEBUG("ICMP echo response -- received %d bytes, expected at least %d bytes\n", r, (int)(len_in + offsetof(struct icmp, icmp_data) + sizeof(struct timeval)));
+        continue;
+      }
+      icmpin  = (struct icmp *)(buf + len_in);
       id_in   = ntohs(icmpin->icmp_id);
       seq_in  = ntohs(icmpin->icmp_seq);
-      if (icmpin->icmp_type == ICMP_ECHOREPLY) {
-        if (id_in == id_out && seq_in < (uint16_t)count) {
-          /* Get the response time */
-          gettimeofday(&t_in, NULL);
-          memcpy(&t_out, icmpin->icmp_data, sizeof(struct timeval));
-          response = (double)(t_in.tv_sec - t_out.tv_sec) + (double)(t_in.tv_usec - t_out.tv_usec) / 1000000;
-          DEBUG("ICMP echo response for %s %d/%d succeeded -- received id=%d sequence=%d response_time=%fs\n", hostname, i + 1, count, id_in, seq_in, response);
-          break; // Wait for one response only
-        } else
-          LogError("ICMP echo response for %s %d/%d error -- received id=%d (expected id=%d), received sequence=%d (expected sequence=%d)\n", hostname, i + 1, count, id_in, id_out, seq_in, i);
-      } else
-        DEBUG("ICMP echo response for %s %d/%d -- expected ECHOREPLY, received response type: %x (%s), source id=%d (mine id=%d) sequence=%d (mine sequence=%d)\n", hostname, i + 1, count, icmpin->icmp_type, icmpin->icmp_type < 19 ? icmpnames[icmpin->icmp_type] : "unknown", id_in, id_out, seq_in, i);
-    } else
-      LogError("ICMP echo response for %s %d/%d timed out -- no response within %d seconds\n", hostname, i + 1, count, timeout);
+      if (icmpin->icmp_type != ICMP_ECHOREPLY || (type == SOCK_RAW && id_in != id))
+        continue;
+      if (seq_in >= seq || from.sin_addr.s_addr != address[target[seq_in]].sin_addr.s_addr) {
+        DEBUG("ICMP echo response error -- received id=%d sequence=%d from unexpected host\n", id_in, seq_in);
+        continue;
+      }
+
+      i = target[seq_in];
+      echo[i].received++;
+      if (echo[i].response < 0) {
+        struct timeval t_out;
+
+        /* Get the response time */
+        gettimeofday(&t_now, NULL);
+        memcpy(&t_out, icmpin->icmp_data, sizeof(struct timeval));
+        echo[i].response = (double)(t_now.tv_sec - t_out.tv_sec) + (double)(t_now.tv_usec - t_out.tv_usec) / 1000000;
+        DEBUG("ICMP echo response for %s %d/%d succeeded -- received id=%d sequence=%d response_time=%fs\n", echo[i].hostname, echo[i].sent, echo[i].count, id_in, seq_in, echo[i].response);
+        if (pending[i]) {
+          pending[i] = FALSE;
+          waiting--;
+        }
+      }
+    }
+
+    for (i = 0; i < n; i++)
+      if (pending[i])
+        LogError("ICMP echo response for %s %d/%d timed out -- no response within %d seconds\n", echo[i].hostname, round + 1, echo[i].count, echo[i].timeout);
   }
 
-  error1:
+  for (i = 0; i < n; i++) {
+    if (echo[i].sent) {
+      echo[i].loss = 100. * (echo[i].sent - MIN(echo[i].received, echo[i].sent)) / echo[i].sent;
+      DEBUG("ICMP echo for %s -- %d requests sent, %d replies received, %.0f%% loss\n", echo[i].hostname, echo[i].sent, echo[i].received, echo[i].loss);
+    }
+  }
+
+  FREE(target);
+  FREE(pending);
+  FREE(address);
+
+  error:
   do {
     r = close(s);
   } while(r == -1 && errno == EINTR);
   if (r == -1)
     LogError("%s: Socket %d close failed -- %s\n", prog, s, STRERROR);
+}
+
+
+/* ----------------------------------------------------------------- Private */
 
-  error2:
-  freeaddrinfo(result);
 
-  return response;
+/*
+ * Resolve the hostname and store the result in the cache
+ */
+static int resolver_update(const char *hostname, struct in_addr *address) {
+  int rv;
+  time_t now;
+  struct addrinfo hints;
+  struct addrinfo *result;
+  ResolverCache_T c;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_INET; /* we support just IPv4 currently */
+  if ((rv = (getaddrinfo(hostname, NULL, &hints, &result) == 0))) {
+    *address = ((struct sockaddr_in *)result->ai_addr)->sin_addr;
+    freeaddrinfo(result);
+  }
+
+  now = time(NULL);
+  LOCK(resolver_mutex)
+    for (c = resolver_cache; c; c = c->next)
+      if (IS(c->hostname, hostname))
+        break;
+    if (! c) {
+      NEW(c);
+      c->hostname = xstrdup(hostname);
+      c->next = resolver_cache;
+      resolver_cache = c;
+    }
+    if (rv) {
+      c->address  = *address;
+      c->resolved = TRUE;
+      c->expire   = now + RESOLVER_TTL;
+    } else {
+      /* If the resolver fails, keep the last known address until the next attempt */
+      c->expire   = now + RESOLVER_NEGATIVE_TTL;
+    }
+    c->refreshing = FALSE;
+  END_LOCK;
+
+  return rv;
 }
 
 
-/* ----------------------------------------------------------------- Private */
+/*
+ * The thread refreshing the expired resolver cache entry
+ */
+static void *resolver_refresh(void *hostname) {
+  struct in_addr address;
+
+  if (! resolver_update(hostname, &address))
+    DEBUG("Cannot resolve %s\n", (char *)hostname);
+  FREE(hostname);
+  return NULL;
+}
+
+
+/**
+ * Get the time elapsed since the given time
+ * @param start The start time
+ * @return The elapsed time in seconds
+ */
+static double get_elapsed(struct timeval *start) {
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_usec - start->tv_usec) / 1000000;
+}
 
 
 /*
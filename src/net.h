@@ -27,6 +27,11 @@
 #define NET_H
 
 #include "config.h"
+
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
 #include "monit.h"
 
 
@@ -48,6 +53,29 @@
 #define NET_TIMEOUT 5
 
 
+/**
+ * ICMP echo test of one host, used by icmp_echo_batch()
+ */
+typedef struct myicmpecho {
+  const char *hostname;                                /**< The host to ping */
+  int timeout;              /**< The timeout in seconds to wait for response */
+  int count;                                   /**< ICMP echo requests count */
+  double response;                              /**< ICMP ECHO response time */
+  double loss;      /**< Percent of the requests sent without reply or -1 */
+  int sent;                                     /**< Number of requests sent */
+  int received;                               /**< Number of replies received */
+} IcmpEcho_T;
+
+
+/**
+ * Reachability probe of one port, used by check_ports()
+ */
+typedef struct myportprobe {
+  Port_T p;                                           /**< The port to probe */
+  int is_available;               /**< TRUE if the port accepted connection */
+} PortProbe_T;
+
+
 /**
  * Check if the hostname resolves
  * @param hostname The host to check
@@ -56,6 +84,23 @@
 int check_host(const char *hostname);
 
 
+/**
+ * Resolve the IPv4 address of the hostname. The result is cached.
+ * @param hostname The host to resolve
+ * @param address The resolved address
+ * @return TRUE if the hostname resolves, otherwise FALSE
+ */
+int resolve_host(const char *hostname, struct in_addr *address);
+
+
+/**
+ * Get the resolver cache statistics
+ * @param hits The number of lookups answered from the cache
+ * @param misses The number of lookups which had to wait for the resolver
+ */
+void resolver_statistics(unsigned long *hits, unsigned long *misses);
+
+
 /**
  * Verify that the socket is ready for i|o
  * @param socket A socket
@@ -96,6 +141,18 @@ int create_socket(const char *hostname, int port, int protocol, int timeout);
 int create_generic_socket(Port_T p);
 
 
+/**
+ * Test if many ports accept connections, all at once. The connections
+ * are started without waiting and completed together, so the call takes
+ * as long as the slowest connection instead of the sum of the connection
+ * timeouts. The connections are closed right away.
+ * @param probe The array of ports to probe, on return the is_available
+ * member is TRUE if the port accepted the connection
+ * @param n The number of ports in the array
+ */
+void check_ports(PortProbe_T *probe, int n);
+
+
 /**
  * Create a non-blocking UNIX socket.
  * @param pathname The pathname to use for the unix socket
@@ -208,8 +265,22 @@ int udp_write(int socket, void *b, int len, int timeout);
  * @param hostname The host to open a socket at
  * @param timeout If response will not come within timeout seconds abort
  * @param count How many pings to send
- * @return response time on succes, -1 on error
+ * @return response time on succes, -1 on error, -2 when monit has no
+ * permissions for ICMP socket
  */
 double icmp_echo(const char *hostname, int timeout, int count);
 
+
+/**
+ * Send echo requests to many hosts at once using one ICMP socket and wait
+ * for the responses. Each host is sent up to 'count' requests, until the
+ * first reply is received.
+ * @param echo The array of hosts to ping, on return the response is the
+ * response time on succes, -1 on error, -2 when monit has no permissions
+ * for ICMP socket and the loss is the percentage of the requests sent
+ * without reply, -1 if no request was sent
+ * @param n The number of hosts in the array
+ */
+void icmp_echo_batch(IcmpEcho_T *echo, int n);
+
 #endif
@@ -172,6 +172,7 @@
   static struct mymail mailset;
   static struct myport portset;
   static struct mymailserver mailserverset;
+  static struct mymmonit mmonitset;
   static struct myfilesystem filesystemset;
   static struct myresource resourceset;
   static struct mychecksum checksumset;
@@ -220,6 +221,7 @@
   static void  addperm(Perm_T);
   static void  addmatch(Match_T, int, int);
   static void  addmatchpath(Match_T, int);
+  static void  addmatchlimit(unsigned long long, unsigned long, int);
   static void  adduid(Uid_T);
   static void  addgid(Gid_T);
   static void  addeuid(uid_t);
@@ -232,6 +234,7 @@
   static void  setpidfile(char *);
   static void  reset_mailset();
   static void  reset_mailserverset();
+  static void  reset_mmonitset();
   static void  reset_portset();
   static void  reset_resourceset();
   static void  reset_timestampset();
@@ -266,9 +269,10 @@
 
 %token IF ELSE THEN OR FAILED
 %token SET LOGFILE FACILITY DAEMON SYSLOG MAILSERVER HTTPD ALLOW ADDRESS INIT
-%token READONLY CLEARTEXT MD5HASH SHA1HASH CRYPT DELAY
+%token READONLY CLEARTEXT MD5HASH SHA1HASH SHA256HASH XXH64HASH CRYPT DELAY
 %token PEMFILE ENABLE DISABLE HTTPDSSL CLIENTPEMFILE ALLOWSELFCERTIFICATION
 %token IDFILE STATEFILE SEND EXPECT EXPECTBUFFER CYCLE COUNT REMINDER
+%token WORKERS HISTORY
 %token PIDFILE START STOP PATHTOK
 %token HOST HOSTNAME PORT TYPE UDP TCP TCPSSL PROTOCOL CONNECTION
 %token ALERT NOALERT MAILFORMAT UNIXSOCKET SIGNATURE
@@ -285,15 +289,17 @@
 %token CHILDREN SYSTEM
 %token RESOURCE MEMORY TOTALMEMORY LOADAVG1 LOADAVG5 LOADAVG15 SWAP
 %token MODE ACTIVE PASSIVE MANUAL CPU TOTALCPU CPUUSER CPUSYSTEM CPUWAIT
-%token GROUP REQUEST DEPENDS BASEDIR SLOT EVENTQUEUE SECRET HOSTHEADER
+%token GROUP REQUEST DEPENDS BASEDIR SLOT EVENTQUEUE DROP OLDEST SECRET HOSTHEADER
 %token UID GID MMONIT INSTANCE USERNAME PASSWORD
 %token TIMESTAMP CHANGED SECOND MINUTE HOUR DAY
 %token SSLAUTO SSLV2 SSLV3 TLSV1 CERTMD5
 %token BYTE KILOBYTE MEGABYTE GIGABYTE
 %token INODE SPACE PERMISSION SIZE MATCH NOT IGNORE ACTION
+%token LIMIT LINE SKIPTOTAIL WATCH IMMEDIATELY CACHE REHASH
 %token EXEC UNMONITOR ICMP ICMPECHO NONEXIST EXIST INVALID DATA RECOVERED PASSED SUCCEEDED
 %token URL CONTENT PID PPID FSFLAG
 %token REGISTER CREDENTIALS 
+%token KEEPALIVE COMPRESS DELTA
 %token <url> URLOBJECT
 %token <string> TARGET
 %token <number> MAXFORWARD
@@ -323,6 +329,9 @@ statement       : setalert
                 | setidfile
                 | setstatefile
                 | setexpectbuffer
+                | setworkers
+                | sethistory
+                | setchecksum
                 | setinit
                 | setfips
                 | checkproc optproclist
@@ -365,6 +374,7 @@ optfile         : start
                 | timestamp
                 | actionrate
                 | every
+                | watch
                 | alert
                 | permission
                 | uid
@@ -372,6 +382,7 @@ optfile         : start
                 | checksum
                 | size
                 | match
+                | matchlimit
                 | mode
                 | group
                 | depend
@@ -408,6 +419,7 @@ optdir          : start
                 | timestamp
                 | actionrate
                 | every
+                | watch
                 | alert
                 | permission
                 | uid
@@ -458,6 +470,7 @@ optfifo         : start
                 | timestamp
                 | actionrate
                 | every
+                | watch
                 | alert
                 | permission
                 | uid
@@ -509,6 +522,38 @@ setexpectbuffer : SET EXPECTBUFFER NUMBER unit {
                   }
                 ;
 
+setworkers      : SET WORKERS NUMBER {
+                    if ($3 < 1)
+                      yyerror2("The number of workers must be greater than zero");
+                    Run.workers = $3;
+                  }
+                ;
+
+sethistory      : SET HISTORY {
+                    Run.history_bytes = HISTORY_SIZE;
+                  }
+                | SET HISTORY SIZE NUMBER unit {
+                    Run.history_bytes = (unsigned long long)$4 * $<number>5;
+                    if (! Run.history_bytes)
+                      yyerror2("The history size must be greater than zero");
+                  }
+                ;
+
+setchecksum     : SET CHECKSUM CACHE checksumrehash {
+                    Run.checksumcache = TRUE;
+                  }
+                ;
+
+checksumrehash  : /* EMPTY */ {
+                    Run.checksumrehash = 0;
+                  }
+                | REHASH EVERY NUMBER CYCLE {
+                    if ($3 < 1)
+                      yyerror2("The rehash interval must be greater than zero");
+                    Run.checksumrehash = $3;
+                  }
+                ;
+
 setinit         : SET INIT {
                     Run.init = TRUE;
                   }
@@ -537,16 +582,31 @@ setlog          : SET LOGFILE PATH   {
                   }
                 ;
 
-seteventqueue   : SET EVENTQUEUE BASEDIR PATH {
-                    Run.eventlist_dir = $4;
+seteventqueue   : SET EVENTQUEUE eventqueueoptlist {
+                    if (! Run.eventlist_dir)
+                      Run.eventlist_dir = xstrdup(MYEVENTLISTBASE);
+                  }
+                ;
+
+eventqueueoptlist : eventqueueopt
+                | eventqueueoptlist eventqueueopt
+                ;
+
+eventqueueopt   : BASEDIR PATH {
+                    FREE(Run.eventlist_dir);
+                    Run.eventlist_dir = $2;
                   }
-                | SET EVENTQUEUE BASEDIR PATH SLOT NUMBER {
-                    Run.eventlist_dir = $4;
-                    Run.eventlist_slots = $6;
+                | SLOT NUMBER {
+                    Run.eventlist_slots = $2;
                   }
-                | SET EVENTQUEUE SLOT NUMBER {
-                    Run.eventlist_dir = xstrdup(MYEVENTLISTBASE);
-                    Run.eventlist_slots = $4;
+                | SIZE NUMBER unit {
+                    Run.eventlist_bytes = (unsigned long long)$2 * $<number>3;
+                  }
+                | DROP OLDEST {
+                    Run.eventlist_policy = QUEUE_DROP_OLDEST;
+                  }
+                | DROP SUCCEEDED {
+                    Run.eventlist_policy = QUEUE_DROP_SUCCEEDED;
                   }
                 ;
 
@@ -575,12 +635,31 @@ mmonitlist      : mmonit credentials
                 | mmonitlist mmonit credentials
                 ;
 
-mmonit          : URLOBJECT nettimeout sslversion certmd5 {
+mmonit          : URLOBJECT nettimeout sslversion certmd5 mmonitoptlist {
                     check_hostname(($<url>1)->hostname);
                     addmmonit($<url>1, $<number>2, $<number>3, $<string>4); 
                   }
                 ;
 
+mmonitoptlist   : /* EMPTY */
+                | mmonitoptlist mmonitopt
+                ;
+
+mmonitopt       : KEEPALIVE {
+                    mmonitset.keepalive = TRUE;
+                  }
+                | COMPRESS {
+#ifdef HAVE_LIBZ
+                    mmonitset.compress = TRUE;
+#else
+                    yyerror("compress option cannot be used. zlib is not supported");
+#endif
+                  }
+                | DELTA {
+                    mmonitset.delta = TRUE;
+                  }
+                ;
+
 credentials     : /* EMPTY */
                 | REGISTER CREDENTIALS {
                     Run.dommonitcredentials = FALSE;
@@ -1293,6 +1372,14 @@ every           : EVERY NUMBER CYCLE {
                  }
                 ;
 
+watch           : WATCH {
+                    current->watch = WATCH_CHANGES;
+                  }
+                | WATCH IMMEDIATELY {
+                    current->watch = WATCH_IMMEDIATE;
+                  }
+                ;
+
 mode            : MODE ACTIVE  {
                     current->mode = MODE_ACTIVE;
                   }
@@ -1555,6 +1642,14 @@ checksum        : IF FAILED hashtype CHECKSUM rate1 THEN action1 recovery {
 hashtype        : /* EMPTY */ { checksumset.type = HASH_UNKNOWN; }
                 | MD5HASH     { checksumset.type = HASH_MD5; }
                 | SHA1HASH    { checksumset.type = HASH_SHA1; }
+                | SHA256HASH  {
+#ifdef HAVE_OPENSSL
+                    checksumset.type = HASH_SHA256;
+#else
+                    yyerror("SHA256 checksum requires monit compiled with SSL support");
+#endif
+                  }
+                | XXH64HASH   { checksumset.type = HASH_XXH64; }
                 ;
 
 inode           : IF INODE operator NUMBER rate1 THEN action1 recovery {
@@ -1646,6 +1741,21 @@ matchflagnot    : /* EMPTY */ {
                   }
                 ;
 
+matchlimit      : MATCH LIMIT NUMBER unit matchskip {
+                    addmatchlimit((unsigned long long)$3 * $<number>4, 0, $<number>5);
+                  }
+                | MATCH LIMIT NUMBER unit NUMBER LINE matchskip {
+                    addmatchlimit((unsigned long long)$3 * $<number>4, $5, $<number>7);
+                  }
+                | MATCH LIMIT NUMBER LINE matchskip {
+                    addmatchlimit(0, $3, $<number>5);
+                  }
+                ;
+
+matchskip       : /* EMPTY */ { $<number>$ = FALSE; }
+                | SKIPTOTAIL  { $<number>$ = TRUE; }
+                ;
+
 
 size            : IF SIZE operator NUMBER unit rate1 THEN action1 recovery {
                     sizeset.operator = $<number>3;
@@ -1797,6 +1907,7 @@ int parse(char *controlfile) {
   ASSERT(controlfile);
 
   servicelist = tail = current = NULL;
+  Util_resetServiceIndex();
 
   /*
    * Secure check the monitrc file. The run control file must have the
@@ -1890,8 +2001,14 @@ static void preparse() {
   Run.eventlist           = NULL;
   Run.eventlist_dir       = NULL;
   Run.eventlist_slots     = -1;
+  Run.eventlist_bytes     = 0;
+  Run.eventlist_policy    = QUEUE_DROP_NONE;
   Run.system              = NULL;
   Run.expectbuffer        = STRLEN;
+  Run.workers             = 1;
+  Run.checksumcache       = FALSE;
+  Run.checksumrehash      = 0;
+  Run.history_bytes       = 0;
   Run.mmonits             = NULL;
   Run.maillist            = NULL;
   Run.mailservers         = NULL;
@@ -1915,6 +2032,7 @@ static void preparse() {
   reset_sizeset();
   reset_mailset();
   reset_mailserverset();
+  reset_mmonitset();
   reset_portset();
   reset_permset();
   reset_icmpset();
@@ -1953,6 +2071,9 @@ static void postparse() {
     /* Set the general system service shortcut */
     if (s->type == TYPE_SYSTEM)
       Run.system = s;
+    /* Compile the content match rules into one matcher */
+    if (s->matchlist && s->type != TYPE_PROCESS)
+      s->matcher = Matcher_new(s->matchlist);
     if (s->type != TYPE_HOST)
 	continue;
     /* Verify that a remote service has a port or an icmp list */
@@ -2040,6 +2161,8 @@ static void addservice(Service_T s) {
  
   NEW(n);
   memcpy(n, s, sizeof(*s));
+  pthread_mutex_init(&n->mutex, NULL);
+  Util_indexService(n);
   /* Add the service to the end of the service list */
   if (tail != NULL) {
     tail->next = n;
@@ -2321,12 +2444,19 @@ static void addchecksum(Checksum_T cs) {
       cs->type = HASH_MD5;
     } else if (len == 40) {
       cs->type = HASH_SHA1;
+#ifdef HAVE_OPENSSL
+    } else if (len == 64) {
+      cs->type = HASH_SHA256;
+#endif
+    } else if (len == 16) {
+      cs->type = HASH_XXH64;
     } else {
       yyerror2("invalid checksum [%s] for file %s", cs->hash, current->path);
       reset_checksumset();
       return;
     }
-  } else if (( cs->type == HASH_MD5 && len!=32 ) || ( cs->type == HASH_SHA1 && len != 40 )) {
+  } else if (( cs->type == HASH_MD5 && len!=32 ) || ( cs->type == HASH_SHA1 && len != 40 ) ||
+             ( cs->type == HASH_SHA256 && len != 64 ) || ( cs->type == HASH_XXH64 && len != 16 )) {
     yyerror2("invalid checksum [%s] for file %s", cs->hash, current->path);
     reset_checksumset();
     return;
@@ -2412,6 +2542,25 @@ static void addmatch(Match_T ms, int actionnumber, int linenumber) {
 }
 
 
+/*
+ * Set the content match limit per cycle in the current service
+ */
+static void addmatchlimit(unsigned long long bytes, unsigned long lines, int skip) {
+
+  if (! bytes && ! lines)
+    yyerror2("The match limit must be greater than zero");
+
+  if (current->matchlimit)
+    yyerror2("The match limit is already defined");
+  else
+    NEW(current->matchlimit);
+
+  current->matchlimit->bytes = bytes;
+  current->matchlimit->lines = lines;
+  current->matchlimit->skip  = skip;
+}
+
+
 static void addmatchpath(Match_T ms, int actionnumber) {
 
   FILE *handle;
@@ -2536,6 +2685,7 @@ static void addicmp(Icmp_T is) {
   icmp->action       = is->action;
   icmp->is_available = FALSE;
   icmp->response     = -1;
+  icmp->loss         = -1;
   
   icmp->next         = current->icmplist;
   current->icmplist  = icmp;
@@ -2805,6 +2955,9 @@ static void addmmonit(URL_T url, int timeout, int sslversion, char *certmd5) {
     }
   }
   c->timeout = timeout;
+  c->keepalive = mmonitset.keepalive;
+  c->compress = mmonitset.compress;
+  c->delta = mmonitset.delta;
   c->next = NULL;
 
   if (Run.mmonits) {
@@ -2815,6 +2968,7 @@ static void addmmonit(URL_T url, int timeout, int sslversion, char *certmd5) {
   } else {
     Run.mmonits = c;
   }
+  reset_mmonitset();
 }
 
 
@@ -3180,6 +3334,14 @@ static void reset_mailserverset() {
 }
 
 
+/*
+ * Reset the mmonit set to default values
+ */
+static void reset_mmonitset() {
+  memset(&mmonitset, 0, sizeof(struct mymmonit));
+}
+
+
 /*
  * Reset the Port set to default values
  */
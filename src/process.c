@@ -68,6 +68,32 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+/* Pid keyed open addressing index over a process tree array. The index
+ * is bound to the tree it was built for, so findprocess() can use it
+ * transparently and fall back to a linear scan for any other tree */
+typedef struct myprocessindex {
+  ProcessTree_T *tree;                     /**< The indexed process tree */
+  int            count;                      /**< Number of indexed entries */
+  int            mask;            /**< Number of slots - 1 (power of two) */
+  int           *slot;           /**< Tree entry index or -1 if slot empty */
+} ProcessIndex_T;
+
+static ProcessIndex_T ptindex;                /**< Index of the actual tree */
+static ProcessIndex_T oldptindex;           /**< Index of the previous tree */
+
+
+/* -------------------------------------------------------------- Prototypes */
+
+
+static void index_build(ProcessIndex_T *, ProcessTree_T *, int);
+static void index_insert(ProcessIndex_T *, ProcessTree_T *, int);
+static int  index_find(ProcessIndex_T *, int);
+static void index_free(ProcessIndex_T *);
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -211,6 +237,10 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
       delprocesstree(oldpt_r, oldsize_r);
     *oldpt_r   = *pt_r; 
     *oldsize_r = *size_r; 
+    /* The actual tree becomes the previous one - hand its index over too */
+    index_free(&oldptindex);
+    oldptindex = ptindex;
+    memset(&ptindex, 0, sizeof(ProcessIndex_T));
   }
   
   if ((*size_r = initprocesstree_sysdep(pt_r)) <= 0) {
@@ -228,6 +258,8 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
   if (pt == NULL)
     return 0;
 
+  index_build(&ptindex, pt, *size_r);
+
   for (i = 0; i < (volatile int)*size_r; i ++) {
     if (oldpt && ((oldentry = findprocess(pt[i].pid, oldpt, *oldsize_r)) != -1)) {
       pt[i].cputime_prev = oldpt[oldentry].cputime;
@@ -259,6 +291,7 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
       memset(&pt[j], 0, sizeof(ProcessTree_T));
       pt[j].ppid = pt[j].pid  = pt[i].ppid;
       pt[i].parent = j;
+      index_insert(&ptindex, pt, j);
     }
     
     if (! connectchild(pt, pt[i].parent, i)) {
@@ -290,7 +323,9 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
 
 
 /**
- * Search a leaf in the processtree
+ * Search a leaf in the processtree. The lookup is done via the pid index
+ * if the tree is the actual or previous one built by initprocesstree(),
+ * otherwise the tree is scanned linearly.
  * @param pid  pid of the process
  * @param pt  processtree
  * @param treesize  size of the processtree
@@ -304,6 +339,11 @@ int findprocess(int pid, ProcessTree_T *pt, int size) {
   if (size <= 0)
     return -1;
 
+  if (pt == ptindex.tree)
+    return ((i = index_find(&ptindex, pid)) < size) ? i : -1;
+  if (pt == oldptindex.tree)
+    return ((i = index_find(&oldptindex, pid)) < size) ? i : -1;
+
   for (i = 0; i < size; i++)
     if (pid == pt[i].pid)
       return i;
@@ -320,6 +360,10 @@ void delprocesstree(ProcessTree_T **reference, int *size) {
 
   if (pt == NULL || size <= 0)
       return;
+  if (pt == ptindex.tree)
+    index_free(&ptindex);
+  else if (pt == oldptindex.tree)
+    index_free(&oldptindex);
   for (i = 0; i < *size; i++) {
     FREE(pt[i].cmdline);
     FREE(pt[i].children);
@@ -375,3 +419,92 @@ void process_testmatch(char *pattern) {
 }
 
 
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Hash the pid to the index slot
+ */
+#define INDEX_SLOT(index, pid) ((int)(((unsigned)(pid) * 2654435761U) & (unsigned)(index)->mask))
+
+
+/**
+ * (Re)build the pid index for the given process tree. The table is sized
+ * to at least twice the number of entries so the probe chains stay short.
+ * @param index The index to build
+ * @param pt The process tree
+ * @param size The process tree size
+ */
+static void index_build(ProcessIndex_T *index, ProcessTree_T *pt, int size) {
+  int i;
+  int slots = 64;
+
+  ASSERT(index);
+
+  while (slots < size * 2)
+    slots <<= 1;
+  FREE(index->slot);
+  index->slot  = xmalloc(slots * sizeof(int));
+  memset(index->slot, 0xff, slots * sizeof(int));
+  index->mask  = slots - 1;
+  index->count = 0;
+  index->tree  = pt;
+  for (i = 0; i < size; i++)
+    index_insert(index, pt, i);
+}
+
+
+/**
+ * Add the process tree entry to the pid index. The first entry with given
+ * pid wins, to keep the same semantic as the linear findprocess() scan.
+ * The tree may have been reallocated by the caller, so the index is rebound
+ * to it and rebuilt with more slots if the load factor would exceed 1/2.
+ * @param index The pid index
+ * @param pt The process tree
+ * @param entry The tree entry index
+ */
+static void index_insert(ProcessIndex_T *index, ProcessTree_T *pt, int entry) {
+  int i;
+
+  ASSERT(index);
+
+  index->tree = pt;
+  if ((index->count + 1) * 2 > index->mask + 1) {
+    index_build(index, pt, entry + 1);
+    return;
+  }
+  for (i = INDEX_SLOT(index, pt[entry].pid); index->slot[i] != -1; i = (i + 1) & index->mask)
+    if (pt[index->slot[i]].pid == pt[entry].pid)
+      return;
+  index->slot[i] = entry;
+  index->count++;
+}
+
+
+/**
+ * Find the tree entry for the given pid. Entries whose pid was reset after
+ * they were indexed are skipped.
+ * @param index The pid index
+ * @param pid The process id
+ * @return The tree entry index or -1 if not found
+ */
+static int index_find(ProcessIndex_T *index, int pid) {
+  int i;
+
+  if (! index->slot)
+    return -1;
+  for (i = INDEX_SLOT(index, pid); index->slot[i] != -1; i = (i + 1) & index->mask)
+    if (index->tree[index->slot[i]].pid == pid)
+      return index->slot[i];
+  return -1;
+}
+
+
+/**
+ * Release the pid index
+ * @param index The pid index
+ */
+static void index_free(ProcessIndex_T *index) {
+  FREE(index->slot);
+  memset(index, 0, sizeof(ProcessIndex_T));
+}
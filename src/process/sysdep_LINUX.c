@@ -75,8 +75,12 @@
 #include <asm/param.h>
 #endif
 
-#ifdef HAVE_GLOB_H
-#include <glob.h>
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#ifdef HAVE_CTYPE_H
+#include <ctype.h>
 #endif
 
 #ifndef HZ
@@ -103,29 +107,242 @@
 /* ----------------------------------------------------------------- Private */
 
 
-#define MEMTOTAL  "MemTotal:"
-#define MEMFREE   "MemFree:"
-#define MEMBUF    "Buffers:"
-#define MEMCACHE  "Cached:"
-#define SWAPTOTAL "SwapTotal:"
-#define SWAPFREE  "SwapFree:"
+#define MEMTOTAL  0x01
+#define MEMFREE   0x02
+#define MEMBUF    0x04
+#define MEMCACHE  0x08
+#define SWAPTOTAL 0x10
+#define SWAPFREE  0x20
+#define MEMALL    (MEMTOTAL | MEMFREE | MEMBUF | MEMCACHE | SWAPTOTAL | SWAPFREE)
 
 #define NSEC_PER_SEC    1000000000L
 
+/* Fields of /proc/<pid>/stat used for the process tree */
+typedef struct myprocstat {
+  char               name[STRLEN];                          /**< Process name */
+  char               state;                                 /**< Process state */
+  int                ppid;                             /**< Parent process id */
+  unsigned long      utime;                        /**< User time in jiffies */
+  unsigned long      stime;                      /**< System time in jiffies */
+  long               cutime;                /**< Waited-for children user time */
+  long               cstime;              /**< Waited-for children system time */
+  unsigned long long starttime;       /**< Start time in jiffies since boot */
+  long               rss;                    /**< Resident set size in pages */
+} ProcStat_T;
+
+/* Fields of /proc/meminfo used for the system statistic, in kB */
+typedef struct mymeminfo {
+  int           found;                   /**< Bitmap of the fields found */
+  unsigned long mem_total;
+  unsigned long mem_free;
+  unsigned long buffers;
+  unsigned long cached;
+  unsigned long swap_total;
+  unsigned long swap_free;
+} MemInfo_T;
+
+/* Initial number of the process cache hash buckets (power of two) */
+#define PROCESS_CACHE_BUCKETS 1024
+/* Length of the process name stored in the process cache */
+#define PROCESS_NAME_LENGTH   32
+
+/* Persistent per-process record which survives the process tree rebuild.
+ * The record identity is the pid with the process start time and name, so
+ * a recycled pid or an exec() of a new program invalidates the record */
+typedef struct myprocesscache {
+  int                    pid;                               /**< Process id */
+  unsigned long long     starttime;   /**< Start time in jiffies since boot */
+  char                   name[PROCESS_NAME_LENGTH];         /**< Process name */
+  char                  *cmdline;                /**< The cached command line */
+  unsigned int           cycle;           /**< Last scan the pid was seen in */
+
+  /** For internal use */
+  struct myprocesscache *next;                  /**< next record in bucket */
+} *ProcessCache_T;
+
+static ProcessCache_T    *process_cache         = NULL;
+static int                process_cache_buckets = 0;
+static int                process_cache_count   = 0;
+static unsigned int       process_cache_cycle   = 0;
+
 static unsigned long long old_cpu_user     = 0;
 static unsigned long long old_cpu_syst     = 0;
 static unsigned long long old_cpu_wait     = 0;
 static unsigned long long old_cpu_total    = 0;
 static int                page_shift_to_kb = 0;
+static time_t             boot_time        = 0;
+
+
+/**
+ * Parse the decimal number at the given position, leading blanks are skipped
+ * @param p The parse position
+ * @param value The number
+ * @return The position after the number or NULL if there is no number
+ */
+static const char *parse_number(const char *p, long long *value) {
+  int       negative = FALSE;
+  long long v = 0;
+
+  while (*p == ' ' || *p == '\t')
+    p++;
+  if (*p == '-') {
+    negative = TRUE;
+    p++;
+  }
+  if (*p < '0' || *p > '9')
+    return NULL;
+  while (*p >= '0' && *p <= '9')
+    v = v * 10 + (*p++ - '0');
+  *value = negative ? -v : v;
+  return p;
+}
+
+
+/**
+ * Parse the /proc/<pid>/stat content in a single pass. Only the fields used
+ * for the process tree are extracted, see fs/proc/array.c for the format.
+ * @param buf The /proc/<pid>/stat content
+ * @param ps The parsed fields
+ * @return TRUE if succeeded otherwise FALSE
+ */
+static int parse_proc_pid_stat(const char *buf, ProcStat_T *ps) {
+  int         field;
+  long long   value;
+  const char *p, *end;
+  char       *name = ps->name;
+
+  /* The process name may contain any character, it is enclosed by the first '(' and the last ')' */
+  if (! (p = strchr(buf, '(')) || ! (end = strrchr(p, ')')))
+    return FALSE;
+  for (p++; p < end && *p != ' ' && *p != '\t' && *p != '\n' && name < ps->name + sizeof(ps->name) - 1; p++)
+    *name++ = *p;
+  *name = 0;
+  if (! *ps->name)
+    return FALSE;
+
+  p = end + 1;
+  for (field = 3; field <= 24; field++) {
+    while (*p == ' ')
+      p++;
+    if (! *p)
+      return FALSE;
+    switch (field) {
+      case 3:
+        ps->state = *p;
+        break;
+      case 4: case 14: case 15: case 16: case 17: case 22: case 24:
+        if (! parse_number(p, &value))
+          return FALSE;
+        if (field == 4)
+          ps->ppid = (int)value;
+        else if (field == 14)
+          ps->utime = (unsigned long)value;
+        else if (field == 15)
+          ps->stime = (unsigned long)value;
+        else if (field == 16)
+          ps->cutime = (long)value;
+        else if (field == 17)
+          ps->cstime = (long)value;
+        else if (field == 22)
+          ps->starttime = (unsigned long long)value;
+        else
+          ps->rss = (long)value;
+        break;
+    }
+    while (*p && *p != ' ')
+      p++;
+  }
+  return TRUE;
+}
 
 
 /**
- * Get system start time
+ * Parse the /proc/meminfo content in a single pass. The field is matched
+ * at the line start only, so for example "SwapCached:" is not confused with
+ * "Cached:". The parsing stops as soon as all fields are found, they are
+ * at the top of the file.
+ * @param buf The /proc/meminfo content
+ * @param mi The parsed fields, mi->found is the bitmap of fields found
+ */
+static void parse_meminfo(const char *buf, MemInfo_T *mi) {
+  long long   value;
+  const char *p = buf;
+
+  memset(mi, 0, sizeof(MemInfo_T));
+  while (*p && mi->found != MEMALL) {
+    int            flag = 0;
+    unsigned long *field = NULL;
+    const char    *q;
+
+    if (! strncmp(p, "MemTotal:", 9)) {
+      flag = MEMTOTAL; field = &mi->mem_total; p += 9;
+    } else if (! strncmp(p, "MemFree:", 8)) {
+      flag = MEMFREE; field = &mi->mem_free; p += 8;
+    } else if (! strncmp(p, "Buffers:", 8)) {
+      flag = MEMBUF; field = &mi->buffers; p += 8;
+    } else if (! strncmp(p, "Cached:", 7)) {
+      flag = MEMCACHE; field = &mi->cached; p += 7;
+    } else if (! strncmp(p, "SwapTotal:", 10)) {
+      flag = SWAPTOTAL; field = &mi->swap_total; p += 10;
+    } else if (! strncmp(p, "SwapFree:", 9)) {
+      flag = SWAPFREE; field = &mi->swap_free; p += 9;
+    }
+    if (field && (q = parse_number(p, &value))) {
+      *field = (unsigned long)value;
+      mi->found |= flag;
+      p = q;
+    }
+    if (! (p = strchr(p, '\n')))
+      break;
+    p++;
+  }
+}
+
+
+/**
+ * Parse the aggregate cpu line of the /proc/stat content
+ * @param buf The /proc/stat content
+ * @param value Array for the cpu times
+ * @param count Maximum number of cpu times to parse
+ * @return The number of cpu times parsed
+ */
+static int parse_stat_cpu(const char *buf, unsigned long long *value, int count) {
+  int         i;
+  long long   v;
+  const char *p = buf;
+
+  if (strncmp(p, "cpu ", 4))
+    return 0;
+  for (i = 0, p += 4; i < count && (p = parse_number(p, &v)); i++)
+    value[i] = (unsigned long long)v;
+  return i;
+}
+
+
+/**
+ * Get system start time. The boot time is read from the btime entry in
+ * /proc/stat, if it is not available it is computed from /proc/uptime.
  * @return seconds since unix epoch
  */
 static time_t get_starttime() {
-  char   buf[1024];
-  double up = 0;
+  FILE          *f;
+  char           buf[1024];
+  double         up = 0;
+  unsigned long  btime = 0;
+
+  /* The intr line in /proc/stat can be very long, read it by lines and look for btime at the line start only */
+  if ((f = fopen("/proc/stat", "r"))) {
+    int linestart = TRUE;
+    while (fgets(buf, sizeof(buf), f)) {
+      if (linestart && ! strncmp(buf, "btime ", 6) && sscanf(buf + 6, "%lu", &btime) == 1)
+        break;
+      linestart = strchr(buf, '\n') ? TRUE : FALSE;
+    }
+    fclose(f);
+    if (btime)
+      return (time_t)btime;
+  }
+  DEBUG("system statistic error -- cannot get boot time from /proc/stat, using /proc/uptime\n");
 
   if (! read_proc_file(buf, 1024, "uptime", -1, NULL)) {
     LogError("system statistic error -- cannot get system uptime\n");
@@ -139,27 +356,124 @@ static time_t get_starttime() {
 
   return time(NULL) - (time_t)up;
 }
-  
+
+
+/**
+ * Grow the process cache hash table so the average chain length stays
+ * at most one
+ */
+static void process_cache_grow() {
+  int             i;
+  int             buckets = process_cache_buckets ? process_cache_buckets * 2 : PROCESS_CACHE_BUCKETS;
+  ProcessCache_T *table = xcalloc(sizeof(ProcessCache_T), buckets);
+
+  for (i = 0; i < process_cache_buckets; i++) {
+    ProcessCache_T c, next;
+    for (c = process_cache[i]; c; c = next) {
+      next = c->next;
+      c->next = table[c->pid & (buckets - 1)];
+      table[c->pid & (buckets - 1)] = c;
+    }
+  }
+  FREE(process_cache);
+  process_cache         = table;
+  process_cache_buckets = buckets;
+}
+
+
+/**
+ * Get the cached command line of the process. The cache record is valid
+ * only if the process start time and name didn't change, otherwise the pid
+ * was recycled or the process executed a new program and the command line
+ * is read again from /proc/<pid>/cmdline.
+ * @param pid The process id
+ * @param starttime The process start time in jiffies since boot
+ * @param name The process name from /proc/<pid>/stat
+ * @param refresh TRUE to bypass the cached command line
+ * @return The command line or NULL if it cannot be read
+ */
+static const char *process_cache_cmdline(int pid, unsigned long long starttime, const char *name, int refresh) {
+  int            j, bytes = 0;
+  char           buf[1024];
+  ProcessCache_T c;
+
+  if (process_cache_count >= process_cache_buckets)
+    process_cache_grow();
+
+  for (c = process_cache[pid & (process_cache_buckets - 1)]; c; c = c->next)
+    if (c->pid == pid)
+      break;
+
+  if (c && ! refresh && c->starttime == starttime && ! strncmp(c->name, name, PROCESS_NAME_LENGTH - 1)) {
+    c->cycle = process_cache_cycle;
+    return c->cmdline;
+  }
+
+  if (! read_proc_file(buf, sizeof(buf), "cmdline", pid, &bytes)) {
+    DEBUG("system statistic error -- cannot read /proc/%d/cmdline\n", pid);
+    return NULL;
+  }
+  /* The cmdline file contains argv elements/strings terminated separated by '\0' => join the string: */
+  for (j = 0; j < (bytes - 1); j++)
+    if (buf[j] == 0)
+      buf[j] = ' ';
+
+  if (! c) {
+    NEW(c);
+    c->pid  = pid;
+    c->next = process_cache[pid & (process_cache_buckets - 1)];
+    process_cache[pid & (process_cache_buckets - 1)] = c;
+    process_cache_count++;
+  } else
+    FREE(c->cmdline);
+  c->starttime = starttime;
+  snprintf(c->name, sizeof(c->name), "%.*s", PROCESS_NAME_LENGTH - 1, name);
+  c->cmdline   = xstrdup(*buf ? buf : name);
+  c->cycle     = process_cache_cycle;
+  return c->cmdline;
+}
+
+
+/**
+ * Remove the records of processes which were not found in the last /proc
+ * scan from the process cache
+ */
+static void process_cache_prune() {
+  int i;
+
+  for (i = 0; i < process_cache_buckets; i++) {
+    ProcessCache_T *c = &process_cache[i];
+    while (*c) {
+      if ((*c)->cycle != process_cache_cycle) {
+        ProcessCache_T dead = *c;
+        *c = dead->next;
+        FREE(dead->cmdline);
+        FREE(dead);
+        process_cache_count--;
+      } else
+        c = &(*c)->next;
+    }
+  }
+}
+
 
 /* ------------------------------------------------------------------ Public */
 
 
 int init_process_info_sysdep(void) {
-  char *ptr;
-  char  buf[1024];
-  long  page_size;
-  int   page_shift;  
+  char      buf[1024];
+  long      page_size;
+  int       page_shift;  
+  MemInfo_T mi;
 
   if (! read_proc_file(buf, sizeof(buf), "meminfo", -1, NULL)) 
     return FALSE;
-  if (! (ptr = strstr(buf, MEMTOTAL))) {
-    DEBUG("system statistic error -- cannot get real memory amount\n");
-    return FALSE;
-  }
-  if (sscanf(ptr+strlen(MEMTOTAL), "%ld", &systeminfo.mem_kbyte_max) != 1) {
+  parse_meminfo(buf, &mi);
+  if (! (mi.found & MEMTOTAL)) {
     DEBUG("system statistic error -- cannot get real memory amount\n");
     return FALSE;
   }
+  systeminfo.mem_kbyte_max = mi.mem_total;
 
   if ((systeminfo.cpus = sysconf(_SC_NPROCESSORS_CONF)) < 0) {
     DEBUG("system statistic error -- cannot get cpu count: %s\n", STRERROR);
@@ -177,6 +491,9 @@ int init_process_info_sysdep(void) {
   for (page_shift = 0; page_size != 1; page_size >>= 1, page_shift++);
   page_shift_to_kb = page_shift - 10;
 
+  /* The boot time doesn't change, process start time is derived from it */
+  boot_time = get_starttime();
+
   return TRUE;
 }
 
@@ -184,44 +501,47 @@ int init_process_info_sysdep(void) {
 /**
  * Read all processes of the proc files system to initialize
  * the process tree (sysdep version... but should work for
- * all procfs based unices) 
+ * all procfs based unices). The /proc/<pid>/stat is read for
+ * every process, the command line is read only for processes
+ * which are not known from the previous scan.
  * @param reference  reference of ProcessTree
  * @return treesize>0 if succeeded otherwise =0.
  */
 int initprocesstree_sysdep(ProcessTree_T ** reference) {
-  int                 i = 0, j;
-  int                 rv, bytes = 0;
+  int                 i = 0;
   int                 treesize = 0;
-  int                 stat_ppid = 0;
-  char               *tmp = NULL;
-  char                procname[STRLEN];
+  int                 treemax = 0;
+  const char         *cmdline = NULL;
   char                buf[1024];
-  char                stat_item_state;
-  long                stat_item_cutime = 0;
-  long                stat_item_cstime = 0;
-  long                stat_item_rss = 0;
-  glob_t              globbuf;
-  unsigned long       stat_item_utime = 0;
-  unsigned long       stat_item_stime = 0;
-  unsigned long long  stat_item_starttime = 0ULL;
+  DIR                *dir = NULL;
+  struct dirent      *de = NULL;
+  ProcStat_T          ps;
   ProcessTree_T      *pt = NULL;
 
   ASSERT(reference);
 
   /* Find all processes in the /proc directory */
-  if ((rv = glob("/proc/[0-9]*", GLOB_ONLYDIR, NULL, &globbuf))) {
-    LogError("system statistic error -- glob failed: %d (%s)\n", rv, STRERROR);
+  if (! (dir = opendir("/proc"))) {
+    LogError("system statistic error -- cannot open /proc: %s\n", STRERROR);
     return FALSE;
-  } 
-
-  treesize = globbuf.gl_pathc;
+  }
 
-  pt = xcalloc(sizeof(ProcessTree_T), treesize);
+  process_cache_cycle++;
 
   /* Insert data from /proc directory */
-  for (i = 0; i < treesize; i++) {
+  while ((de = readdir(dir))) {
 
-    pt[i].pid = atoi(globbuf.gl_pathv[i] + strlen("/proc/"));
+    if (! isdigit((int)*de->d_name))
+      continue;
+
+    if (treesize == treemax) {
+      treemax = treemax ? treemax * 2 : 256;
+      pt = xresize(pt, treemax * sizeof(ProcessTree_T));
+    }
+    i = treesize++;
+    memset(&pt[i], 0, sizeof(ProcessTree_T));
+
+    pt[i].pid = atoi(de->d_name);
     
     if (!read_proc_file(buf, sizeof(buf), "stat", pt[i].pid, NULL)) {
       DEBUG("system statistic error -- cannot read /proc/%d/stat\n", pt[i].pid);
@@ -230,68 +550,39 @@ int initprocesstree_sysdep(ProcessTree_T ** reference) {
 
     pt[i].time = get_float_time();
 
-    if (!(tmp = strrchr(buf, ')'))) {
-      DEBUG("system statistic error -- file /proc/%d/stat parse error\n", pt[i].pid);
-      continue;
-    }
-    *tmp = 0;
-    if (sscanf(buf, "%*d (%256s", procname) != 1) {
-      DEBUG("system statistic error -- file /proc/%d/stat process name parse error\n", pt[i].pid);
-      continue;
-    }
-
-    tmp += 2;
-
-    /* This implementation is done by using fs/procfs/array.c as a basis
-     * it is also worth looking into the source of the procps utils */
-    if (sscanf(tmp,
-         "%c %d %*d %*d %*d %*d %*u %*u"
-         "%*u %*u %*u %lu %lu %ld %ld %*d %*d %*d "
-         "%*u %llu %*u %ld %*u %*u %*u %*u %*u "
-         "%*u %*u %*u %*u %*u %*u %*u %*u %*d %*d\n",
-         &stat_item_state,
-         &stat_ppid,
-         &stat_item_utime,
-         &stat_item_stime,
-         &stat_item_cutime,
-         &stat_item_cstime,
-         &stat_item_starttime,
-         &stat_item_rss) != 8) {
+    if (! parse_proc_pid_stat(buf, &ps)) {
       DEBUG("system statistic error -- file /proc/%d/stat parse error\n", pt[i].pid);
       continue;
     }
     
-    pt[i].ppid      = stat_ppid;
-    pt[i].starttime = get_starttime() + (time_t)(stat_item_starttime / HZ);
+    pt[i].ppid      = ps.ppid;
+    pt[i].starttime = boot_time + (time_t)(ps.starttime / HZ);
   
     /* jiffies -> seconds = 1 / HZ
      * HZ is defined in "asm/param.h"  and it is usually 1/100s but on
      * alpha system it is 1/1024s */
-    pt[i].cputime     = ((float)(stat_item_utime + stat_item_stime) * 10.0) / HZ;
+    pt[i].cputime     = ((float)(ps.utime + ps.stime) * 10.0) / HZ;
     pt[i].cpu_percent = 0;
 
     /* State is Zombie -> then we are a Zombie ... clear or? (-: */
-    if (stat_item_state == 'Z')
+    if (ps.state == 'Z')
       pt[i].status_flag |= PROCESS_ZOMBIE;
 
     if (page_shift_to_kb < 0)
-      pt[i].mem_kbyte = (stat_item_rss >> abs(page_shift_to_kb));
+      pt[i].mem_kbyte = (ps.rss >> abs(page_shift_to_kb));
     else
-      pt[i].mem_kbyte = (stat_item_rss << abs(page_shift_to_kb));
+      pt[i].mem_kbyte = (ps.rss << abs(page_shift_to_kb));
 
-    if (! read_proc_file(buf, sizeof(buf), "cmdline", pt[i].pid, &bytes)) {
-      DEBUG("system statistic error -- cannot read /proc/%d/cmdline\n", pt[i].pid);
+    /* Zombie has no command line anymore, don't use the cached one */
+    if (! (cmdline = process_cache_cmdline(pt[i].pid, ps.starttime, ps.name, ps.state == 'Z')))
       continue;
-    }
-    /* The cmdline file contains argv elements/strings terminated separated by '\0' => join the string: */
-    for (j = 0; j < (bytes - 1); j++)
-      if (buf[j] == 0)
-        buf[j] = ' ';
-    pt[i].cmdline = *buf ? xstrdup(buf) : xstrdup(procname);
+    pt[i].cmdline = xstrdup(cmdline);
   }
   
+  closedir(dir);
+  process_cache_prune();
+
   *reference = pt;
-  globfree(&globbuf);
 
   return treesize;
 }
@@ -314,41 +605,37 @@ int getloadavg_sysdep (double *loadv, int nelem) {
  * @return: TRUE if successful, FALSE if failed
  */
 int used_system_memory_sysdep(SystemInfo_T *si) {
-  char          *ptr;
-  char           buf[1024];
-  unsigned long  mem_free = 0UL;
-  unsigned long  buffers = 0UL;
-  unsigned long  cached = 0UL;
-  unsigned long  swap_total = 0UL;
-  unsigned long  swap_free = 0UL;
+  char      buf[1024];
+  MemInfo_T mi;
   
   if (! read_proc_file(buf, 1024, "meminfo", -1, NULL)) {
     LogError("system statistic error -- cannot get real memory free amount\n");
     goto error;
   }
+  parse_meminfo(buf, &mi);
 
   /* Memory */
-  if (! (ptr = strstr(buf, MEMFREE)) || sscanf(ptr + strlen(MEMFREE), "%ld", &mem_free) != 1) {
+  if (! (mi.found & MEMFREE)) {
     LogError("system statistic error -- cannot get real memory free amount\n");
     goto error;
   }
-  if (! (ptr = strstr(buf, MEMBUF)) || sscanf(ptr + strlen(MEMBUF), "%ld", &buffers) != 1)
+  if (! (mi.found & MEMBUF))
     DEBUG("system statistic error -- cannot get real memory buffers amount\n");
-  if (! (ptr = strstr(buf, MEMCACHE)) || sscanf(ptr + strlen(MEMCACHE), "%ld", &cached) != 1)
+  if (! (mi.found & MEMCACHE))
     DEBUG("system statistic error -- cannot get real memory cache amount\n");
-  si->total_mem_kbyte = systeminfo.mem_kbyte_max - mem_free - buffers - cached;
+  si->total_mem_kbyte = systeminfo.mem_kbyte_max - mi.mem_free - mi.buffers - mi.cached;
 
   /* Swap */
-  if (! (ptr = strstr(buf, SWAPTOTAL)) || sscanf(ptr + strlen(SWAPTOTAL), "%ld", &swap_total) != 1) {
+  if (! (mi.found & SWAPTOTAL)) {
     LogError("system statistic error -- cannot get swap total amount\n");
     goto error;
   }
-  if (! (ptr = strstr(buf, SWAPFREE)) || sscanf(ptr + strlen(SWAPFREE), "%ld", &swap_free) != 1) {
+  if (! (mi.found & SWAPFREE)) {
     LogError("system statistic error -- cannot get swap free amount\n");
     goto error;
   }
-  si->swap_kbyte_max   = swap_total;
-  si->total_swap_kbyte = swap_total - swap_free;
+  si->swap_kbyte_max   = mi.swap_total;
+  si->total_swap_kbyte = mi.swap_total - mi.swap_free;
 
   return TRUE;
 
@@ -365,6 +652,7 @@ int used_system_memory_sysdep(SystemInfo_T *si) {
  */
 int used_system_cpu_sysdep(SystemInfo_T *si) {
   int                rv;
+  unsigned long long cpu[7] = {0};
   unsigned long long cpu_total;
   unsigned long long cpu_user;
   unsigned long long cpu_nice;
@@ -380,14 +668,14 @@ int used_system_cpu_sysdep(SystemInfo_T *si) {
     goto error;
   }
 
-  rv = sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu",
-         &cpu_user,
-         &cpu_nice,
-         &cpu_syst,
-         &cpu_idle,
-         &cpu_wait,
-         &cpu_irq,
-         &cpu_softirq);
+  rv = parse_stat_cpu(buf, cpu, 7);
+  cpu_user    = cpu[0];
+  cpu_nice    = cpu[1];
+  cpu_syst    = cpu[2];
+  cpu_idle    = cpu[3];
+  cpu_wait    = cpu[4];
+  cpu_irq     = cpu[5];
+  cpu_softirq = cpu[6];
   if (rv < 4) {
     LogError("system statistic error -- cannot read cpu usage\n");
     goto error;
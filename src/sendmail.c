@@ -70,6 +70,15 @@
 /**
  *  Connect to a SMTP server and send mail.
  *
+ *  The SMTP session is kept open after the mail was sent and it is
+ *  reused by the following alerts until sendmail_close() is called at
+ *  the end of the cycle, so an incident with many failed services costs
+ *  one connection and handshake. If the server supports the RFC 2920
+ *  command pipelining, the MAIL, RCPT and DATA commands are sent at
+ *  once and the message content is sent together with the envelope of
+ *  the next message. The session is shared by the validation threads
+ *  and it is used with the sendmail mutex locked.
+ *
  *  @author Jan-Henrik Haukeland, <hauk@tildeslash.com>
  *
  *  @file
@@ -87,169 +96,303 @@ typedef struct {
   const char *username;
   const char *password;
   Ssl_T ssl;
+  int pipelining;
+  Buffer_T buffer;
   char localhost[STRLEN];
 } SendMail_T;
 
+static SendMail_T session;
+static pthread_mutex_t sendmail_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 /* -------------------------------------------------------------- Prototypes */
 
 
+static int  do_reply(SendMail_T *S);
 static void do_status(SendMail_T *S);
 static void open_server(SendMail_T *S);
+static void do_hello(SendMail_T *S);
 static void do_send(SendMail_T *S, const char *, ...);
+static void do_flush(SendMail_T *S);
+static void do_envelope(SendMail_T *S, Mail_T);
+static void do_content(SendMail_T *S, Mail_T, const char *);
+static void close_server(SendMail_T *S);
 
 
 /* ------------------------------------------------------------------ Public */
 
 
 /**
- * Send mail messages via SMTP
+ * Send mail messages via SMTP. The open session is reused, if it was
+ * closed by the server meanwhile, the mail is sent via a new session.
  * @param mail A Mail object
  * @return FALSE if failed, TRUE if succeeded
  */
 int sendmail(Mail_T mail) {
 
-  int i;
-  int rv;
+  int rv = FALSE;
   Mail_T m;
-  SendMail_T S;
-  char *b64 = NULL;
+  SendMail_T *S = &session;
   char now[STRLEN];
   
   ASSERT(mail);
   
-  S.socket = NULL;
-  if(sigsetjmp(S.error, TRUE)) {
-    rv = FALSE;
-    goto exit;
-  } else {
-    rv = TRUE;
-  }
-  
-  open_server(&S);
-  
   Util_getRFC822Date(NULL, now, STRLEN);
   
-  snprintf(S.localhost, sizeof(S.localhost), "%s", Run.mail_hostname ? Run.mail_hostname : Run.localhostname);
-  
-  do_status(&S);
-
-  /* Use EHLO if TLS or Authentication is requested */
-  if((S.ssl.use_ssl && S.ssl.version == SSL_VERSION_TLS) || S.username) {
-    do_send(&S, "EHLO %s\r\n", S.localhost);
-  } else {
-    do_send(&S, "HELO %s\r\n", S.localhost);
-  }
-  do_status(&S);
-
-  /* Switch to TLS now if configured */
-  if(S.ssl.use_ssl && S.ssl.version == SSL_VERSION_TLS) {
-    do_send(&S, "STARTTLS\r\n"); 
-    do_status(&S);
-    if(!socket_switch2ssl(S.socket, S.ssl)) {
+  LOCK(sendmail_mutex)
+  {
+    volatile int reused;
+    volatile int sent = FALSE;
+
+    /* The idle session is readable only if the server closed it */
+    if(S->socket && can_read(socket_get_socket(S->socket), 0))
+      close_server(S);
+    reused = S->socket != NULL;
+
+    retry:
+    if(sigsetjmp(S->error, TRUE)) {
+      close_server(S);
+      /* The reused session might have timed out, try once again unless
+       * some message was delivered already */
+      if(reused && ! sent) {
+        reused = FALSE;
+        DEBUG("Sendmail: the session with the mailserver '%s' was closed, reconnecting\n", S->server);
+        goto retry;
+      }
       rv = FALSE;
-      goto exit;
+    } else {
+      if(! S->socket) {
+        open_server(S);
+        do_hello(S);
+      }
+
+      if(S->pipelining) {
+        do_envelope(S, mail);
+        do_flush(S);
+        do_status(S);
+        do_status(S);
+        do_status(S);
+        for(m= mail; m; m= m->next) {
+          do_content(S, m, now);
+          if(m->next)
+            do_envelope(S, m->next);
+          do_flush(S);
+          do_status(S);
+          sent = TRUE;
+          if(m->next) {
+            do_status(S);
+            do_status(S);
+            do_status(S);
+          }
+        }
+      } else {
+        for(m= mail; m; m= m->next) {
+          do_send(S, "MAIL FROM: <%s>\r\n", m->from);
+          do_flush(S);
+          do_status(S);
+          do_send(S, "RCPT TO: <%s>\r\n", m->to);
+          do_flush(S);
+          do_status(S);
+          do_send(S, "DATA\r\n");
+          do_flush(S);
+          do_status(S);
+          do_content(S, m, now);
+          do_flush(S);
+          do_status(S);
+          sent = TRUE;
+        }
+      }
+      rv = TRUE;
     }
-    /* After starttls, send ehlo again: RFC 3207: 4.2 Result of the STARTTLS Command */
-    do_send(&S, "EHLO %s\r\n", S.localhost);
-    do_status(&S);
   }
+  END_LOCK;
 
-  /* Authenticate if possible */
-  if(S.username) {
-    unsigned char buffer[STRLEN];
-    int len;
+  return rv;
+}
 
-    len = snprintf((char *)buffer, STRLEN, "%c%s%c%s", '\0', S.username, '\0', S.password?S.password:"");
-    b64 = encode_base64(len, buffer);
-    do_send(&S, "AUTH PLAIN %s\r\n", b64); 
-    do_status(&S);
-  }
-  
-  for(i = 0, m= mail; m; m= m->next, i++) { 
-    do_send(&S, "MAIL FROM: <%s>\r\n", m->from);
-    do_status(&S);
-    do_send(&S, "RCPT TO: <%s>\r\n", m->to);
-    do_status(&S);
-    do_send(&S, "DATA\r\n");
-    do_status(&S);
-    do_send(&S, "From: %s\r\n", m->from);
-    if (m->replyto)
-      do_send(&S, "Reply-To: %s\r\n", m->replyto);
-    do_send(&S, "To: %s\r\n", m->to);
-    do_send(&S, "Subject: %s\r\n", m->subject);
-    do_send(&S, "Date: %s\r\n", now);
-    do_send(&S, "X-Mailer: %s %s\r\n", prog, VERSION);
-    do_send(&S, "Mime-Version: 1.0\r\n");
-    do_send(&S, "Content-Type: text/plain; charset=\"iso-8859-1\"\r\n");
-    do_send(&S, "Content-Transfer-Encoding: 8bit\r\n");
-    do_send(&S, "Message-id: <%ld.%lu@%s>\r\n", time(NULL), random(), S.localhost);
-    do_send(&S, "\r\n");
-    do_send(&S, "%s\r\n", m->message);
-    do_send(&S, ".\r\n");
-    do_status(&S);
-  }
-  do_send(&S, "QUIT\r\n");
-  do_status(&S);
-  
-exit:
-  if(S.socket)
-    socket_free(&S.socket);
-  
-  FREE(b64);
 
-  return rv;
+/**
+ * Close the SMTP session if open. This function is called at the end
+ * of the cycle and before the mail servers are released.
+ */
+void sendmail_close() {
+  SendMail_T *S = &session;
+
+  LOCK(sendmail_mutex)
+  {
+    if(S->socket) {
+      if(! sigsetjmp(S->error, TRUE)) {
+        do_send(S, "QUIT\r\n");
+        do_flush(S);
+        do_status(S);
+      }
+      close_server(S);
+    }
+    FREE(S->buffer.buf);
+    S->buffer.bufsize = S->buffer.bufused = 0;
+  }
+  END_LOCK;
 }
 
 
 /* ----------------------------------------------------------------- Private */
 
 
-void do_send(SendMail_T *S, const char *s, ...) {
+/**
+ * Append the command to the output buffer, the buffer is sent by
+ * do_flush()
+ */
+static void do_send(SendMail_T *S, const char *s, ...) {
   
-  long len;
   va_list ap;
-  char *msg= NULL;
   
   va_start(ap,s);
-  msg= Util_formatString(s, ap, &len);
+  Util_vstringbuffer(&S->buffer, s, ap);
   va_end(ap);
   
-  if (socket_write(S->socket, msg, strlen(msg)) <= 0) {
-    FREE(msg);
+}
+
+
+static void do_flush(SendMail_T *S) {
+  
+  size_t size = S->buffer.bufused;
+
+  S->buffer.bufused = 0;
+  if (size && socket_write(S->socket, S->buffer.buf, size) <= 0) {
     LogError("Sendmail: error sending data to the server '%s' -- %s\n",
 	S->server, STRERROR);
     siglongjmp(S->error, TRUE);
   }
   
-  FREE(msg);
-  
 }
 
 
-static void do_status(SendMail_T *S) {
+/**
+ * Read the (multiline) reply of the server, the PIPELINING extension
+ * announced in the reply is recorded
+ * @return The reply code
+ */
+static int do_reply(SendMail_T *S) {
   
-  int  status;
+  int  status = 0;
   char buf[STRLEN];
   
-  if(!socket_readln(S->socket, buf, sizeof(buf))) {
-    LogError("Sendmail: error receiving data from the mailserver '%s' -- %s\n",
-	S->server, STRERROR);
-    siglongjmp(S->error, TRUE);
-  }
+  do {
+    if(!socket_readln(S->socket, buf, sizeof(buf))) {
+      LogError("Sendmail: error receiving data from the mailserver '%s' -- %s\n",
+	  S->server, STRERROR);
+      siglongjmp(S->error, TRUE);
+    }
+    Util_chomp(buf);
+    sscanf(buf, "%d", &status);
+    if(strlen(buf) > 4 && IS(buf + 4, "PIPELINING"))
+      S->pipelining = TRUE;
+  } while(strlen(buf) > 3 && buf[3] == '-');
   
-  Util_chomp(buf);
+  if(status >= 400)
+    LogError("Sendmail error: %s\n", buf);
+
+  return status;
   
-  sscanf(buf, "%d", &status);
+}
+
+
+static void do_status(SendMail_T *S) {
   
-  if(status >= 400) {
-    LogError("Sendmail error: %s\n", buf);
+  if(do_reply(S) >= 400)
     siglongjmp(S->error, TRUE);
-  }
   
 }
 
 
+/**
+ * Greet the server, switch to TLS and authenticate if configured. The
+ * EHLO is used to learn whether the server supports pipelining, the
+ * HELO is used if the server doesn't know EHLO.
+ */
+static void do_hello(SendMail_T *S) {
+
+  snprintf(S->localhost, sizeof(S->localhost), "%s", Run.mail_hostname ? Run.mail_hostname : Run.localhostname);
+  S->pipelining = FALSE;
+  
+  do_status(S);
+
+  do_send(S, "EHLO %s\r\n", S->localhost);
+  do_flush(S);
+  if(do_reply(S) >= 400) {
+    /* EHLO is required for TLS and Authentication */
+    if((S->ssl.use_ssl && S->ssl.version == SSL_VERSION_TLS) || S->username)
+      siglongjmp(S->error, TRUE);
+    do_send(S, "HELO %s\r\n", S->localhost);
+    do_flush(S);
+    do_status(S);
+  }
+
+  /* Switch to TLS now if configured */
+  if(S->ssl.use_ssl && S->ssl.version == SSL_VERSION_TLS) {
+    do_send(S, "STARTTLS\r\n"); 
+    do_flush(S);
+    do_status(S);
+    if(!socket_switch2ssl(S->socket, S->ssl)) {
+      LogError("Sendmail: cannot switch to TLS with the mailserver '%s'\n", S->server);
+      siglongjmp(S->error, TRUE);
+    }
+    /* After starttls, send ehlo again: RFC 3207: 4.2 Result of the STARTTLS Command */
+    S->pipelining = FALSE;
+    do_send(S, "EHLO %s\r\n", S->localhost);
+    do_flush(S);
+    do_status(S);
+  }
+
+  /* Authenticate if possible */
+  if(S->username) {
+    unsigned char buffer[STRLEN];
+    int len;
+    char *b64;
+
+    len = snprintf((char *)buffer, STRLEN, "%c%s%c%s", '\0', S->username, '\0', S->password?S->password:"");
+    b64 = encode_base64(len, buffer);
+    do_send(S, "AUTH PLAIN %s\r\n", b64); 
+    FREE(b64);
+    do_flush(S);
+    do_status(S);
+  }
+
+}
+
+
+static void do_envelope(SendMail_T *S, Mail_T m) {
+  do_send(S, "MAIL FROM: <%s>\r\n", m->from);
+  do_send(S, "RCPT TO: <%s>\r\n", m->to);
+  do_send(S, "DATA\r\n");
+}
+
+
+static void do_content(SendMail_T *S, Mail_T m, const char *now) {
+  do_send(S, "From: %s\r\n", m->from);
+  if (m->replyto)
+    do_send(S, "Reply-To: %s\r\n", m->replyto);
+  do_send(S, "To: %s\r\n", m->to);
+  do_send(S, "Subject: %s\r\n", m->subject);
+  do_send(S, "Date: %s\r\n", now);
+  do_send(S, "X-Mailer: %s %s\r\n", prog, VERSION);
+  do_send(S, "Mime-Version: 1.0\r\n");
+  do_send(S, "Content-Type: text/plain; charset=\"iso-8859-1\"\r\n");
+  do_send(S, "Content-Transfer-Encoding: 8bit\r\n");
+  do_send(S, "Message-id: <%ld.%lu@%s>\r\n", time(NULL), random(), S->localhost);
+  do_send(S, "\r\n");
+  do_send(S, "%s\r\n", m->message);
+  do_send(S, ".\r\n");
+}
+
+
+static void close_server(SendMail_T *S) {
+  if(S->socket)
+    socket_free(&S->socket);
+  S->buffer.bufused = 0;
+}
+
+
 static void open_server(SendMail_T *S) {
 
   MailServer_T mta= Run.mailservers;
@@ -278,6 +278,18 @@ int socket_is_ready(Socket_T S) {
 }
 
 
+int socket_can_read(Socket_T S, int timeout) {
+
+  ASSERT(S);
+
+  if(S->offset < S->length)
+    return TRUE;
+
+  return (fill(S, timeout) > 0);
+
+}
+
+
 int socket_is_secure(Socket_T S) {
   
   ASSERT(S);
@@ -407,8 +419,10 @@ int socket_write(Socket_T S, void *b, int size) {
   
   ASSERT(S);
   
-  /* Clear any extra data read from the server */
-  socket_reset(S);
+  /* Clear any extra data read from the server. The accepted socket keeps
+   * the data, it may be the next request of a persistent connection */
+  if(S->connection_type == TYPE_LOCAL)
+    socket_reset(S);
 
   while(size > 0) {
     
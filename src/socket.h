@@ -116,6 +116,16 @@ void socket_free(Socket_T *S);
 int socket_is_ready(Socket_T S);
 
 
+/**
+ * Returns TRUE if there is data to be read from the socket, either
+ * buffered already or received within timeout seconds
+ * @param S A Socket object
+ * @param timeout The number of seconds to wait for data
+ * @return TRUE if data can be read otherwise FALSE
+ */
+int socket_can_read(Socket_T S, int timeout);
+
+
 /**
  * Return TRUE if the connection is encrypted with SSL
  * @param S A Socket object
@@ -119,20 +119,43 @@
 #include <grp.h>
 #endif
 
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
 #include "monit.h"
 #include "engine.h"
 #include "md5.h"
 #include "sha.h"
+#include "xxhash.h"
 #include "base64.h"
 #include "alert.h"
 #include "process.h"
 #include "event.h"
 
 
+/* The file checksum read size, the large reads keep the syscall overhead
+ * low while the kernel reads ahead */
+#define CHECKSUM_BLOCKSIZE 1048576
+
+/* Case-insensitive open addressing index of the service list by name. The
+ * index is built by the parser and it is read only until the service list
+ * is released, so the lookup needs no lock */
+static struct {
+  Service_T *slot;                          /**< Service or NULL if empty */
+  int        size;               /**< Number of slots (power of two) */
+  int        count;                        /**< Number of indexed services */
+} serviceindex;
+
+
 /* Private prototypes */
 static char   x2c(char *hex);
 static char  *is_str_defined(char *);
 static void   printevents(unsigned int);
+static void   reserve_buffer(Buffer_T *, size_t);
+static int    digest_file(int, int, unsigned char *);
+static unsigned int hash_name(const char *);
+static void   insert_service(Service_T);
 #ifdef HAVE_LIBPAM
 #ifdef SOLARIS
 static int    PAMquery(int, struct pam_message **, struct pam_response **, void *);
@@ -501,6 +524,16 @@ Service_T Util_getService(const char *name) {
 
   ASSERT(name);
 
+  if(serviceindex.count) {
+    unsigned int i;
+
+    for(i= hash_name(name) & (serviceindex.size - 1); (s= serviceindex.slot[i]); i= (i + 1) & (serviceindex.size - 1)) {
+      if(IS(s->name, name))
+        return s;
+    }
+    return NULL;
+  }
+
   for(s= servicelist; s; s= s->next) {
     if(IS(s->name, name)) {
       return s;
@@ -510,6 +543,33 @@ Service_T Util_getService(const char *name) {
 }
 
 
+void Util_indexService(Service_T s) {
+  ASSERT(s);
+
+  if(2 * (serviceindex.count + 1) > serviceindex.size) {
+    int i;
+    int size= serviceindex.size;
+    Service_T *slot= serviceindex.slot;
+
+    serviceindex.size= size ? 2 * size : 64;
+    serviceindex.slot= xcalloc(serviceindex.size, sizeof(Service_T));
+    serviceindex.count= 0;
+    for(i= 0; i < size; i++)
+      if(slot[i])
+        insert_service(slot[i]);
+    FREE(slot);
+  }
+  insert_service(s);
+}
+
+
+void Util_resetServiceIndex() {
+  FREE(serviceindex.slot);
+  serviceindex.size= 0;
+  serviceindex.count= 0;
+}
+
+
 int Util_getNumberOfServices() {
   int i= 0;
   Service_T s;
@@ -536,6 +596,12 @@ void Util_printRunList() {
   printf(" %-18s = %s\n", "Use process engine", Run.doprocess?"True":"False");
   printf(" %-18s = %d seconds with start delay %d seconds\n", "Poll time", Run.polltime, Run.startdelay);
   printf(" %-18s = %d bytes\n", "Expect buffer", Run.expectbuffer);
+  if(Run.checksumcache) {
+    if(Run.checksumrehash)
+      printf(" %-18s = Enabled with full rehash every %d cycles\n", "Checksum cache", Run.checksumrehash);
+    else
+      printf(" %-18s = Enabled\n", "Checksum cache");
+  }
 
   if(Run.eventlist_dir) {
     char slots[STRLEN];
@@ -547,6 +613,11 @@ void Util_printRunList() {
 
     printf(" %-18s = base directory %s with %s slots\n",
       "Event queue", Run.eventlist_dir, slots);
+    if(Run.eventlist_bytes)
+      printf(" %-18s = %llu bytes\n", "Event queue size", Run.eventlist_bytes);
+    if(Run.eventlist_policy != QUEUE_DROP_NONE)
+      printf(" %-18s = drop %s\n", "Event queue full",
+        Run.eventlist_policy == QUEUE_DROP_OLDEST ? "oldest" : "succeeded");
   }
 
   if(Run.mmonits) {
@@ -868,6 +939,14 @@ void Util_printService(Service_T s) {
       printf("then %s", Util_describeAction(a->failed, buf, sizeof(buf)));
       printf("\n");
     }
+    if (s->matchlimit) {
+      printf(" %-20s = ", "Regex limit");
+      if (s->matchlimit->bytes)
+        printf("%llu byte(s) ", s->matchlimit->bytes);
+      if (s->matchlimit->lines)
+        printf("%lu line(s) ", s->matchlimit->lines);
+      printf("per cycle%s\n", s->matchlimit->skip ? ", skip to tail" : "");
+    }
   }
   
   for(dl= s->filesystemlist; dl; dl= dl->next) {
@@ -1195,6 +1274,9 @@ int Util_isProcessRunning(Service_T s, int refresh) {
   }
 
   if (pid > 0) {
+    /* If the process tree was just refreshed, the pid lookup in its index is as good as a probe, otherwise test the pid directly */
+    if (refresh && Run.doprocess && ptree && findprocess(pid, ptree, ptreesize) != -1)
+      return pid;
     if ((getpgid(pid) > -1) || (errno == EPERM))
       return pid;
     DEBUG("'%s' Error testing process id [%d] -- %s\n", s->name, pid, STRERROR);
@@ -1207,14 +1289,13 @@ int Util_isProcessRunning(Service_T s, int refresh) {
 
 char *Util_getRFC822Date(time_t *date, char *result, int len) {
   
-  struct tm *tm_now;
+  struct tm tm_now;
   time_t now = (date && *date > 0) ? *date : time(NULL);
   
-  tm_now = localtime(&now);
-  if (! tm_now)
+  if (! localtime_r(&now, &tm_now))
     return NULL;
   
-  if (strftime(result, len, "%a, %d %b %Y %H:%M:%S %z", tm_now) <= 0) {
+  if (strftime(result, len, "%a, %d %b %Y %H:%M:%S %z", &tm_now) <= 0) {
     *result= 0;
   }
   return result;
@@ -1277,37 +1358,33 @@ int Util_getChecksum(char *file, int hashtype, char *buf, int bufsize) {
     case HASH_SHA1:
       hashlength = 20;
       break;
+#ifdef HAVE_OPENSSL
+    case HASH_SHA256:
+      hashlength = 32;
+      break;
+#endif
+    case HASH_XXH64:
+      hashlength = XXH64_SIZE;
+      break;
     default:
       LogError("checksum: invalid hash type: 0x%x\n", hashtype);
       return FALSE;
   }
 
   if (file_isFile(file)) {
-    FILE *f = fopen(file, "r");
-    if (f) {
-      MD_T result;
+    int fd = open(file, O_RDONLY);
+    if (fd != -1) {
       unsigned char sum[STRLEN];
-      int fresult = 0;
-
-      *result = 0;
 
-      switch (hashtype) {
-        case HASH_MD5:
-          fresult = md5_stream(f, sum);
-          break;
-        case HASH_SHA1:
-          fresult = sha_stream(f, sum);
-          break;
+      if (! digest_file(fd, hashtype, sum)) {
+        LogError("checksum: file %s read error -- %s\n", file, STRERROR);
+        close(fd);
+        return FALSE;
       }
 
-      if (fclose(f))
+      if (close(fd))
         LogError("%s: Error closing file '%s' -- %s\n", prog, file, STRERROR);
 
-      if (fresult) {
-        LogError("checksum: file %s stream error (0x%x)\n", file, fresult);
-        return FALSE;
-      }
-
       Util_digest2Bytes(sum, hashlength, buf);
       return TRUE;
 
@@ -1980,26 +2057,46 @@ char *Util_portDescription(Port_T p, char *buf, int bufsize) {
 
 void Util_stringbuffer(Buffer_T *b, const char *m, ...) {
   if (m) {
-    va_list  ap;
-    char    *buf;
-    long     need = 0;
-    ssize_t  have = 0;
+    va_list ap;
 
     va_start(ap, m);
-    buf = Util_formatString(m, ap, &need);
+    Util_vstringbuffer(b, m, ap);
     va_end(ap);
+  }
+}
+
 
-    have = (*b).bufsize - (*b).bufused;
-    if (have <= need) {
-      (*b).bufsize += (need + STRLEN);
-      (*b).buf = xresize((*b).buf, (*b).bufsize);
-      if (! (*b).bufused)
-        memset((*b).buf, 0, (*b).bufsize);
+void Util_vstringbuffer(Buffer_T *b, const char *m, va_list ap) {
+  ASSERT(b);
+
+  if (m) {
+#ifdef HAVE_VA_COPY
+    int     n;
+    va_list ap_copy;
+
+    /* Format in place, if the free space is not sufficient, grow the buffer and format again */
+    reserve_buffer(b, 0);
+    va_copy(ap_copy, ap);
+    n = vsnprintf(b->buf + b->bufused, b->bufsize - b->bufused, m, ap_copy);
+    va_end(ap_copy);
+    if (n >= (int)(b->bufsize - b->bufused)) {
+      reserve_buffer(b, n);
+      va_copy(ap_copy, ap);
+      n = vsnprintf(b->buf + b->bufused, b->bufsize - b->bufused, m, ap_copy);
+      va_end(ap_copy);
     }
-    memcpy(&(*b).buf[(*b).bufused], buf, need);
-    (*b).bufused += need;
-    (*b).buf[(*b).bufused]= 0;
+    if (n > 0)
+      b->bufused += n;
+#else
+    long  need = 0;
+    char *buf = Util_formatString(m, ap, &need);
+
+    reserve_buffer(b, need);
+    memcpy(b->buf + b->bufused, buf, need);
+    b->bufused += need;
     FREE(buf);
+#endif
+    b->buf[b->bufused] = 0;
   }
 }
 
@@ -2041,6 +2138,139 @@ long Util_usleep(long u) {
 /* ----------------------------------------------------------------- Private */
 
 
+/**
+ * Grow the buffer geometrically, so it has space for at least need
+ * bytes and the terminating zero
+ */
+static void reserve_buffer(Buffer_T *b, size_t need) {
+  if (b->bufsize - b->bufused <= need) {
+    size_t size = b->bufsize ? b->bufsize : STRLEN;
+
+    while (size - b->bufused <= need)
+      size *= 2;
+    b->buf = xresize(b->buf, size);
+    b->bufsize = size;
+  }
+}
+
+
+/**
+ * Compute the digest of the file content. The file is read sequentially
+ * in large blocks. The cryptographic hashes use the OpenSSL digests if
+ * available, as these select the fastest implementation for the CPU at
+ * runtime (such as the SHA extensions or AVX2), the built-in MD5 and SHA1
+ * are used otherwise, for example in the FIPS mode where MD5 is disabled.
+ * @param fd The file descriptor
+ * @param hashtype The hash type
+ * @param sum The result buffer
+ * @return TRUE if succeeded, FALSE if the file read failed (errno is set)
+ */
+static int digest_file(int fd, int hashtype, unsigned char *sum) {
+  int     rv = TRUE;
+  ssize_t n;
+  char   *buffer;
+  union {
+    struct md5_ctx   md5;
+    struct sha_ctx   sha;
+    struct xxh64_ctx xxh64;
+  } ctx;
+#ifdef HAVE_OPENSSL
+  EVP_MD_CTX   *evp = NULL;
+  const EVP_MD *md = NULL;
+
+  switch (hashtype) {
+    case HASH_MD5:
+      md = EVP_md5();
+      break;
+    case HASH_SHA1:
+      md = EVP_sha1();
+      break;
+    case HASH_SHA256:
+      md = EVP_sha256();
+      break;
+  }
+  if (md && (evp = EVP_MD_CTX_create()) && ! EVP_DigestInit_ex(evp, md, NULL)) {
+    EVP_MD_CTX_destroy(evp);
+    evp = NULL;
+  }
+  if (hashtype == HASH_SHA256 && ! evp) {
+    LogError("checksum: SHA256 digest is not available\n");
+    errno = EINVAL;
+    return FALSE;
+  }
+#endif
+
+  switch (hashtype) {
+    case HASH_MD5:
+      md5_init_ctx(&ctx.md5);
+      break;
+    case HASH_SHA1:
+      sha_init_ctx(&ctx.sha);
+      break;
+    case HASH_XXH64:
+      xxh64_init_ctx(&ctx.xxh64);
+      break;
+  }
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  buffer = xmalloc(CHECKSUM_BLOCKSIZE);
+  while ((n = read(fd, buffer, CHECKSUM_BLOCKSIZE)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      rv = FALSE;
+      break;
+    }
+#ifdef HAVE_OPENSSL
+    if (evp) {
+      EVP_DigestUpdate(evp, buffer, n);
+      continue;
+    }
+#endif
+    switch (hashtype) {
+      case HASH_MD5:
+        md5_process_bytes(buffer, n, &ctx.md5);
+        break;
+      case HASH_SHA1:
+        sha_process_bytes(buffer, n, &ctx.sha);
+        break;
+      case HASH_XXH64:
+        xxh64_process_bytes(buffer, n, &ctx.xxh64);
+        break;
+    }
+  }
+  FREE(buffer);
+
+#ifdef HAVE_OPENSSL
+  if (evp) {
+    int err = errno;
+    EVP_DigestFinal_ex(evp, sum, NULL);
+    EVP_MD_CTX_destroy(evp);
+    errno = err;
+    return rv;
+  }
+#endif
+  if (rv) {
+    switch (hashtype) {
+      case HASH_MD5:
+        md5_finish_ctx(&ctx.md5, sum);
+        break;
+      case HASH_SHA1:
+        sha_finish_ctx(&ctx.sha, sum);
+        break;
+      case HASH_XXH64:
+        xxh64_finish_ctx(&ctx.xxh64, sum);
+        break;
+    }
+  }
+
+  return rv;
+}
+
+
 /**
  * Returns the value of the parameter if defined or the String "(not
  * defined)"
@@ -2050,6 +2280,33 @@ static char *is_str_defined(char *s) {
 }
 
 
+/*
+ * Case-insensitive FNV-1a hash of the service name
+ */
+static unsigned int hash_name(const char *name) {
+  unsigned int h= 2166136261U;
+
+  for(; *name; name++) {
+    h^= (unsigned char)tolower((unsigned char)*name);
+    h*= 16777619U;
+  }
+  return h;
+}
+
+
+/*
+ * Insert the service to the index, the index must have a free slot
+ */
+static void insert_service(Service_T s) {
+  unsigned int i;
+
+  for(i= hash_name(s->name) & (serviceindex.size - 1); serviceindex.slot[i]; i= (i + 1) & (serviceindex.size - 1))
+    ;
+  serviceindex.slot[i]= s;
+  serviceindex.count++;
+}
+
+
 /**
  * Convert a hex char to a char
  */
@@ -179,12 +179,31 @@ char *Util_digest2Bytes(unsigned char *digest, int mdlen, MD_T result);
 
 
 /**
+ * Get the service by name, the name is compared case-insensitive. The
+ * service is found via the name index, the service list is scanned only
+ * if it was not indexed.
  * @param name A service name as stated in the config file
  * @return the named service or NULL if not found
  */
 Service_T Util_getService(const char *name);
 
 
+/**
+ * Add the service to the name index used by Util_getService(). The
+ * parser indexes each service it creates, the service names must not
+ * change afterwards.
+ * @param s A service object
+ */
+void Util_indexService(Service_T s);
+
+
+/**
+ * Release the service name index. Must be called before the service
+ * list is released or built again.
+ */
+void Util_resetServiceIndex();
+
+
 /**
  * @param name A service name as stated in the config file
  * @return TRUE if the service name exist in the
@@ -511,6 +530,16 @@ char *Util_portDescription(Port_T p, char *buf, int bufsize);
 void Util_stringbuffer(Buffer_T *b, const char *m, ...);
 
 
+/**
+ * Print to string buffer. The string is formated directly into the
+ * buffer, which grows geometrically if needed.
+ * @param b A Buffer object
+ * @param m Format string
+ * @param ap Variable argument list
+ */
+void Util_vstringbuffer(Buffer_T *b, const char *m, va_list ap);
+
+
 /**
  *  Returns the FQDN hostname or fallback to gethostname() output
  *  @param buf the character array for hostname
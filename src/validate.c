@@ -60,6 +60,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
@@ -105,6 +109,53 @@
 
 #define MATCH_LINE_LENGTH 512
 
+/* The content match reads the file by blocks of this size */
+#define MATCH_BUFFER_SIZE 65536
+
+/* TRUE if the host is pinged by the ICMP batch, i.e. it will be checked in this cycle */
+#define ICMP_BATCHED(s, icmp) ((icmp)->type == ICMP_ECHO && (s)->type == TYPE_HOST && (s)->monitor && ! ((s)->def_every && (s)->nevery + 1 < (s)->every))
+
+#define JOB_WAITING       0
+#define JOB_RUNNING       1
+#define JOB_DONE          2
+
+/* Service validation job used by the concurrent validation */
+typedef struct myvalidatejob {
+  Service_T s;                                     /**< The service to check */
+  int       state;                 /**< JOB_WAITING, JOB_RUNNING or JOB_DONE */
+  int       pending;  /**< Number of unfinished services this service depends on */
+  int       dependants_num;      /**< Number of services depending on this one */
+  int      *dependants;        /**< Jobs of services depending on this service */
+} ValidateJob_T;
+
+static ValidateJob_T  *jobs = NULL;            /**< Jobs of the actual cycle */
+static int             jobs_num = 0;                   /**< Number of jobs */
+static int             jobs_next = 0;          /**< First job not dispatched */
+static int             jobs_errors = 0;         /**< Number of failed checks */
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  jobs_cond = PTHREAD_COND_INITIALIZER;
+
+static unsigned long   checksum_hits = 0;         /**< Checksum cache hits */
+static unsigned long   checksum_misses = 0;     /**< Checksum cache misses */
+static pthread_mutex_t checksum_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Maximum number of threads testing the ports of one service and of all
+ * services checked at the same time */
+#define CONNECTION_THREADS     4
+#define CONNECTION_THREADS_MAX 16
+
+/* Port tests of one service, shared by the threads testing them */
+typedef struct myconnectionjob {
+  Service_T       s;                       /**< The service owning the ports */
+  PortProbe_T    *probe;                /**< The probed ports to test */
+  int             n;                           /**< The number of ports */
+  int             next;                  /**< Index of the next port to test */
+  pthread_mutex_t mutex;                                 /**< Protects next */
+} ConnectionJob_T;
+
+static int             connection_threads = 0;  /**< Running test threads */
+static pthread_mutex_t connection_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 /* -------------------------------------------------------------- Prototypes */
 
@@ -114,20 +165,28 @@ static void check_gid(Service_T);
 static void check_size(Service_T);
 static void check_perm(Service_T);
 static void check_match(Service_T);
-static int  check_match_ignore(Service_T, char *);
-static void check_match_if(Service_T, char *);
+static off_t last_line(int, off_t, off_t);
+static void check_match_if(Service_T, char *, int *);
 static int  check_skip(Service_T);
 static void check_timeout(Service_T);
-static void check_checksum(Service_T);
+static void check_checksum(Service_T, int);
+static int  get_checksum(Service_T);
+static void get_checksum_key(ChecksumKey_T *, struct stat *);
 static void check_timestamp(Service_T);
 static void check_process_state(Service_T);
 static void check_process_pid(Service_T);
 static void check_process_ppid(Service_T);
-static void check_connection(Service_T, Port_T);
+static void check_icmp_batch();
+static void check_connections(Service_T);
+static void *check_connection_thread(void *);
+static void check_connection(Service_T, PortProbe_T *);
 static void check_filesystem_flags(Service_T);
 static void check_filesystem_resources(Service_T, Filesystem_T);
 static void check_process_resources(Service_T, Resource_T);
 static int  do_scheduled_action(Service_T);
+static int  validate_service(Service_T);
+static int  validate_concurrently();
+static void *validate_worker(void *);
 
 
 /* ---------------------------------------------------------------- Public */
@@ -136,13 +195,13 @@ static int  do_scheduled_action(Service_T);
 /**
  *  This function contains the main check machinery for  monit. The
  *  validate function check services in the service list to see if
- *  they will pass all defined tests.
+ *  they will pass all defined tests. If more than one worker is set,
+ *  the services are validated concurrently by a pool of threads.
  */
 int validate() {
   int errors = 0;
   Service_T s;
 
-  Run.handler_flag = HANDLER_SUCCEEDED;
   Event_queue_process();
 
   initprocesstree(&ptree, &ptreesize, &oldptree, &oldptreesize);
@@ -156,28 +215,66 @@ int validate() {
       do_scheduled_action(s);
   }
 
+  check_icmp_batch();
+
   /* Check the services */
-  for (s = servicelist; s && !Run.stopped; s = s->next) {
-    if (! do_scheduled_action(s) && s->monitor && ! check_skip(s)) {
-      check_timeout(s); // Can disable monitoring => need to check s->monitor again
-      if (s->monitor) {
-        if (! s->check(s))
-          errors++;
-        /* The monitoring may be disabled by some matching rule in s->check
-         * so we have to check again before setting to MONITOR_YES */
-        if (s->monitor != MONITOR_NOT)
-          s->monitor = MONITOR_YES;
-      }
-    }
-    gettimeofday(&s->collected, NULL);
+  if (Run.workers > 1) {
+    errors = validate_concurrently();
+  } else {
+    for (s = servicelist; s && !Run.stopped; s = s->next)
+      if (! validate_service(s))
+        errors++;
   }
 
   reset_depend();
 
+  History_update();
+
+  /* The alerts of the cycle were handled */
+  Event_flush();
+
+  return errors;
+}
+
+
+/**
+ * Validate the services watched with WATCH_IMMEDIATE whose path changed.
+ * This function is called when the watch wakes the sleeping daemon, the
+ * other services are checked in the next poll cycle.
+ */
+int validate_changed() {
+  int errors = 0;
+  Service_T s;
+
+  for (s = servicelist; s && !Run.stopped; s = s->next)
+    if (s->watch == WATCH_IMMEDIATE && s->changed)
+      if (! validate_service(s))
+        errors++;
+
+  reset_depend();
+
+  History_update();
+
+  /* The alerts of the cycle were handled */
+  Event_flush();
+
   return errors;
 }
 
 
+/**
+ * Get the checksum cache statistics
+ * @param hits The number of checksums reused from the cache
+ * @param misses The number of checksums which had to be computed
+ */
+void checksum_statistics(unsigned long *hits, unsigned long *misses) {
+  LOCK(checksum_mutex)
+    *hits   = checksum_hits;
+    *misses = checksum_misses;
+  END_LOCK;
+}
+
+
 /**
  * Validate a given process service s. Events are posted according to 
  * its configuration. In case of a fatal event FALSE is returned.
@@ -185,33 +282,38 @@ int validate() {
 int check_process(Service_T s) {
 
   pid_t  pid = -1;
-  Port_T pp = NULL;
   Resource_T pr = NULL;
 
   ASSERT(s);
 
-  /* Test for running process */
-  if (!(pid = Util_isProcessRunning(s, FALSE))) {
-    Event_post(s, Event_Nonexist, STATE_FAILED, s->action_NONEXIST, "process is not running");
+  /* The process tree may be refreshed by an action handled in an other
+   * service check thread, so it is used only while holding the Run.mutex */
+  LOCK(Run.mutex)
+    /* Test for running process */
+    if (!(pid = Util_isProcessRunning(s, FALSE))) {
+      Event_post(s, Event_Nonexist, STATE_FAILED, s->action_NONEXIST, "process is not running");
+    } else {
+      Event_post(s, Event_Nonexist, STATE_SUCCEEDED, s->action_NONEXIST, "process is running with pid %d", (int)pid);
+
+      if (Run.doprocess) {
+        if (update_process_data(s, ptree, ptreesize, pid)) {
+          check_process_state(s);
+          check_process_pid(s);
+          check_process_ppid(s);
+          for (pr = s->resourcelist; pr; pr = pr->next)
+            check_process_resources(s, pr);
+        } else
+          LogError("'%s' failed to get service data\n", s->name);
+      }
+    }
+  END_LOCK;
+
+  if (! pid)
     return FALSE;
-  } else
-    Event_post(s, Event_Nonexist, STATE_SUCCEEDED, s->action_NONEXIST, "process is running with pid %d", (int)pid);
-
-  if (Run.doprocess) {
-    if (update_process_data(s, ptree, ptreesize, pid)) {
-      check_process_state(s);
-      check_process_pid(s);
-      check_process_ppid(s);
-      for (pr = s->resourcelist; pr; pr = pr->next)
-        check_process_resources(s, pr);
-    } else
-      LogError("'%s' failed to get service data\n", s->name);
-  }
 
   /* Test each host:port and protocol in the service's portlist */
   if (s->portlist)
-    for (pp = s->portlist; pp; pp = pp->next)
-      check_connection(s, pp);
+    check_connections(s);
 
   return TRUE;
   
@@ -289,14 +391,23 @@ int check_filesystem(Service_T s) {
  * its configuration. In case of a fatal event FALSE is returned.
  */
 int check_file(Service_T s) {
+  int changed;
   struct stat stat_buf;
 
   ASSERT(s);
 
+  /* Without a watch, or if the watch reported a change, the content is
+   * tested. The modification which inotify doesn't report (such as a write
+   * using mmap) is still recognized by the file's inode, size or time */
+  changed = s->watch == WATCH_NONE || s->changed;
+  s->changed = FALSE;
+
   if (stat(s->path, &stat_buf) != 0) {
     Event_post(s, Event_Nonexist, STATE_FAILED, s->action_NONEXIST, "file doesn't exist");
     return FALSE;
   } else {
+    if (stat_buf.st_ino != s->inf->priv.file.st_ino || stat_buf.st_size != s->inf->priv.file.st_size || MAX(stat_buf.st_mtime, stat_buf.st_ctime) != s->inf->timestamp)
+      changed = TRUE;
     s->inf->st_mode = stat_buf.st_mode;
     if (s->inf->priv.file.st_ino == 0) {
       s->inf->priv.file.st_ino_prev = stat_buf.st_ino;
@@ -321,7 +432,7 @@ int check_file(Service_T s) {
   }
 
   if (s->checksum)
-    check_checksum(s);
+    check_checksum(s, changed);
 
   if (s->perm)
     check_perm(s);
@@ -338,7 +449,8 @@ int check_file(Service_T s) {
   if (s->timestamplist)
     check_timestamp(s);
 
-  if (s->matchlist)
+  /* The matching continues if the match limit left a backlog */
+  if (s->matchlist && (changed || s->inf->priv.file.match_backlog))
     check_match(s);
 
   return TRUE;
@@ -356,6 +468,8 @@ int check_directory(Service_T s) {
 
   ASSERT(s);
 
+  s->changed = FALSE;
+
   if (stat(s->path, &stat_buf) != 0) {
     Event_post(s, Event_Nonexist, STATE_FAILED, s->action_NONEXIST, "directory doesn't exist");
     return FALSE;
@@ -403,6 +517,8 @@ int check_fifo(Service_T s) {
 
   ASSERT(s);
 
+  s->changed = FALSE;
+
   if (stat(s->path, &stat_buf) != 0) {
     Event_post(s, Event_Nonexist, STATE_FAILED, s->action_NONEXIST, "fifo doesn't exist");
     return FALSE;
@@ -456,7 +572,6 @@ int check_status(Service_T s) {
  * @return FALSE if there was an error otherwise TRUE
  */
 int check_remote_host(Service_T s) {
-  Port_T p = NULL;
   Icmp_T icmp = NULL;
   Icmp_T last_ping = NULL;
 
@@ -469,7 +584,19 @@ int check_remote_host(Service_T s) {
       switch(icmp->type) {
       case ICMP_ECHO:
 
-        icmp->response = icmp_echo(s->path, icmp->timeout, icmp->count);
+        /* The host may be pinged already together with other hosts */
+        if (! icmp->is_tested) {
+          IcmpEcho_T echo;
+
+          memset(&echo, 0, sizeof(IcmpEcho_T));
+          echo.hostname = s->path;
+          echo.timeout  = icmp->timeout;
+          echo.count    = icmp->count;
+          icmp_echo_batch(&echo, 1);
+          icmp->response = echo.response;
+          icmp->loss     = echo.loss;
+        }
+        icmp->is_tested = FALSE;
 
         if (icmp->response == -2) {
           icmp->is_available = TRUE;
@@ -503,8 +630,7 @@ int check_remote_host(Service_T s) {
 
   /* Test each host:port and protocol in the service's portlist */
   if (s->portlist)
-    for (p = s->portlist; p; p = p->next)
-      check_connection(s, p);
+    check_connections(s);
 
   return TRUE;
   
@@ -532,10 +658,13 @@ int check_system(Service_T s) {
 
 
 /**
- * Test the connection and protocol
+ * Test the connection and protocol of the port probed by check_ports().
+ * The port is connected right before the protocol test, so the server
+ * doesn't wait for the test of an other port.
  */
-static void check_connection(Service_T s, Port_T p) {
-  Socket_T socket;
+static void check_connection(Service_T s, PortProbe_T *probe) {
+  Port_T p = probe->p;
+  Socket_T socket = NULL;
   volatile int rv = TRUE;
   char buf[STRLEN];
   char report[STRLEN] = {0};
@@ -548,8 +677,7 @@ static void check_connection(Service_T s, Port_T p) {
   gettimeofday(&t1, NULL);
 
   /* Open a socket to the destination INET[hostname:port] or UNIX[pathname] */
-  socket = socket_create(p);
-  if (!socket) {
+  if (! probe->is_available || ! (socket = socket_create(p))) {
     snprintf(report, STRLEN, "failed, cannot open a connection to %s", Util_portDescription(p, buf, sizeof(buf)));
     rv = FALSE;
     goto error;
@@ -596,6 +724,153 @@ static void check_connection(Service_T s, Port_T p) {
 }
 
 
+/**
+ * Ping all remote hosts which are going to be checked in this cycle at
+ * once, so the cycle is delayed by the slowest host only. The results
+ * are used by check_remote_host().
+ */
+static void check_icmp_batch() {
+  int i, n = 0;
+  Service_T s;
+  Icmp_T icmp;
+  IcmpEcho_T *echo;
+
+  for (s = servicelist; s; s = s->next) {
+    for (icmp = s->icmplist; icmp; icmp = icmp->next) {
+      icmp->is_tested = FALSE;
+      if (ICMP_BATCHED(s, icmp))
+        n++;
+    }
+  }
+
+  /* Single host is pinged by check_remote_host() */
+  if (n < 2)
+    return;
+
+  echo = xcalloc(sizeof(IcmpEcho_T), n);
+  for (i = 0, s = servicelist; s; s = s->next) {
+    for (icmp = s->icmplist; icmp; icmp = icmp->next) {
+      if (ICMP_BATCHED(s, icmp)) {
+        echo[i].hostname = s->path;
+        echo[i].timeout  = icmp->timeout;
+        echo[i].count    = icmp->count;
+        i++;
+      }
+    }
+  }
+
+  icmp_echo_batch(echo, n);
+
+  for (i = 0, s = servicelist; s; s = s->next) {
+    for (icmp = s->icmplist; icmp; icmp = icmp->next) {
+      if (ICMP_BATCHED(s, icmp)) {
+        icmp->response  = echo[i].response;
+        icmp->loss      = echo[i].loss;
+        icmp->is_tested = TRUE;
+        i++;
+      }
+    }
+  }
+  FREE(echo);
+}
+
+
+/**
+ * Test all ports of the service s. All ports are probed at once by
+ * check_ports(), so unreachable ports delay the service check by the
+ * longest connection timeout instead of the sum of the timeouts. The
+ * ports which accepted the probe are then connected again and tested.
+ * If more than one worker is set, the ports are tested concurrently
+ * by up to CONNECTION_THREADS threads including the calling one. At most
+ * CONNECTION_THREADS_MAX additional threads run for all services, each
+ * worker gets an equal share of them so that the services checked later
+ * in the cycle are not left without threads. The ports are tested by
+ * the calling thread if the limit is reached.
+ * The events are serialized by the event engine.
+ */
+static void check_connections(Service_T s) {
+  int i, n, threads;
+  Port_T p;
+  pthread_t thread[CONNECTION_THREADS - 1];
+  ConnectionJob_T job;
+
+  ASSERT(s);
+
+  for (n = 0, p = s->portlist; p; p = p->next)
+    n++;
+
+  job.s = s;
+  job.n = n;
+  job.next = 0;
+  job.probe = xcalloc(sizeof(PortProbe_T), n);
+  for (i = 0, p = s->portlist; p; p = p->next, i++)
+    job.probe[i].p = p;
+  /* The probe would only repeat the connect of a single port */
+  if (n < 2)
+    job.probe[0].is_available = TRUE;
+  else
+    check_ports(job.probe, n);
+
+  if (n < 2 || Run.workers < 2) {
+    for (i = 0; i < n; i++)
+      check_connection(s, &job.probe[i]);
+    FREE(job.probe);
+    return;
+  }
+
+  LOCK(connection_mutex)
+    threads = MIN(MIN(n, CONNECTION_THREADS) - 1, CONNECTION_THREADS_MAX / Run.workers);
+    threads = MIN(threads, CONNECTION_THREADS_MAX - connection_threads);
+    connection_threads += threads;
+  END_LOCK;
+
+  pthread_mutex_init(&job.mutex, NULL);
+  for (i = 0; i < threads; i++) {
+    int status;
+
+    if ((status = pthread_create(&thread[i], NULL, check_connection_thread, &job)) != 0) {
+      DEBUG("'%s' cannot create the connection test thread -- %s\n", s->name, strerror(status));
+      break;
+    }
+  }
+  if (i < threads) {
+    LOCK(connection_mutex)
+      connection_threads -= threads - i;
+    END_LOCK;
+    threads = i;
+  }
+
+  check_connection_thread(&job);
+
+  for (i = 0; i < threads; i++)
+    pthread_join(thread[i], NULL);
+  pthread_mutex_destroy(&job.mutex);
+  FREE(job.probe);
+
+  LOCK(connection_mutex)
+    connection_threads -= threads;
+  END_LOCK;
+}
+
+
+/**
+ * Test the ports of the job until all are tested
+ */
+static void *check_connection_thread(void *arg) {
+  ConnectionJob_T *job = arg;
+  PortProbe_T *probe;
+
+  do {
+    LOCK(job->mutex)
+      probe = job->next < job->n ? &job->probe[job->next++] : NULL;
+    END_LOCK;
+    if (probe)
+      check_connection(job->s, probe);
+  } while (probe);
+  return NULL;
+}
+
+
 /**
  * Test process state (e.g. Zombie)
  */
@@ -827,9 +1102,11 @@ static void check_process_resources(Service_T s, Resource_T r) {
 
 
 /**
- * Test for associated path checksum change
+ * Test for associated path checksum change. If the file didn't change,
+ * the checksum computed before is tested again without reading the file.
+ * @param modified FALSE if the file is known to be unchanged
  */
-static void check_checksum(Service_T s) {
+static void check_checksum(Service_T s, int modified) {
   int         changed;
   Checksum_T  cs;
 
@@ -837,7 +1114,7 @@ static void check_checksum(Service_T s) {
 
   cs = s->checksum;
 
-  if (Util_getChecksum(s->path, cs->type, s->inf->priv.file.cs_sum, sizeof(s->inf->priv.file.cs_sum))) {
+  if ((! modified && *s->inf->priv.file.cs_sum) || get_checksum(s)) {
 
     Event_post(s, Event_Data, STATE_SUCCEEDED, s->action_DATA, "checksum computed for %s", s->path);
 
@@ -848,6 +1125,12 @@ static void check_checksum(Service_T s) {
       case HASH_SHA1:
         changed = strncmp(cs->hash, s->inf->priv.file.cs_sum, 40);
         break;
+      case HASH_SHA256:
+        changed = strncmp(cs->hash, s->inf->priv.file.cs_sum, 64);
+        break;
+      case HASH_XXH64:
+        changed = strncmp(cs->hash, s->inf->priv.file.cs_sum, 16);
+        break;
       default:
         LogError("'%s' unknown hash type\n", s->name);
         *s->inf->priv.file.cs_sum = 0;
@@ -885,11 +1168,80 @@ static void check_checksum(Service_T s) {
     return;
   }
 
+  *s->inf->priv.file.cs_sum = 0;
   Event_post(s, Event_Data, STATE_FAILED, s->action_DATA, "cannot compute checksum for %s", s->path);
 
 }
 
 
+/**
+ * Compute the file checksum into s->inf->priv.file.cs_sum. If the checksum
+ * cache is enabled and the file's metadata didn't change since the last
+ * computation, the previous checksum is reused.
+ * @return TRUE if the checksum is available, otherwise FALSE
+ */
+static int get_checksum(Service_T s) {
+  struct stat   buf;
+  ChecksumKey_T key;
+  time_t        started = time(NULL);
+  int           cacheable = Run.checksumcache && stat(s->path, &buf) == 0;
+
+  if (cacheable) {
+    get_checksum_key(&key, &buf);
+    if (s->inf->priv.file.cs_cached && ! memcmp(&key, &s->inf->priv.file.cs_key, sizeof(key)) &&
+        (! Run.checksumrehash || ++s->inf->priv.file.cs_cycles < Run.checksumrehash)) {
+      DEBUG("'%s' file metadata has not changed -- using the cached checksum\n", s->name);
+      LOCK(checksum_mutex)
+        checksum_hits++;
+      END_LOCK;
+      return TRUE;
+    }
+    LOCK(checksum_mutex)
+      checksum_misses++;
+    END_LOCK;
+  }
+
+  s->inf->priv.file.cs_cached = FALSE;
+  if (! Util_getChecksum(s->path, s->checksum->type, s->inf->priv.file.cs_sum, sizeof(s->inf->priv.file.cs_sum)))
+    return FALSE;
+
+  /* The checksum is cached only if the file didn't change while it was
+   * computed and wasn't modified in the second the computation started,
+   * because an other change within the timestamp granularity wouldn't be
+   * recognized later */
+  if (cacheable && stat(s->path, &buf) == 0 && MAX(buf.st_mtime, buf.st_ctime) < started) {
+    ChecksumKey_T after;
+
+    get_checksum_key(&after, &buf);
+    if (! memcmp(&key, &after, sizeof(key))) {
+      s->inf->priv.file.cs_key    = key;
+      s->inf->priv.file.cs_cached = TRUE;
+      s->inf->priv.file.cs_cycles = 0;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * Get the checksum cache key from the file's metadata
+ */
+static void get_checksum_key(ChecksumKey_T *key, struct stat *buf) {
+  memset(key, 0, sizeof(ChecksumKey_T));
+  key->dev   = buf->st_dev;
+  key->ino   = buf->st_ino;
+  key->size  = buf->st_size;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  key->mtime = (long long)buf->st_mtim.tv_sec * 1000000000LL + buf->st_mtim.tv_nsec;
+  key->ctime = (long long)buf->st_ctim.tv_sec * 1000000000LL + buf->st_ctim.tv_nsec;
+#else
+  key->mtime = (long long)buf->st_mtime * 1000000000LL;
+  key->ctime = (long long)buf->st_ctime * 1000000000LL;
+#endif
+}
+
+
 /**
  * Test for associated path permission change
  */
@@ -1023,165 +1375,191 @@ static void check_size(Service_T s) {
  * Match content
  */
 static void check_match(Service_T s) {
-  int  advance = 0;
-  int  length = 0;
-  FILE *file;
-  char line[MATCH_LINE_LENGTH];
+  int     fd;
+  int     skip = FALSE;
+  int     limited = FALSE;
+  off_t   skipped = 0;
+  size_t  used = 0;
+  unsigned long lines = 0;
+  unsigned long long bytes = 0;
+  ssize_t n;
+  char   *buffer;
+  int    *matched;
+  char    line[MATCH_LINE_LENGTH];
     
-  ASSERT(s && s->matchlist);
+  ASSERT(s && s->matchlist && s->matcher);
 
   /* If inode changed or size shrinked -> set read position = 0 */
   if (s->inf->priv.file.st_ino != s->inf->priv.file.st_ino_prev || s->inf->priv.file.readpos > s->inf->priv.file.st_size)
     s->inf->priv.file.readpos = 0;
   
   /* Do we need to match? */
+  s->inf->priv.file.match_backlog = 0;
   if (s->inf->priv.file.readpos == s->inf->priv.file.st_size)
     return;
 
   /* Open the file */
-  if (! (file = fopen(s->path, "r"))) {
+  if ((fd = open(s->path, O_RDONLY)) == -1) {
     LogError("'%s' cannot open file %s: %s\n", s->name, s->path, STRERROR);
     return;
   }
 
+  /* Seek to the read position */
+  if (lseek(fd, s->inf->priv.file.readpos, SEEK_SET) == -1) {
+    LogError("'%s' cannot seek file %s: %s\n", s->name, s->path, STRERROR);
+    goto final;
+  }
+
+  /* The file is read by blocks and the complete lines are matched in place.
+   * The incomplete line at the end of the block is moved to the beginning
+   * of the buffer and completed by the next read. The incomplete line at
+   * the end of the file is read next time. If the match limit is reached,
+   * the matching resumes from the read position in the next cycle. */
+  buffer = xmalloc(MATCH_BUFFER_SIZE);
+  matched = xcalloc(Matcher_count(s->matcher), sizeof(int));
   while (TRUE) {
-    
-    /* Seek to the read position */
-    if (fseek(file, s->inf->priv.file.readpos, SEEK_SET)) {
-      LogError("'%s' cannot seek file %s: %s\n", s->name, s->path, STRERROR);
-      goto final;
-    }
+    char *start, *end, *nl;
 
-    if (! fgets(line, MATCH_LINE_LENGTH, file)) {
-      if (! feof(file))
+    do {
+      n = read(fd, buffer + used, MATCH_BUFFER_SIZE - used);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+      if (n < 0)
         LogError("'%s' cannot read file %s: %s\n", s->name, s->path, STRERROR);
-      goto final;
+      break;
     }
-    
-    length = strlen(line);
-
-    /* Empty line? Should not happen... but who knows */
-    if (length == 0)
-      goto final;
-
-    /* Complete line or just beginning? (ignore full buffers) */
-    if (length < MATCH_LINE_LENGTH-1 && line[length-1] != '\n')
-      goto final; /* we gonna read it next time */
-
-    advance = length;
-    
-    /*
-     * Does this line end with '\n'? Otherwise ignore and check it
-     * as soon as it is complete
-     */
-    if (length == MATCH_LINE_LENGTH-1) {
-      int rv = 0;
-
-      while ((unsigned char)rv != '\n' && rv != EOF) {
-        rv = fgetc(file);
-        advance++;
+    used += n;
+
+    start = buffer;
+    end   = buffer + used;
+    while ((nl = memchr(start, '\n', end - start))) {
+      size_t length = nl - start;
+
+      *nl = 0;
+      if (skip) {
+        /* End of the long line, set read position after it and match its beginning */
+        s->inf->priv.file.readpos += skipped + length + 1;
+        bytes += skipped + length + 1;
+        skip = FALSE;
+        skipped = 0;
+        check_match_if(s, line, matched);
+      } else {
+        s->inf->priv.file.readpos += length + 1;
+        bytes += length + 1;
+        /* Just the beginning of a long line is matched */
+        if (length > MATCH_LINE_LENGTH - 1)
+          start[MATCH_LINE_LENGTH - 1] = 0;
+        check_match_if(s, start, matched);
       }
-
-      if (rv == EOF)
+      start = nl + 1;
+      lines++;
+      if (s->matchlimit &&
+          ((s->matchlimit->bytes && bytes >= s->matchlimit->bytes) ||
+           (s->matchlimit->lines && lines >= s->matchlimit->lines))) {
+        limited = TRUE;
         break;
+      }
     }
+    if (limited)
+      break;
 
-    /* Set read position to the end of last read */
-    s->inf->priv.file.readpos += advance;
-
-    /* Remove appending newline */
-    if (line[length-1] == '\n')
-      line[length-1] = 0;
-
-    check_match_if (s, line);
+    used = end - start;
+    if (skip) {
+      skipped += used;
+      used = 0;
+    } else if (used == MATCH_BUFFER_SIZE) {
+      /* The line is longer than the buffer, keep its beginning and skip the rest up to the newline */
+      memcpy(line, start, MATCH_LINE_LENGTH - 1);
+      line[MATCH_LINE_LENGTH - 1] = 0;
+      skip = TRUE;
+      skipped = used;
+      used = 0;
+    } else if (used && start != buffer) {
+      memmove(buffer, start, used);
+    }
+  }
+  FREE(matched);
+  FREE(buffer);
+
+  if (limited) {
+    struct stat stat_buf;
+    off_t size = fstat(fd, &stat_buf) == 0 ? stat_buf.st_size : s->inf->priv.file.st_size;
+
+    if (size > s->inf->priv.file.readpos) {
+      if (s->matchlimit->skip) {
+        /* Skip the backlog, the matching continues from the last line of the
+         * file, which may be still incomplete */
+        off_t tail = last_line(fd, s->inf->priv.file.readpos, size);
+
+        if (tail > s->inf->priv.file.readpos) {
+          LogWarning("'%s' match limit reached -- skipping %llu B to the end of file %s\n", s->name, (unsigned long long)(tail - s->inf->priv.file.readpos), s->path);
+          s->inf->priv.file.match_skipped += tail - s->inf->priv.file.readpos;
+          s->inf->priv.file.readpos = tail;
+        }
+      } else {
+        s->inf->priv.file.match_backlog = size - s->inf->priv.file.readpos;
+        DEBUG("'%s' match limit reached -- %llu B left for the next cycle\n", s->name, (unsigned long long)s->inf->priv.file.match_backlog);
+      }
+    }
   }
 
   final:
-  if (fclose(file))
+  if (close(fd))
     LogError("'%s' cannot close file %s: %s\n", s->name, s->path, STRERROR);
 }
 
 /**
- * Match line for "ignore" statements
+ * Find the beginning of the last line of the file, searching backwards
+ * from size down to the offset from.
+ * @return The offset following the last newline before size, or from if
+ * there is no newline or the file cannot be read
  */
-static int check_match_ignore(Service_T s, char *line) {
-  int     rv = FALSE;
-  int     match_return;
-  Match_T ml;
-  Match_T prev = NULL;
-  
-  /* Check ignores */
+static off_t last_line(int fd, off_t from, off_t size) {
+  char  block[STRLEN];
+  off_t offset = size;
 
-  for (ml = s->matchlist; ml; prev = ml, ml = ml->next) {
-    if (ml->ignore) {
-#ifdef HAVE_REGEX_H
-      match_return = regexec(ml->regex_comp, line, 0, NULL, 0);
-#else
-      if (strstr(line, ml->match_string) == NULL)
-        match_return = -1;
-      else
-        match_return = 0;
-#endif
-      if ((match_return == 0)  ^ (ml->not)) {
-        /* We match! -> line is ignored! */
-        DEBUG("'%s' Regular expression %s'%s' ignore match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
-        rv = TRUE;
-        break;
-      }
-    }
-  }
-
-  /* Optimize match list => put recent match in front */
+  while (offset > from) {
+    ssize_t n = MIN((off_t)sizeof(block), offset - from);
 
-  if (prev != NULL && rv == TRUE) {
-    prev->next   = ml->next;
-    ml->next     = s->matchlist;
-    s->matchlist = ml;
+    offset -= n;
+    if (pread(fd, block, n, offset) != n)
+      break;
+    while (n--)
+      if (block[n] == '\n')
+        return offset + n + 1;
   }
-  
-  return rv;
+  return from;
 }
 
+
 /**
- * Match line for "if" statements
+ * Match line for "if" statements, all rules are tested by one scan of
+ * the line. The processing stops at the first matching rule if an
+ * "ignore" statement matches the line too.
  */
-static void check_match_if (Service_T s, char *line) {
-  int     match_return;
-  int     ignore_tested = FALSE;
+static void check_match_if(Service_T s, char *line, int *matched) {
+  int     i;
   Match_T ml;
-
-  /* Check non ignores */
-  
-  for (ml = s->matchlist; ml; ml = ml->next) {
-   
-    if (! ml->ignore) {
-
-#ifdef HAVE_REGEX_H
-      match_return = regexec(ml->regex_comp, line, 0, NULL, 0);
-#else
-      if (strstr(line, ml->match_string) == NULL)
-        match_return = -1;
-      else
-        match_return = 0;
-#endif
-
-      if ((match_return == 0) ^ (ml->not)) {
-        /* Check if we have to test for ignores! */
-        if (! ignore_tested && check_match_ignore(s, line))
-          return;
-        
-        DEBUG("'%s' Regular expression %s'%s' match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
-        Event_post(s, Event_Content, STATE_CHANGED, ml->action, "content match [%s]", line);
-      } else {
-        DEBUG("'%s' Regular expression %s'%s' doesn't match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
-        Event_post(s, Event_Content, STATE_CHANGEDNOT, ml->action, "content doesn't match [%s]", line);
+  Match_T ignore = Matcher_match(s->matcher, line, matched);
+
+  for (i = 0, ml = s->matchlist; ml; ml = ml->next, i++) {
+    if (ml->ignore)
+      continue;
+    if (matched[i]) {
+      if (ignore) {
+        DEBUG("'%s' Regular expression %s'%s' ignore match on content line\n", s->name, ignore->not ? "not " : "", ignore->match_string);
+        return;
       }
+      DEBUG("'%s' Regular expression %s'%s' match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
+      Event_post(s, Event_Content, STATE_CHANGED, ml->action, "content match [%s]", line);
+    } else {
+      DEBUG("'%s' Regular expression %s'%s' doesn't match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
+      Event_post(s, Event_Content, STATE_CHANGEDNOT, ml->action, "content doesn't match [%s]", line);
     }
   }
-  
-  return;
 }
 
+
 /**
  * Test filesystem flags for possible change since last cycle
  */
@@ -1313,13 +1691,152 @@ static int check_skip(Service_T s) {
  */
 static int do_scheduled_action(Service_T s) {
   int rv = FALSE;
-  if (s->doaction != ACTION_IGNORE) {
-    // FIXME: let the event engine do the action directly? (just replace s->action_ACTION with s->doaction and drop control_service call)
-    rv = control_service(s->name, s->doaction);
-    Event_post(s, Event_Action, STATE_CHANGED, s->action_ACTION, "%s action done", actionnames[s->doaction]);
-    s->doaction = ACTION_IGNORE;
-    FREE(s->token);
-  }
+  LOCK(Run.mutex)
+    if (s->doaction != ACTION_IGNORE) {
+      // FIXME: let the event engine do the action directly? (just replace s->action_ACTION with s->doaction and drop control_service call)
+      rv = control_service(s->name, s->doaction);
+      Event_post(s, Event_Action, STATE_CHANGED, s->action_ACTION, "%s action done", actionnames[s->doaction]);
+      s->doaction = ACTION_IGNORE;
+      FREE(s->token);
+    }
+  END_LOCK;
   return rv;
 }
 
+
+/**
+ * Run the scheduled action and the checks of the service for this cycle
+ * @param s A Service object
+ * @return FALSE if the service check failed, otherwise TRUE
+ */
+static int validate_service(Service_T s) {
+  int rv = TRUE;
+  int docheck;
+
+  ASSERT(s);
+
+  LOCK(s->mutex)
+    /* The dependency flags and counters are shared with the event handling */
+    LOCK(Run.mutex)
+      if ((docheck = (! do_scheduled_action(s) && s->monitor && ! check_skip(s))))
+        check_timeout(s); // Can disable monitoring => need to check s->monitor again
+    END_LOCK;
+    if (docheck && s->monitor) {
+      rv = s->check(s);
+      /* The monitoring may be disabled by some matching rule in s->check
+       * so we have to check again before setting to MONITOR_YES */
+      if (s->monitor != MONITOR_NOT)
+        s->monitor = MONITOR_YES;
+    }
+    gettimeofday(&s->collected, NULL);
+  END_LOCK;
+
+  return rv;
+}
+
+
+/**
+ * Validate the services using a pool of Run.workers threads. The service
+ * list is sorted by dependencies, a service is dispatched only when all
+ * services it depends on were checked in this cycle, so the dependency
+ * chain is handled in the same order as in the sequential validation.
+ * @return The number of failed service checks
+ */
+static int validate_concurrently() {
+  int        i, j;
+  int        workers = 0;
+  pthread_t *worker;
+  Service_T  s;
+
+  for (jobs_num = 0, s = servicelist; s; s = s->next)
+    jobs_num++;
+  jobs        = xcalloc(sizeof(ValidateJob_T), jobs_num);
+  jobs_next   = 0;
+  jobs_errors = 0;
+  for (i = 0, s = servicelist; s; s = s->next, i++)
+    jobs[i].s = s;
+
+  /* Link the services with the services they depend on */
+  for (i = 0; i < jobs_num; i++) {
+    Dependant_T d;
+
+    for (d = jobs[i].s->dependantlist; d; d = d->next) {
+      for (j = 0; j < i; j++) {
+        if (IS(d->dependant, jobs[j].s->name)) {
+          jobs[j].dependants = xresize(jobs[j].dependants, (jobs[j].dependants_num + 1) * sizeof(int));
+          jobs[j].dependants[jobs[j].dependants_num++] = i;
+          jobs[i].pending++;
+          break;
+        }
+      }
+    }
+  }
+
+  worker = xcalloc(sizeof(pthread_t), Run.workers);
+  for (i = 0; i < Run.workers && i < jobs_num; i++) {
+    int status;
+
+    if ((status = pthread_create(&worker[workers], NULL, validate_worker, NULL)) != 0) {
+      LogError("%s: Failed to create the validation thread -- %s\n", prog, strerror(status));
+      break;
+    }
+    workers++;
+  }
+  /* Validate in this thread if no worker could be started */
+  if (! workers)
+    validate_worker(NULL);
+  for (i = 0; i < workers; i++)
+    pthread_join(worker[i], NULL);
+  FREE(worker);
+
+  for (i = 0; i < jobs_num; i++)
+    FREE(jobs[i].dependants);
+  FREE(jobs);
+
+  return jobs_errors;
+}
+
+
+/**
+ * The validation thread. Takes the first job whose dependencies are done
+ * and waits if there is none until some running job finishes.
+ */
+static void *validate_worker(void *arg) {
+  while (TRUE) {
+    int            i;
+    ValidateJob_T *job = NULL;
+
+    LOCK(jobs_mutex)
+      while (! Run.stopped && jobs_next < jobs_num) {
+        for (i = jobs_next; i < jobs_num; i++) {
+          if (jobs[i].state == JOB_WAITING && ! jobs[i].pending) {
+            job = &jobs[i];
+            job->state = JOB_RUNNING;
+            break;
+          }
+        }
+        while (jobs_next < jobs_num && jobs[jobs_next].state != JOB_WAITING)
+          jobs_next++;
+        if (job)
+          break;
+        pthread_cond_wait(&jobs_cond, &jobs_mutex);
+      }
+    END_LOCK;
+
+    if (! job)
+      break;
+
+    i = validate_service(job->s);
+
+    LOCK(jobs_mutex)
+      if (! i)
+        jobs_errors++;
+      job->state = JOB_DONE;
+      for (i = 0; i < job->dependants_num; i++)
+        jobs[job->dependants[i]].pending--;
+      pthread_cond_broadcast(&jobs_cond);
+    END_LOCK;
+  }
+  return NULL;
+}
+
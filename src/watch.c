@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "monit.h"
+#include "watch.h"
+
+
+/**
+ *  Watch the paths of file, directory and fifo services for changes.
+ *
+ *  The parent directory of each path is watched and the events are
+ *  filtered by the file name, so the watch survives the replacement
+ *  of the file, such as a log rotation. A directory service watches
+ *  the directory itself too, to see the changes of its content. The
+ *  lost watches (the path or its parent was removed) are re-added on
+ *  every wait, the service is considered changed until the watch is
+ *  established.
+ *
+ *  The watch table is used from the main thread only, the validation
+ *  doesn't run while the daemon waits for the events.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/* Changes of the service's path reported by the parent directory */
+#define WATCH_PARENT_MASK (IN_MODIFY|IN_ATTRIB|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)
+
+/* Changes of the content of a directory service */
+#define WATCH_SELF_MASK   (IN_ATTRIB|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+/* Time to collect the following events of a changing path in milliseconds */
+#define WATCH_SETTLE 100
+
+typedef struct mywatch {
+  Service_T s;                                          /**< Watched service */
+  char     *dir;                               /**< Parent directory of path */
+  char     *name;                                 /**< File name of the path */
+  int       parent;         /**< Parent directory watch descriptor or -1 */
+  int       self;              /**< Directory watch descriptor or -1 */
+} Watch_T;
+
+static int      watch_fd = -1;
+static Watch_T *watches = NULL;
+static int      watches_num = 0;
+
+#endif
+
+
+/* -------------------------------------------------------------- Prototypes */
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void rewatch();
+static int  changed(Watch_T *, const char *);
+static int  drop(int);
+static int  handle_events();
+#endif
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Watch_start() {
+  Service_T s;
+
+  for (s = servicelist; s; s = s->next)
+    s->changed = TRUE;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  {
+    int i = 0;
+
+    for (s = servicelist; s; s = s->next)
+      if (s->watch != WATCH_NONE)
+        watches_num++;
+    if (! watches_num)
+      return;
+
+    if ((watch_fd = inotify_init()) == -1) {
+      LogError("%s: Cannot initialize inotify -- %s\n", prog, STRERROR);
+      for (s = servicelist; s; s = s->next)
+        s->watch = WATCH_NONE;
+      watches_num = 0;
+      return;
+    }
+    fcntl(watch_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(watch_fd, F_SETFL, fcntl(watch_fd, F_GETFL) | O_NONBLOCK);
+
+    watches = xcalloc(watches_num, sizeof(Watch_T));
+    for (s = servicelist; s; s = s->next) {
+      if (s->watch != WATCH_NONE) {
+        Watch_T *W = &watches[i++];
+        char *slash = strrchr(s->path, '/');
+
+        W->s      = s;
+        W->dir    = slash && slash != s->path ? xstrndup(s->path, slash - s->path) : xstrdup("/");
+        W->name   = xstrdup(slash ? slash + 1 : s->path);
+        W->parent = -1;
+        W->self   = -1;
+      }
+    }
+    rewatch();
+  }
+#else
+  for (s = servicelist; s; s = s->next) {
+    if (s->watch != WATCH_NONE) {
+      LogWarning("%s: Warning: path watch is not supported on this system -- '%s' is checked every cycle\n", prog, s->name);
+      s->watch = WATCH_NONE;
+    }
+  }
+#endif
+}
+
+
+void Watch_stop() {
+#ifdef HAVE_SYS_INOTIFY_H
+  int i;
+
+  for (i = 0; i < watches_num; i++) {
+    FREE(watches[i].dir);
+    FREE(watches[i].name);
+  }
+  FREE(watches);
+  watches_num = 0;
+  if (watch_fd != -1) {
+    close(watch_fd);
+    watch_fd = -1;
+  }
+#endif
+}
+
+
+int Watch_wait(int timeout) {
+#ifdef HAVE_SYS_INOTIFY_H
+  int    immediate = FALSE;
+  time_t deadline = time(NULL) + timeout;
+
+  if (watch_fd == -1) {
+    sleep(timeout);
+    return FALSE;
+  }
+
+  while (! immediate) {
+    int rv;
+    time_t now = time(NULL);
+    struct pollfd fds = {watch_fd, POLLIN, 0};
+
+    rewatch();
+    if (now >= deadline)
+      break;
+    if ((rv = poll(&fds, 1, (int)(deadline - now) * 1000)) == 0)
+      break;
+    if (rv < 0) {
+      /* Interrupted by a signal, return like sleep() does */
+      if (errno != EINTR)
+        LogError("%s: Watch poll failed -- %s\n", prog, STRERROR);
+      break;
+    }
+    if ((immediate = handle_events())) {
+      /* Give the writer a moment to finish, so a burst of writes wakes us once */
+      if (poll(&fds, 1, WATCH_SETTLE) > 0)
+        handle_events();
+    }
+  }
+
+  return immediate;
+#else
+  sleep(timeout);
+  return FALSE;
+#endif
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/**
+ * Add the missing watches. A service is marked as changed when its watch
+ * is (re)established or if it cannot be watched, because the changes
+ * made while the path was not watched are unknown.
+ */
+static void rewatch() {
+  int i;
+
+  for (i = 0; i < watches_num; i++) {
+    Watch_T *W = &watches[i];
+
+    if (W->parent == -1) {
+      W->parent = inotify_add_watch(watch_fd, W->dir, WATCH_PARENT_MASK|IN_MASK_ADD);
+      W->s->changed = TRUE;
+    }
+    if (W->s->type == TYPE_DIRECTORY && W->self == -1) {
+      W->self = inotify_add_watch(watch_fd, W->s->path, WATCH_SELF_MASK|IN_MASK_ADD);
+      W->s->changed = TRUE;
+    }
+  }
+}
+
+
+/**
+ * Mark the service as changed
+ * @return TRUE if the service is watched with WATCH_IMMEDIATE
+ */
+static int changed(Watch_T *W, const char *reason) {
+  DEBUG("'%s' path %s %s\n", W->s->name, W->s->path, reason);
+  W->s->changed = TRUE;
+  return W->s->watch == WATCH_IMMEDIATE;
+}
+
+
+/**
+ * Forget the removed watch descriptor, the services using it are marked
+ * as changed and their watch is re-added by the next rewatch().
+ * @return TRUE if a service watched with WATCH_IMMEDIATE is affected
+ */
+static int drop(int wd) {
+  int i;
+  int immediate = FALSE;
+
+  for (i = 0; i < watches_num; i++) {
+    Watch_T *W = &watches[i];
+
+    if (W->parent == wd) {
+      W->parent = -1;
+      immediate |= changed(W, "watch removed");
+    }
+    if (W->self == wd) {
+      W->self = -1;
+      immediate |= changed(W, "watch removed");
+    }
+  }
+  return immediate;
+}
+
+
+/**
+ * Read the pending events and mark the changed services
+ * @return TRUE if a service watched with WATCH_IMMEDIATE changed
+ */
+static int handle_events() {
+  int     i;
+  int     immediate = FALSE;
+  ssize_t n;
+  union {
+    struct inotify_event event;
+    char buf[8192];
+  } u;
+
+  while ((n = read(watch_fd, u.buf, sizeof(u.buf))) > 0) {
+    char *p;
+    struct inotify_event *e;
+
+    for (p = u.buf; p < u.buf + n; p += sizeof(struct inotify_event) + e->len) {
+      e = (struct inotify_event *)p;
+
+      if (e->mask & IN_Q_OVERFLOW) {
+        /* Some events were lost */
+        for (i = 0; i < watches_num; i++)
+          immediate |= changed(&watches[i], "may have changed (event queue overflow)");
+        continue;
+      }
+
+      if (e->mask & IN_IGNORED) {
+        immediate |= drop(e->wd);
+        continue;
+      }
+
+      for (i = 0; i < watches_num; i++) {
+        Watch_T *W = &watches[i];
+
+        if (e->wd == W->self) {
+          immediate |= changed(W, "content changed");
+        } else if (e->wd == W->parent && e->len && ! strcmp(e->name, W->name)) {
+          /* The directory was replaced, its old watch is useless */
+          if (W->self != -1 && (e->mask & (IN_DELETE|IN_MOVED_FROM))) {
+            inotify_rm_watch(watch_fd, W->self);
+            immediate |= drop(W->self);
+          }
+          immediate |= changed(W, "changed");
+        }
+      }
+    }
+  }
+  if (n < 0 && errno != EAGAIN && errno != EINTR)
+    LogError("%s: Cannot read inotify events -- %s\n", prog, STRERROR);
+
+  return immediate;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_WATCH_H
+#define MONIT_WATCH_H
+
+
+/**
+ *  Watch the paths of file, directory and fifo services for changes
+ *  using inotify. A change sets the service's changed flag, so the
+ *  expensive tests run only if the path changed, and services watched
+ *  with WATCH_IMMEDIATE wake the sleeping daemon. If inotify is not
+ *  available or a path cannot be watched, the service is considered
+ *  changed in every cycle.
+ *
+ *  @file
+ */
+
+
+/**
+ * Start watching the paths of the services with a watch mode set. The
+ * watched services are marked as changed, so the first cycle runs all
+ * tests.
+ */
+void Watch_start();
+
+
+/**
+ * Stop watching and release the watch table. Must be called before
+ * the service list is released.
+ */
+void Watch_stop();
+
+
+/**
+ * Sleep for the given time while handling the path change events. The
+ * function returns earlier if a signal was received or if the path of
+ * a service watched with WATCH_IMMEDIATE changed.
+ * @param timeout The time to sleep in seconds
+ * @return TRUE if a service watched with WATCH_IMMEDIATE changed,
+ * otherwise FALSE
+ */
+int Watch_wait(int timeout);
+
+
+#endif
@@ -48,6 +48,7 @@
 #include "monit.h"
 #include "event.h"
 #include "process.h"
+#include "xxhash.h"
 
 
 /**
@@ -62,11 +63,12 @@
 /* -------------------------------------------------------------- Prototypes */
 
 
-static void document_head(Buffer_T *, int, const char *);
+static void document_head(Buffer_T *, int, const char *, int);
 static void document_foot(Buffer_T *);
 static void status_service(Service_T, Buffer_T *, short, int);
 static void status_servicegroup(ServiceGroup_T, Buffer_T *, short);
 static void status_event(Event_T, Buffer_T *);
+static unsigned long long status_hash(const char *);
 
 
 /* ------------------------------------------------------------------ Public */
@@ -84,31 +86,98 @@ static void status_event(Event_T, Buffer_T *);
  */
 char *status_xml(Event_T E, short L, int V, const char *myip) {
   Buffer_T  B;
-  Service_T S;
-  ServiceGroup_T SG;
 
   memset(&B, 0, sizeof(Buffer_T));
 
-  document_head(&B, V, myip);
+  status_xml_buffer(&B, E, L, V, myip);
+
+  return B.buf;
+
+}
+
+
+/**
+ * Append XML formated message for event notification or general status
+ * of monitored services and resources to the given buffer.
+ * @param B Buffer object
+ * @param E An event object or NULL for general status
+ * @param L Status information level
+ * @param V Format version
+ * @param myip The client-side IP address
+ */
+void status_xml_buffer(Buffer_T *B, Event_T E, short L, int V, const char *myip) {
+  Service_T S;
+  ServiceGroup_T SG;
+
+  document_head(B, V, myip, FALSE);
 
   if (V == 2)
-    Util_stringbuffer(&B, "<services>");
+    Util_stringbuffer(B, "<services>");
   for (S = servicelist_conf; S; S = S->next_conf)
-    status_service(S, &B, L, V);
+    status_service(S, B, L, V);
   if (V == 2) {
-    Util_stringbuffer(&B, "</services>"
-                          "<servicegroups>");
+    Util_stringbuffer(B, "</services>"
+                         "<servicegroups>");
     for (SG = servicegrouplist; SG; SG = SG->next)
-      status_servicegroup(SG, &B, L);
-    Util_stringbuffer(&B, "</servicegroups>");
+      status_servicegroup(SG, B, L);
+    Util_stringbuffer(B, "</servicegroups>");
   }
   if (E)
-    status_event(E, &B);
+    status_event(E, B);
+
+  document_foot(B);
+
+}
+
+
+/**
+ * Return XML formated full status report of the services for M/Monit.
+ * In the delta mode only the services whose status changed since the
+ * last acknowledged report are included and the monit element has the
+ * delta attribute set. The service status is compared by a hash which
+ * doesn't cover the collection time.
+ * @param delta TRUE for the delta report, FALSE for the complete report
+ * @param myip The client-side IP address
+ * @return XML document. The caller must free the memory.
+ */
+char *status_xml_report(int delta, const char *myip) {
+  Buffer_T       B;
+  Service_T      S;
+  ServiceGroup_T SG;
+
+  memset(&B, 0, sizeof(Buffer_T));
 
+  document_head(&B, 2, myip, delta);
+  Util_stringbuffer(&B, "<services>");
+  for (S = servicelist_conf; S; S = S->next_conf) {
+    size_t start = B.bufused;
+
+    status_service(S, &B, LEVEL_FULL, 2);
+    S->report_sent = status_hash(B.buf + start);
+    if (delta && S->report_sent == S->report_acked) {
+      B.bufused = start;
+      B.buf[start] = 0;
+    }
+  }
+  Util_stringbuffer(&B, "</services><servicegroups>");
+  for (SG = servicegrouplist; SG; SG = SG->next)
+    status_servicegroup(SG, &B, LEVEL_FULL);
+  Util_stringbuffer(&B, "</servicegroups>");
   document_foot(&B);
 
   return B.buf;
+}
+
 
+/**
+ * Mark the last status report as acknowledged by M/Monit, the following
+ * delta report contains the services which changed since.
+ */
+void status_xml_acknowledge() {
+  Service_T S;
+
+  for (S = servicelist_conf; S; S = S->next_conf)
+    S->report_acked = S->report_sent;
 }
 
 
@@ -120,17 +189,19 @@ char *status_xml(Event_T E, short L, int V, const char *myip) {
  * @param B Buffer object
  * @param V Format version
  * @param myip The client-side IP address
+ * @param delta TRUE if the document is a delta status report
  */
-static void document_head(Buffer_T *B, int V, const char *myip) {
+static void document_head(Buffer_T *B, int V, const char *myip, int delta) {
   Util_stringbuffer(B,
     "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>");
   if (V == 2) {
     Util_stringbuffer(B,
-      "<monit id=\"%s\" incarnation=\"%lld\" version=\"%s\">"
+      "<monit id=\"%s\" incarnation=\"%lld\" version=\"%s\"%s>"
       "<server>",
       Run.id,
       (long long)Run.incarnation,
-      VERSION);
+      VERSION,
+      delta ? " delta=\"1\"" : "");
   } else {
     Util_stringbuffer(B,
       "<monit>"
@@ -345,9 +416,11 @@ static void status_service(Service_T S, Buffer_T *B, short L, int V) {
   		  "<icmp>"
   		  "<type>%s</type>"
   		  "<responsetime>%.3f</responsetime>"
+  		  "<packetloss>%.0f</packetloss>"
   		  "</icmp>",
   		  icmpnames[i->type],
-  		  i->is_available?i->response:-1.);
+  		  i->is_available?i->response:-1.,
+  		  i->loss);
         }
       }
       if((S->type == TYPE_HOST || S->type == TYPE_PROCESS) && S-> portlist) {
@@ -479,3 +552,29 @@ static void status_event(Event_T E, Buffer_T *B) {
     "</event>");
 }
 
+
+/**
+ * Hash of the service status, the collection time is not covered
+ * @param s The service status XML
+ * @return The hash value
+ */
+static unsigned long long status_hash(const char *s) {
+  int                i;
+  const char        *p;
+  const char        *q;
+  unsigned long long h = 0;
+  unsigned char      sum[XXH64_SIZE];
+  struct xxh64_ctx   ctx;
+
+  xxh64_init_ctx(&ctx);
+  if ((p = strstr(s, "<collected_sec>")) && (q = strstr(p, "</collected_usec>"))) {
+    xxh64_process_bytes(s, p - s, &ctx);
+    s = q;
+  }
+  xxh64_process_bytes(s, strlen(s), &ctx);
+  xxh64_finish_ctx(&ctx, sum);
+  for (i = 0; i < XXH64_SIZE; i++)
+    h = (h << 8) | sum[i];
+  return h;
+}
+
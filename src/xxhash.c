@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "xxhash.h"
+
+
+/**
+ *  XXH64 hash by Yann Collet, implemented from the public specification
+ *  (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md).
+ *  The input is read byte by byte in little endian order, so the result
+ *  doesn't depend on the host byte order and alignment.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+
+/* -------------------------------------------------------------- Prototypes */
+
+
+static xxh64_uint64 read64(const unsigned char *);
+static xxh64_uint64 read32(const unsigned char *);
+static xxh64_uint64 xxh64_round(xxh64_uint64, xxh64_uint64);
+static xxh64_uint64 xxh64_merge(xxh64_uint64, xxh64_uint64);
+static const unsigned char *xxh64_stripes(struct xxh64_ctx *, const unsigned char *, const unsigned char *);
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void xxh64_init_ctx(struct xxh64_ctx *ctx) {
+  memset(ctx, 0, sizeof(struct xxh64_ctx));
+  ctx->v[0] = PRIME64_1 + PRIME64_2;
+  ctx->v[1] = PRIME64_2;
+  ctx->v[2] = 0;
+  ctx->v[3] = 0 - PRIME64_1;
+}
+
+
+void xxh64_process_bytes(const void *buffer, size_t len, struct xxh64_ctx *ctx) {
+  const unsigned char *p = buffer;
+  const unsigned char *end = p + len;
+
+  ctx->total += len;
+
+  /* Complete the buffered stripe first */
+  if (ctx->buflen) {
+    size_t fill = 32 - ctx->buflen;
+
+    if (len < fill) {
+      memcpy(ctx->buffer + ctx->buflen, p, len);
+      ctx->buflen += len;
+      return;
+    }
+    memcpy(ctx->buffer + ctx->buflen, p, fill);
+    xxh64_stripes(ctx, ctx->buffer, ctx->buffer + 32);
+    ctx->buflen = 0;
+    p += fill;
+  }
+
+  p = xxh64_stripes(ctx, p, end);
+
+  if (p < end) {
+    ctx->buflen = end - p;
+    memcpy(ctx->buffer, p, ctx->buflen);
+  }
+}
+
+
+void *xxh64_finish_ctx(struct xxh64_ctx *ctx, void *resbuf) {
+  int i;
+  xxh64_uint64 h;
+  const unsigned char *p = ctx->buffer;
+  const unsigned char *end = p + ctx->buflen;
+  unsigned char *r = resbuf;
+
+  if (ctx->total >= 32) {
+    h = ROTL64(ctx->v[0], 1) + ROTL64(ctx->v[1], 7) + ROTL64(ctx->v[2], 12) + ROTL64(ctx->v[3], 18);
+    for (i = 0; i < 4; i++)
+      h = xxh64_merge(h, ctx->v[i]);
+  } else {
+    h = PRIME64_5;
+  }
+  h += ctx->total;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxh64_round(0, read64(p));
+    h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+  if (p + 4 <= end) {
+    h ^= read32(p) * PRIME64_1;
+    h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= *p * PRIME64_5;
+    h = ROTL64(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  for (i = XXH64_SIZE - 1; i >= 0; i--, h >>= 8)
+    r[i] = (unsigned char)h;
+
+  return resbuf;
+}
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static xxh64_uint64 read64(const unsigned char *p) {
+  return (xxh64_uint64)p[0]       | (xxh64_uint64)p[1] << 8  | (xxh64_uint64)p[2] << 16 | (xxh64_uint64)p[3] << 24 |
+         (xxh64_uint64)p[4] << 32 | (xxh64_uint64)p[5] << 40 | (xxh64_uint64)p[6] << 48 | (xxh64_uint64)p[7] << 56;
+}
+
+
+static xxh64_uint64 read32(const unsigned char *p) {
+  return (xxh64_uint64)p[0] | (xxh64_uint64)p[1] << 8 | (xxh64_uint64)p[2] << 16 | (xxh64_uint64)p[3] << 24;
+}
+
+
+static xxh64_uint64 xxh64_round(xxh64_uint64 acc, xxh64_uint64 input) {
+  acc += input * PRIME64_2;
+  acc = ROTL64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+
+static xxh64_uint64 xxh64_merge(xxh64_uint64 acc, xxh64_uint64 v) {
+  acc ^= xxh64_round(0, v);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+
+/**
+ * Process the complete 32 byte stripes of the data
+ * @return The start of the remaining incomplete stripe
+ */
+static const unsigned char *xxh64_stripes(struct xxh64_ctx *ctx, const unsigned char *p, const unsigned char *end) {
+  xxh64_uint64 v0 = ctx->v[0];
+  xxh64_uint64 v1 = ctx->v[1];
+  xxh64_uint64 v2 = ctx->v[2];
+  xxh64_uint64 v3 = ctx->v[3];
+
+  /* The four independent lanes keep the multipliers of the CPU busy */
+  for (; end - p >= 32; p += 32) {
+    v0 = xxh64_round(v0, read64(p));
+    v1 = xxh64_round(v1, read64(p + 8));
+    v2 = xxh64_round(v2, read64(p + 16));
+    v3 = xxh64_round(v3, read64(p + 24));
+  }
+
+  ctx->v[0] = v0;
+  ctx->v[1] = v1;
+  ctx->v[2] = v2;
+  ctx->v[3] = v3;
+  return p;
+}
+
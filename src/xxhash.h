@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_XXHASH_H
+#define MONIT_XXHASH_H
+
+
+/**
+ *  XXH64 non-cryptographic hash. The hash is several times faster than
+ *  MD5 and SHA1 and is suitable for the detection of accidental changes
+ *  only, it gives no protection against a deliberate modification. The
+ *  interface follows the md5 and sha functions.
+ *
+ *  @file
+ */
+
+
+/* The size of the hash in bytes */
+#define XXH64_SIZE 8
+
+
+typedef unsigned long long xxh64_uint64;
+
+
+/* Structure to save state of computation between the single steps */
+struct xxh64_ctx {
+  xxh64_uint64  total;                           /**< Processed bytes count */
+  xxh64_uint64  v[4];                                    /**< Accumulators */
+  unsigned char buffer[32];                     /**< Incomplete stripe data */
+  size_t        buflen;                        /**< Incomplete stripe length */
+};
+
+
+/**
+ * Initialize the hash context with the seed 0
+ * @param ctx The context
+ */
+void xxh64_init_ctx(struct xxh64_ctx *ctx);
+
+
+/**
+ * Update the context with the next len bytes of the buffer. The length
+ * doesn't need to be a multiple of the stripe size.
+ * @param buffer The data
+ * @param len The data length
+ * @param ctx The context
+ */
+void xxh64_process_bytes(const void *buffer, size_t len, struct xxh64_ctx *ctx);
+
+
+/**
+ * Write the hash to the first XXH64_SIZE bytes of resbuf in the big
+ * endian (canonical) byte order, the same as printed by xxhsum(1)
+ * @param ctx The context
+ * @param resbuf The result buffer
+ * @return The resbuf
+ */
+void *xxh64_finish_ctx(struct xxh64_ctx *ctx, void *resbuf);
+
+
+#endif